@@ -0,0 +1,47 @@
+﻿#include "pch.h"
+#include "AllocationCounter.h"
+
+namespace
+{
+    std::atomic<uint64_t> g_allocationCount = 0;
+}
+
+uint64_t GetAllocationCount()
+{
+    return g_allocationCount.load(std::memory_order_relaxed);
+}
+
+// Replacing the global operator new lets us count what the STL and C++/WinRT
+// allocate, including coroutine frames. The array and nothrow forms call
+// into this one. Over-aligned allocations aren't counted.
+void* operator new(size_t size)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0)
+    {
+        size = 1;
+    }
+    while (true)
+    {
+        if (auto result = malloc(size))
+        {
+            return result;
+        }
+        auto handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
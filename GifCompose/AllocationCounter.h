@@ -0,0 +1,5 @@
+﻿#pragma once
+
+// The number of allocations made through operator new since the process
+// started, across all threads.
+uint64_t GetAllocationCount();
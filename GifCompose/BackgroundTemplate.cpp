@@ -0,0 +1,95 @@
+﻿#include "pch.h"
+#include "BackgroundTemplate.h"
+#include "BitmapLoader.h"
+#include "ImageHeader.h"
+
+winrt::com_ptr<ID2D1Bitmap1> CreateBackgroundTemplate(
+    PipelineDevice const& device,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    ParallelDecoder& decoder,
+    std::wstring const& path,
+    D2D1_SIZE_U size)
+{
+    // Check the sizes from the headers before decoding anything, then load
+    // the backgrounds
+    CheckImageSizes(GetImageFilePaths(path), size, L"Background");
+    auto backgrounds = LoadBitmaps(decoder, device.D3DDevice, d2dContext, path);
+    for (auto&& background : backgrounds)
+    {
+        auto backgroundSize = background->GetPixelSize();
+        if (backgroundSize.width != size.width || backgroundSize.height != size.height)
+        {
+            throw winrt::hresult_invalid_argument(L"All backgrounds must be of the same size as the frames!");
+        }
+    }
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = size.width;
+    desc.Height = size.height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+    desc.SampleDesc.Count = 1;
+    winrt::com_ptr<ID3D11Texture2D> backgroundTemplateTexture;
+    winrt::check_hresult(device.D3DDevice->CreateTexture2D(&desc, nullptr, backgroundTemplateTexture.put()));
+    auto backgroundTemplate = CreateBitmapFromTexture(backgroundTemplateTexture, d2dContext);
+
+    // Draw our background template
+    auto lock = device.Lock();
+    d2dContext->SetTarget(backgroundTemplate.get());
+    auto clearColor = D2D1_COLOR_F{ 1.0f, 1.0f, 1.0f, 1.0f };
+    d2dContext->BeginDraw();
+    d2dContext->Clear(&clearColor);
+    for (auto&& background : backgrounds)
+    {
+        d2dContext->DrawBitmap(background.get());
+    }
+    winrt::check_hresult(d2dContext->EndDraw());
+    d2dContext->SetTarget(nullptr);
+
+    return backgroundTemplate;
+}
+
+winrt::com_ptr<ID2D1Bitmap1> BackgroundTemplateCache::GetOrCreate(
+    std::wstring const& path,
+    D2D1_SIZE_U size,
+    std::function<winrt::com_ptr<ID2D1Bitmap1>()> const& create)
+{
+    auto key = std::to_wstring(size.width) + L"x" + std::to_wstring(size.height) + L"|" + std::filesystem::canonical(path).wstring();
+
+    std::promise<winrt::com_ptr<ID2D1Bitmap1>> promise;
+    std::shared_future<winrt::com_ptr<ID2D1Bitmap1>> future;
+    auto shouldCreate = false;
+    {
+        std::scoped_lock lock(m_lock);
+        auto it = m_templates.find(key);
+        if (it == m_templates.end())
+        {
+            future = promise.get_future().share();
+            m_templates.emplace(key, future);
+            shouldCreate = true;
+        }
+        else
+        {
+            future = it->second;
+        }
+    }
+
+    if (shouldCreate)
+    {
+        try
+        {
+            promise.set_value(create());
+        }
+        catch (...)
+        {
+            // Let later jobs try again
+            promise.set_exception(std::current_exception());
+            std::scoped_lock lock(m_lock);
+            m_templates.erase(key);
+        }
+    }
+    return future.get();
+}
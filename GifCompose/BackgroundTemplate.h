@@ -0,0 +1,29 @@
+﻿#pragma once
+#include "PipelineDevice.h"
+#include "ImageDecoder.h"
+
+// Draws every background in the folder on top of each other over white.
+winrt::com_ptr<ID2D1Bitmap1> CreateBackgroundTemplate(
+    PipelineDevice const& device,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    ParallelDecoder& decoder,
+    std::wstring const& path,
+    D2D1_SIZE_U size);
+
+// Background templates shared between jobs that use the same backgrounds.
+// The template is only read once it's drawn, so any job on the same device
+// can use it. Safe to use from multiple threads.
+class BackgroundTemplateCache
+{
+public:
+    // Returns the template for the folder and size, calling create if no job
+    // has asked for it yet. Jobs asking while it's being created wait for it.
+    winrt::com_ptr<ID2D1Bitmap1> GetOrCreate(
+        std::wstring const& path,
+        D2D1_SIZE_U size,
+        std::function<winrt::com_ptr<ID2D1Bitmap1>()> const& create);
+
+private:
+    std::mutex m_lock;
+    std::unordered_map<std::wstring, std::shared_future<winrt::com_ptr<ID2D1Bitmap1>>> m_templates;
+};
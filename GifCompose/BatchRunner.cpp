@@ -0,0 +1,96 @@
+﻿#include "pch.h"
+#include "BatchRunner.h"
+#include "BackgroundTemplate.h"
+
+namespace winrt
+{
+    using namespace Windows::Data::Json;
+}
+
+namespace
+{
+    std::wstring GetJobPath(winrt::JsonObject const& job, std::wstring const& name, std::filesystem::path const& basePath)
+    {
+        if (!job.HasKey(name))
+        {
+            throw winrt::hresult_invalid_argument(L"Every job needs a '" + name + L"' path!");
+        }
+        std::filesystem::path path(job.GetNamedString(name).c_str());
+        if (path.is_relative())
+        {
+            path = basePath / path;
+        }
+        return path.wstring();
+    }
+}
+
+std::vector<BatchJob> LoadBatchJobs(std::filesystem::path const& manifestPath)
+{
+    std::ifstream stream(manifestPath, std::ios::binary);
+    if (!stream)
+    {
+        throw winrt::hresult_invalid_argument(L"Could not open the batch manifest!");
+    }
+    std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    auto manifest = winrt::JsonObject::Parse(winrt::to_hstring(text));
+
+    auto basePath = std::filesystem::absolute(manifestPath).parent_path();
+    std::vector<BatchJob> jobs;
+    for (auto&& value : manifest.GetNamedArray(L"jobs"))
+    {
+        auto job = value.GetObject();
+        BatchJob batchJob;
+        batchJob.FramesPath = GetJobPath(job, L"frames", basePath);
+        batchJob.BackgroundPath = GetJobPath(job, L"backgrounds", basePath);
+        batchJob.OutputPath = GetJobPath(job, L"output", basePath);
+        jobs.push_back(std::move(batchJob));
+    }
+    return jobs;
+}
+
+size_t RunBatch(
+    std::vector<BatchJob> const& jobs,
+    PipelineOptions const& options,
+    uint32_t maxConcurrentJobs,
+    PipelineStats* stats)
+{
+    auto resources = CreatePipelineResources(options, stats);
+    resources.Backgrounds = std::make_shared<BackgroundTemplateCache>();
+
+    // Each worker runs one job at a time, which limits how many run at once
+    ThreadPool pool(std::min<uint32_t>(maxConcurrentJobs, static_cast<uint32_t>(std::max<size_t>(jobs.size(), 1))));
+    std::vector<std::future<void>> results;
+    results.reserve(jobs.size());
+    for (auto&& job : jobs)
+    {
+        auto jobOptions = options;
+        jobOptions.FramesPath = job.FramesPath;
+        jobOptions.BackgroundPath = job.BackgroundPath;
+        jobOptions.OutputPath = job.OutputPath;
+        results.push_back(pool.Submit([resources, jobOptions, stats]()
+            {
+                CreateGifAsync(resources, jobOptions, stats).get();
+            }));
+    }
+
+    size_t failedCount = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        try
+        {
+            results[i].get();
+            wprintf(L"[%zu/%zu] %s\n", i + 1, results.size(), jobs[i].OutputPath.c_str());
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            wprintf(L"[%zu/%zu] %s failed: %s\n", i + 1, results.size(), jobs[i].OutputPath.c_str(), error.message().c_str());
+            failedCount++;
+        }
+        catch (std::exception const& error)
+        {
+            wprintf(L"[%zu/%zu] %s failed: %S\n", i + 1, results.size(), jobs[i].OutputPath.c_str(), error.what());
+            failedCount++;
+        }
+    }
+    return failedCount;
+}
@@ -0,0 +1,24 @@
+﻿#pragma once
+#include "Pipeline.h"
+
+struct BatchJob
+{
+    std::wstring FramesPath;
+    std::wstring BackgroundPath;
+    std::wstring OutputPath;
+};
+
+// Reads a manifest of the form:
+//   { "jobs": [ { "frames": "...", "backgrounds": "...", "output": "..." }, ... ] }
+// Relative paths are relative to the folder the manifest is in.
+std::vector<BatchJob> LoadBatchJobs(std::filesystem::path const& manifestPath);
+
+// Runs every job on one device, with at most maxConcurrentJobs running at
+// once. Everything but the paths comes from options. Jobs that use the same
+// backgrounds share a background template. Returns the number of jobs that
+// failed.
+size_t RunBatch(
+    std::vector<BatchJob> const& jobs,
+    PipelineOptions const& options,
+    uint32_t maxConcurrentJobs,
+    PipelineStats* stats = nullptr);
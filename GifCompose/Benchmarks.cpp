@@ -0,0 +1,826 @@
+﻿#include "pch.h"
+#include "Benchmarks.h"
+#include "FrameDiff.h"
+#include "ImageDecoder.h"
+#include "BitmapLoader.h"
+#include "LzwEncoder.h"
+#include "Quantizer.h"
+#include "Pipeline.h"
+
+namespace winrt
+{
+    using namespace Windows::Data::Json;
+}
+
+namespace
+{
+    template <typename Func>
+    double TimeIterations(uint32_t iterations, Func&& func)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            func();
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+    }
+
+    void WritePng(
+        winrt::com_ptr<IWICImagingFactory2> const& wicFactory,
+        std::filesystem::path const& path,
+        uint32_t width,
+        uint32_t height,
+        std::vector<uint8_t> const& bgraPixels)
+    {
+        winrt::com_ptr<IWICStream> stream;
+        winrt::check_hresult(wicFactory->CreateStream(stream.put()));
+        winrt::check_hresult(stream->InitializeFromFilename(path.c_str(), GENERIC_WRITE));
+        winrt::com_ptr<IWICBitmapEncoder> encoder;
+        winrt::check_hresult(wicFactory->CreateEncoder(GUID_ContainerFormatPng, nullptr, encoder.put()));
+        winrt::check_hresult(encoder->Initialize(stream.get(), WICBitmapEncoderNoCache));
+        winrt::com_ptr<IWICBitmapFrameEncode> frame;
+        winrt::check_hresult(encoder->CreateNewFrame(frame.put(), nullptr));
+        winrt::check_hresult(frame->Initialize(nullptr));
+        winrt::check_hresult(frame->SetSize(width, height));
+        auto format = GUID_WICPixelFormat32bppBGRA;
+        winrt::check_hresult(frame->SetPixelFormat(&format));
+        if (format != GUID_WICPixelFormat32bppBGRA)
+        {
+            throw winrt::hresult_error(WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT);
+        }
+        winrt::check_hresult(frame->WritePixels(height, width * 4, static_cast<uint32_t>(bgraPixels.size()), const_cast<uint8_t*>(bgraPixels.data())));
+        winrt::check_hresult(frame->Commit());
+        winrt::check_hresult(encoder->Commit());
+    }
+
+    // An opaque gradient, red increasing to the right and green downwards.
+    std::vector<uint8_t> GenerateBackground(uint32_t width, uint32_t height)
+    {
+        auto stride = width * 4;
+        std::vector<uint8_t> pixels(static_cast<size_t>(stride) * height);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = reinterpret_cast<uint32_t*>(pixels.data() + (static_cast<size_t>(y) * stride));
+            for (uint32_t x = 0; x < width; x++)
+            {
+                row[x] = 0xFF000000 | (((x * 255) / width) << 16) | (((y * 255) / height) << 8) | 0x40;
+            }
+        }
+        return pixels;
+    }
+
+    // An opaque ball that moves from left to right over the frame set, the
+    // rest of the frame is transparent.
+    std::vector<uint8_t> GenerateFrame(uint32_t width, uint32_t height, uint32_t index, uint32_t frameCount)
+    {
+        auto stride = width * 4;
+        std::vector<uint8_t> pixels(static_cast<size_t>(stride) * height, 0);
+        auto radius = static_cast<int32_t>(height / 6);
+        auto centerX = radius + static_cast<int32_t>((static_cast<uint64_t>(width - (radius * 2)) * index) / frameCount);
+        auto centerY = static_cast<int32_t>(height / 2);
+        for (auto y = std::max(centerY - radius, 0); y < std::min(centerY + radius, static_cast<int32_t>(height)); y++)
+        {
+            auto row = reinterpret_cast<uint32_t*>(pixels.data() + (static_cast<size_t>(y) * stride));
+            for (auto x = std::max(centerX - radius, 0); x < std::min(centerX + radius, static_cast<int32_t>(width)); x++)
+            {
+                auto dx = x - centerX;
+                auto dy = y - centerY;
+                if ((dx * dx) + (dy * dy) <= radius * radius)
+                {
+                    row[x] = 0xFF000000 | ((static_cast<uint32_t>(index * 7) & 0xFF) << 16) | ((static_cast<uint32_t>(x) & 0xFF) << 8) | 0xC0;
+                }
+            }
+        }
+        return pixels;
+    }
+
+    // A ball moving across an otherwise transparent frame, over an opaque
+    // gradient background. Roughly what our captured clips look like.
+    void GenerateFrameSet(
+        std::filesystem::path const& folder,
+        uint32_t width,
+        uint32_t height,
+        uint32_t frameCount)
+    {
+        auto framesPath = folder / L"frames";
+        auto backgroundsPath = folder / L"backgrounds";
+        std::filesystem::create_directories(framesPath);
+        std::filesystem::create_directories(backgroundsPath);
+        auto wicFactory = CreateWICFactory();
+        WritePng(wicFactory, backgroundsPath / L"background.png", width, height, GenerateBackground(width, height));
+
+        ThreadPool pool(std::thread::hardware_concurrency());
+        std::vector<std::future<void>> writes;
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            writes.push_back(pool.Submit([=]()
+                {
+                    wchar_t name[32] = {};
+                    swprintf_s(name, L"frame%05u.png", i);
+                    WritePng(CreateWICFactory(), framesPath / name, width, height, GenerateFrame(width, height, i, frameCount));
+                }));
+        }
+        for (auto&& write : writes)
+        {
+            write.get();
+        }
+    }
+
+    void RunPipelineBenchmark()
+    {
+        struct Configuration
+        {
+            uint32_t Width;
+            uint32_t Height;
+            uint32_t FrameCount;
+        };
+        Configuration const configurations[] =
+        {
+            { 640, 360, 30 },
+            { 640, 360, 120 },
+            { 1280, 720, 30 },
+            { 1280, 720, 120 },
+            { 1920, 1080, 30 },
+            { 1920, 1080, 120 },
+        };
+        uint32_t const iterations = 3;
+
+        auto rootPath = std::filesystem::temp_directory_path() / L"GifComposeBenchmark";
+        std::filesystem::remove_all(rootPath);
+        for (auto&& configuration : configurations)
+        {
+            wchar_t folderName[64] = {};
+            swprintf_s(folderName, L"%ux%u_%u", configuration.Width, configuration.Height, configuration.FrameCount);
+            auto folder = rootPath / folderName;
+            GenerateFrameSet(folder, configuration.Width, configuration.Height, configuration.FrameCount);
+
+            for (auto encoder : { EncoderType::Wic, EncoderType::Native })
+            {
+                PipelineOptions options;
+                options.FramesPath = (folder / L"frames").wstring();
+                options.BackgroundPath = (folder / L"backgrounds").wstring();
+                options.OutputPath = (folder / L"output.gif").wstring();
+                options.DecodeThreads = std::thread::hardware_concurrency();
+                options.EncodeThreads = std::thread::hardware_concurrency();
+                options.Encoder = encoder;
+
+                PipelineStats stats;
+                std::vector<double> runTimes;
+                for (uint32_t i = 0; i < iterations; i++)
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    CreateGifAsync(options, &stats).get();
+                    auto end = std::chrono::steady_clock::now();
+                    runTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                }
+
+                auto runs = SummarizeSamples(runTimes);
+                wprintf(L"%ux%u, %u frames, %s encoder, %u runs: median %.1f ms, p95 %.1f ms\n",
+                    configuration.Width,
+                    configuration.Height,
+                    configuration.FrameCount,
+                    encoder == EncoderType::Native ? L"native" : L"wic",
+                    iterations,
+                    runs.MedianMilliseconds,
+                    runs.P95Milliseconds);
+                PrintStageSummaries(stats.Profiler);
+                wprintf(L"  Peak working set: %.1f MB, peak video memory: %.1f MB\n\n",
+                    static_cast<double>(GetPeakWorkingSet()) / (1024.0 * 1024.0),
+                    static_cast<double>(stats.Profiler.PeakVideoMemory()) / (1024.0 * 1024.0));
+            }
+        }
+        std::error_code error;
+        std::filesystem::remove_all(rootPath, error);
+    }
+
+    void RunDiffBenchmark()
+    {
+        // A 4K frame with a small animated region, which is the common case
+        // for our clips. A single stray pixel keeps the bounds calculation honest.
+        uint32_t const width = 3840;
+        uint32_t const height = 2160;
+        uint32_t const stride = width * 4;
+        uint32_t const iterations = 100;
+        std::vector<uint8_t> previous(static_cast<size_t>(stride) * height);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = reinterpret_cast<uint32_t*>(previous.data() + (static_cast<size_t>(y) * stride));
+            for (uint32_t x = 0; x < width; x++)
+            {
+                row[x] = 0xFF000000 | ((x & 0xFF) << 16) | ((y & 0xFF) << 8) | ((x ^ y) & 0xFF);
+            }
+        }
+        auto current = previous;
+        for (uint32_t y = 900; y < 1140; y++)
+        {
+            auto row = reinterpret_cast<uint32_t*>(current.data() + (static_cast<size_t>(y) * stride));
+            for (uint32_t x = 1700; x < 2100; x++)
+            {
+                row[x] = ~row[x] | 0xFF000000;
+            }
+        }
+        reinterpret_cast<uint32_t*>(current.data() + (static_cast<size_t>(height - 3) * stride))[width - 5] ^= 0x00010101;
+
+        wprintf(L"Frame diff, %ux%u, %u iterations\n", width, height, iterations);
+        auto expected = DiffFrames(current.data(), previous.data(), width, height, stride, DiffKernel::Scalar);
+        double scalarTime = 0.0;
+        for (auto kernel : { DiffKernel::Scalar, DiffKernel::Sse2, DiffKernel::Avx2, DiffKernel::Neon })
+        {
+            if (!IsDiffKernelSupported(kernel))
+            {
+                continue;
+            }
+
+            FrameDiffResult result;
+            auto time = TimeIterations(iterations, [&]()
+                {
+                    result = DiffFrames(current.data(), previous.data(), width, height, stride, kernel);
+                });
+            if (kernel == DiffKernel::Scalar)
+            {
+                scalarTime = time;
+            }
+
+            auto&& rect = result.DirtyRect;
+            auto&& expectedRect = expected.DirtyRect;
+            auto matches = rect.Left == expectedRect.Left && rect.Top == expectedRect.Top &&
+                rect.Width == expectedRect.Width && rect.Height == expectedRect.Height &&
+                result.DirtyTiles == expected.DirtyTiles;
+            auto gigabytesPerSecond = (static_cast<double>(previous.size()) * 2.0) / (time / 1000.0) / 1e9;
+            auto name = GetDiffKernelName(kernel);
+            wprintf(L"  %-8.*s %8.3f ms/frame  %6.2f GB/s  %5.2fx  %s\n",
+                static_cast<int>(name.size()),
+                name.data(),
+                time,
+                gigabytesPerSecond,
+                scalarTime / time,
+                matches ? L"" : L"(MISMATCH)");
+        }
+    }
+
+    // Flat UI panels, rows of text-like glyphs and a gradient image, which is
+    // what screen captures look like to LZW.
+    std::vector<uint8_t> GenerateScreenCapture(uint32_t width, uint32_t height)
+    {
+        auto stride = width * 4;
+        std::vector<uint8_t> pixels(static_cast<size_t>(stride) * height);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = reinterpret_cast<uint32_t*>(pixels.data() + (static_cast<size_t>(y) * stride));
+            for (uint32_t x = 0; x < width; x++)
+            {
+                uint32_t color = 0xFFF3F3F3;
+                if (y < 32)
+                {
+                    // Title bar
+                    color = 0xFF202020;
+                }
+                else if (x < width / 5)
+                {
+                    // Side panel, with a list of items
+                    color = ((y / 24) % 2) ? 0xFFE6E6E6 : 0xFFEDEDED;
+                }
+                else if (x > width / 2 && y > height / 2)
+                {
+                    // Some kind of picture
+                    color = 0xFF000000 | (((x * 255) / width) << 16) | (((y * 255) / height) << 8) | ((x ^ y) & 0x3F);
+                }
+                // Text, in lines of 20 pixels with words of varying length
+                auto lineY = y % 20;
+                auto word = ((x / 7) * 2654435761u) ^ (y / 20);
+                if (y >= 32 && lineY >= 4 && lineY < 15 && (word % 7) != 0 && ((x * 31) ^ (lineY * 17) ^ word) % 5 < 2)
+                {
+                    color = x < width / 5 ? 0xFF404040 : 0xFF1A1A1A;
+                }
+                row[x] = color;
+            }
+        }
+        return pixels;
+    }
+
+    void RunLzwBenchmark(std::wstring const& framesPath)
+    {
+        uint32_t const maxFrames = 10;
+        uint32_t const iterations = 5;
+        std::vector<IndexedImage> images;
+        if (!framesPath.empty())
+        {
+            auto wicFactory = CreateWICFactory();
+            for (auto&& path : GetImageFilePaths(framesPath))
+            {
+                if (images.size() >= maxFrames)
+                {
+                    break;
+                }
+                auto image = DecodeImageFile(wicFactory, path);
+                images.push_back(QuantizeImage(image.Data(), image.Width, image.Height, image.Stride()));
+            }
+        }
+        else
+        {
+            uint32_t const width = 1920;
+            uint32_t const height = 1080;
+            auto pixels = GenerateScreenCapture(width, height);
+            images.push_back(QuantizeImage(pixels.data(), width, height, width * 4));
+        }
+        if (images.empty())
+        {
+            throw winrt::hresult_invalid_argument(L"No frames to compress!");
+        }
+
+        size_t totalIndices = 0;
+        for (auto&& image : images)
+        {
+            totalIndices += image.Indices.size();
+        }
+        wprintf(L"LZW, %zu frames, %.1f MB of indices, %u iterations\n",
+            images.size(),
+            static_cast<double>(totalIndices) / (1024.0 * 1024.0),
+            iterations);
+
+        // Same code size the native encoder would use
+        std::vector<uint8_t> minCodeSizes;
+        for (auto&& image : images)
+        {
+            uint8_t bits = 2;
+            while ((1u << bits) < image.Palette.size())
+            {
+                bits++;
+            }
+            minCodeSizes.push_back(bits);
+        }
+
+        std::vector<std::vector<uint8_t>> expected;
+        double mapTime = 0.0;
+        for (auto dictionary : { LzwDictionary::Map, LzwDictionary::Flat })
+        {
+            std::vector<std::vector<uint8_t>> results(images.size());
+            auto time = TimeIterations(iterations, [&]()
+                {
+                    for (size_t i = 0; i < images.size(); i++)
+                    {
+                        auto&& image = images[i];
+                        results[i] = LzwCompress(image.Indices.data(), image.Indices.size(), minCodeSizes[i], dictionary);
+                    }
+                });
+            if (dictionary == LzwDictionary::Map)
+            {
+                mapTime = time;
+                expected = results;
+            }
+
+            size_t compressedSize = 0;
+            for (auto&& result : results)
+            {
+                compressedSize += result.size();
+            }
+            auto megabytesPerSecond = (static_cast<double>(totalIndices) / (1024.0 * 1024.0)) / (time / 1000.0);
+            auto name = GetLzwDictionaryName(dictionary);
+            wprintf(L"  %-8.*s %8.3f ms  %7.1f MB/s  %5.2fx  %5.1f%% of input  %s\n",
+                static_cast<int>(name.size()),
+                name.data(),
+                time,
+                megabytesPerSecond,
+                mapTime / time,
+                100.0 * static_cast<double>(compressedSize) / static_cast<double>(totalIndices),
+                results == expected ? L"" : L"(MISMATCH)");
+        }
+    }
+
+    // Samples the working set on a background thread, since the peak the OS
+    // keeps can't be reset between runs.
+    class PeakWorkingSetSampler
+    {
+    public:
+        PeakWorkingSetSampler()
+        {
+            m_thread = std::thread([this]()
+                {
+                    while (!m_stopping)
+                    {
+                        Sample();
+                        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    }
+                });
+        }
+
+        ~PeakWorkingSetSampler()
+        {
+            m_stopping = true;
+            m_thread.join();
+        }
+
+        uint64_t Peak()
+        {
+            Sample();
+            return m_peak;
+        }
+
+    private:
+        void Sample()
+        {
+            PROCESS_MEMORY_COUNTERS counters = {};
+            if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            {
+                auto peak = m_peak.load();
+                while (counters.WorkingSetSize > peak && !m_peak.compare_exchange_weak(peak, counters.WorkingSetSize))
+                {
+                }
+            }
+        }
+
+    private:
+        std::thread m_thread;
+        std::atomic<bool> m_stopping = false;
+        std::atomic<uint64_t> m_peak = 0;
+    };
+
+    // Reads the frames of a GIF one at a time as BGRA8.
+    class GifFrameReader
+    {
+    public:
+        GifFrameReader(winrt::com_ptr<IWICImagingFactory2> const& wicFactory, std::filesystem::path const& path)
+        {
+            m_wicFactory = wicFactory;
+            winrt::check_hresult(m_wicFactory->CreateDecoderFromFilename(path.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, m_decoder.put()));
+            winrt::check_hresult(m_decoder->GetFrameCount(&m_frameCount));
+        }
+
+        uint32_t FrameCount() const { return m_frameCount; }
+
+        // Frames are expected to cover the whole image, which they do
+        // without delta encoding
+        std::vector<uint8_t> ReadFrame(uint32_t index, uint32_t width, uint32_t height)
+        {
+            winrt::com_ptr<IWICBitmapFrameDecode> frame;
+            winrt::check_hresult(m_decoder->GetFrame(index, frame.put()));
+            uint32_t frameWidth = 0;
+            uint32_t frameHeight = 0;
+            winrt::check_hresult(frame->GetSize(&frameWidth, &frameHeight));
+            if (frameWidth != width || frameHeight != height)
+            {
+                throw winrt::hresult_invalid_argument(L"GIF frames must cover the whole image!");
+            }
+            winrt::com_ptr<IWICBitmapSource> converted;
+            winrt::check_hresult(WICConvertBitmapSource(GUID_WICPixelFormat32bppBGRA, frame.get(), converted.put()));
+            std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+            winrt::check_hresult(converted->CopyPixels(nullptr, width * 4, static_cast<uint32_t>(pixels.size()), pixels.data()));
+            return pixels;
+        }
+
+    private:
+        winrt::com_ptr<IWICImagingFactory2> m_wicFactory;
+        winrt::com_ptr<IWICBitmapDecoder> m_decoder;
+        uint32_t m_frameCount = 0;
+    };
+
+    struct FrameComparison
+    {
+        bool FrameCountsMatch = false;
+        // Averaged over every color channel of every block
+        double MeanError = 0.0;
+        // Fraction of blocks where a channel is off by more than
+        // LargeErrorThreshold
+        double LargeErrorFraction = 0.0;
+    };
+
+    // Frames are compared as the average color of blocks this many pixels
+    // on a side. An encoder that dithers trades per pixel error for the
+    // right color on average, and that's what we want to check.
+    constexpr uint32_t ComparisonBlockSize = 4;
+    // A palette of 256 colors over the background gradient, which has every
+    // level of red and green, comes out as boxes about 16 levels on a side.
+    // A correct encoder is then off by about 4 in red and green and hardly
+    // at all in blue, 3 or so on average. A mean of 6 leaves room for the
+    // ball's colors taking some of the palette. An error of more than 48 is
+    // three boxes away, which quantization doesn't explain, while a frame
+    // composed or written wrong (a missing background, the ball in the
+    // wrong place, a stale region) is off by that much over a large area.
+    // 1% of blocks allows for rare colors that get folded into a much
+    // larger box.
+    constexpr int32_t LargeErrorThreshold = 48;
+    constexpr double MaxMeanError = 6.0;
+    constexpr double MaxLargeErrorFraction = 0.01;
+
+    // What frame index of a generated frame set should look like, composed
+    // on the CPU rather than through FrameComposer. The ball is opaque and
+    // the rest of the frame is fully transparent, so compositing only has
+    // to pick one or the other.
+    std::vector<uint8_t> ComposeReferenceFrame(std::vector<uint8_t> const& background, std::vector<uint8_t> const& frame)
+    {
+        auto pixels = background;
+        for (size_t offset = 0; offset < pixels.size(); offset += 4)
+        {
+            if (frame[offset + 3] != 0)
+            {
+                memcpy(pixels.data() + offset, frame.data() + offset, 4);
+            }
+        }
+        return pixels;
+    }
+
+    // Compares each frame of a GIF made from a generated frame set against
+    // its reference frame.
+    FrameComparison CompareToReference(
+        winrt::com_ptr<IWICImagingFactory2> const& wicFactory,
+        std::filesystem::path const& path,
+        uint32_t width,
+        uint32_t height,
+        uint32_t frameCount)
+    {
+        GifFrameReader reader(wicFactory, path);
+        FrameComparison comparison;
+        comparison.FrameCountsMatch = reader.FrameCount() == frameCount;
+        if (!comparison.FrameCountsMatch || frameCount == 0)
+        {
+            return comparison;
+        }
+
+        auto background = GenerateBackground(width, height);
+        auto stride = static_cast<size_t>(width) * 4;
+        double totalError = 0.0;
+        uint64_t largeErrors = 0;
+        uint64_t blockCount = 0;
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            auto pixels = reader.ReadFrame(i, width, height);
+            auto referencePixels = ComposeReferenceFrame(background, GenerateFrame(width, height, i, frameCount));
+            for (uint32_t blockY = 0; blockY < height; blockY += ComparisonBlockSize)
+            {
+                for (uint32_t blockX = 0; blockX < width; blockX += ComparisonBlockSize)
+                {
+                    auto blockWidth = std::min(ComparisonBlockSize, width - blockX);
+                    auto blockHeight = std::min(ComparisonBlockSize, height - blockY);
+                    std::array<int32_t, 3> sums = {};
+                    std::array<int32_t, 3> referenceSums = {};
+                    for (auto y = blockY; y < blockY + blockHeight; y++)
+                    {
+                        for (auto x = blockX; x < blockX + blockWidth; x++)
+                        {
+                            auto offset = (y * stride) + (static_cast<size_t>(x) * 4);
+                            for (size_t channel = 0; channel < 3; channel++)
+                            {
+                                sums[channel] += pixels[offset + channel];
+                                referenceSums[channel] += referencePixels[offset + channel];
+                            }
+                        }
+                    }
+
+                    auto blockPixels = static_cast<double>(blockWidth * blockHeight);
+                    auto largest = 0.0;
+                    for (size_t channel = 0; channel < 3; channel++)
+                    {
+                        auto error = std::abs(sums[channel] - referenceSums[channel]) / blockPixels;
+                        totalError += error;
+                        largest = std::max(largest, error);
+                    }
+                    if (largest > LargeErrorThreshold)
+                    {
+                        largeErrors++;
+                    }
+                    blockCount++;
+                }
+            }
+        }
+        comparison.MeanError = totalError / (static_cast<double>(blockCount) * 3.0);
+        comparison.LargeErrorFraction = static_cast<double>(largeErrors) / static_cast<double>(blockCount);
+        return comparison;
+    }
+
+    struct RegressionResult
+    {
+        std::wstring Name;
+        double FramesPerSecond = 0.0;
+        uint64_t PeakWorkingSet = 0;
+        uint64_t PeakVideoMemory = 0;
+    };
+
+    // How much worse than the baseline a result can be before it fails
+    constexpr double MaxThroughputRegression = 0.15;
+    constexpr double MaxMemoryRegression = 0.15;
+
+    constexpr uint32_t RegressionResultsVersion = 1;
+
+    void SaveRegressionResults(std::filesystem::path const& path, std::vector<RegressionResult> const& results)
+    {
+        winrt::JsonArray resultArray;
+        for (auto&& result : results)
+        {
+            winrt::JsonObject resultObject;
+            resultObject.Insert(L"name", winrt::JsonValue::CreateStringValue(result.Name));
+            resultObject.Insert(L"framesPerSecond", winrt::JsonValue::CreateNumberValue(result.FramesPerSecond));
+            resultObject.Insert(L"peakWorkingSet", winrt::JsonValue::CreateNumberValue(static_cast<double>(result.PeakWorkingSet)));
+            resultObject.Insert(L"peakVideoMemory", winrt::JsonValue::CreateNumberValue(static_cast<double>(result.PeakVideoMemory)));
+            resultArray.Append(resultObject);
+        }
+        winrt::JsonObject resultsObject;
+        resultsObject.Insert(L"version", winrt::JsonValue::CreateNumberValue(RegressionResultsVersion));
+        resultsObject.Insert(L"results", resultArray);
+
+        auto text = winrt::to_string(resultsObject.Stringify());
+        std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        if (!stream)
+        {
+            throw winrt::hresult_invalid_argument(L"Could not write the regression results!");
+        }
+        stream.write(text.data(), text.size());
+    }
+
+    std::vector<RegressionResult> LoadRegressionResults(std::filesystem::path const& path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+        {
+            throw winrt::hresult_invalid_argument(L"Could not open the regression baseline!");
+        }
+        std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        auto resultsObject = winrt::JsonObject::Parse(winrt::to_hstring(text));
+        if (static_cast<uint32_t>(resultsObject.GetNamedNumber(L"version")) != RegressionResultsVersion)
+        {
+            throw winrt::hresult_invalid_argument(L"The regression baseline is from an incompatible version!");
+        }
+        std::vector<RegressionResult> results;
+        for (auto&& value : resultsObject.GetNamedArray(L"results"))
+        {
+            auto resultObject = value.GetObject();
+            RegressionResult result;
+            result.Name = resultObject.GetNamedString(L"name");
+            result.FramesPerSecond = resultObject.GetNamedNumber(L"framesPerSecond");
+            result.PeakWorkingSet = static_cast<uint64_t>(resultObject.GetNamedNumber(L"peakWorkingSet"));
+            result.PeakVideoMemory = static_cast<uint64_t>(resultObject.GetNamedNumber(L"peakVideoMemory"));
+            results.push_back(std::move(result));
+        }
+        return results;
+    }
+
+    // Encodes fixed workloads with both encoders. Each encoder's frames have
+    // to match reference frames composed on the CPU within a tolerance, and
+    // if there's a baseline, throughput and peak memory can't be much worse
+    // than it.
+    bool RunRegressionBenchmark(std::wstring const& resultsPath, std::wstring const& baselinePath)
+    {
+        struct Workload
+        {
+            std::wstring_view Name;
+            uint32_t Width;
+            uint32_t Height;
+            uint32_t FrameCount;
+        };
+        Workload const workloads[] =
+        {
+            { L"1080p_100", 1920, 1080, 100 },
+            { L"360p_1000", 640, 360, 1000 },
+            { L"4k_1", 3840, 2160, 1 },
+        };
+        uint32_t const iterations = 3;
+
+        std::vector<RegressionResult> baseline;
+        if (!baselinePath.empty())
+        {
+            baseline = LoadRegressionResults(baselinePath);
+        }
+
+        auto passed = true;
+        std::vector<RegressionResult> results;
+        auto wicFactory = CreateWICFactory();
+        auto rootPath = std::filesystem::temp_directory_path() / L"GifComposeRegression";
+        std::filesystem::remove_all(rootPath);
+        for (auto&& workload : workloads)
+        {
+            auto folder = rootPath / workload.Name;
+            GenerateFrameSet(folder, workload.Width, workload.Height, workload.FrameCount);
+
+            for (auto encoder : { EncoderType::Wic, EncoderType::Native })
+            {
+                auto encoderName = encoder == EncoderType::Native ? L"native" : L"wic";
+                PipelineOptions options;
+                options.FramesPath = (folder / L"frames").wstring();
+                options.BackgroundPath = (folder / L"backgrounds").wstring();
+                options.OutputPath = (folder / (std::wstring(encoderName) + L".gif")).wstring();
+                options.DecodeThreads = std::thread::hardware_concurrency();
+                options.EncodeThreads = std::thread::hardware_concurrency();
+                options.Encoder = encoder;
+                // Keep one GIF frame per generated frame for the comparison
+                options.MergeDuplicateFrames = false;
+
+                RegressionResult result;
+                result.Name = std::wstring(workload.Name) + L"_" + encoderName;
+                std::vector<double> runTimes;
+                size_t frameCount = 0;
+                {
+                    PeakWorkingSetSampler sampler;
+                    for (uint32_t i = 0; i < iterations; i++)
+                    {
+                        PipelineStats stats;
+                        auto start = std::chrono::steady_clock::now();
+                        CreateGifAsync(options, &stats).get();
+                        auto end = std::chrono::steady_clock::now();
+                        runTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                        frameCount = stats.FrameCount;
+                        result.PeakVideoMemory = std::max(result.PeakVideoMemory, stats.Profiler.PeakVideoMemory());
+                    }
+                    result.PeakWorkingSet = sampler.Peak();
+                }
+                auto runs = SummarizeSamples(runTimes);
+                result.FramesPerSecond = runs.MedianMilliseconds > 0.0 ? static_cast<double>(frameCount) / (runs.MedianMilliseconds / 1000.0) : 0.0;
+                wprintf(L"%s: %.1f frames/sec, peak working set %.1f MB, peak video memory %.1f MB\n",
+                    result.Name.c_str(),
+                    result.FramesPerSecond,
+                    static_cast<double>(result.PeakWorkingSet) / (1024.0 * 1024.0),
+                    static_cast<double>(result.PeakVideoMemory) / (1024.0 * 1024.0));
+
+                auto baselineResult = std::find_if(baseline.begin(), baseline.end(), [&](auto const& entry) { return entry.Name == result.Name; });
+                if (baselineResult != baseline.end())
+                {
+                    if (result.FramesPerSecond < baselineResult->FramesPerSecond * (1.0 - MaxThroughputRegression))
+                    {
+                        wprintf(L"  FAIL: throughput dropped from %.1f frames/sec\n", baselineResult->FramesPerSecond);
+                        passed = false;
+                    }
+                    if (static_cast<double>(result.PeakWorkingSet) > static_cast<double>(baselineResult->PeakWorkingSet) * (1.0 + MaxMemoryRegression))
+                    {
+                        wprintf(L"  FAIL: peak working set grew from %.1f MB\n", static_cast<double>(baselineResult->PeakWorkingSet) / (1024.0 * 1024.0));
+                        passed = false;
+                    }
+                    if (static_cast<double>(result.PeakVideoMemory) > static_cast<double>(baselineResult->PeakVideoMemory) * (1.0 + MaxMemoryRegression))
+                    {
+                        wprintf(L"  FAIL: peak video memory grew from %.1f MB\n", static_cast<double>(baselineResult->PeakVideoMemory) / (1024.0 * 1024.0));
+                        passed = false;
+                    }
+                }
+
+                auto comparison = CompareToReference(wicFactory, options.OutputPath, workload.Width, workload.Height, workload.FrameCount);
+                auto framesMatch = comparison.FrameCountsMatch &&
+                    comparison.MeanError <= MaxMeanError &&
+                    comparison.LargeErrorFraction <= MaxLargeErrorFraction;
+                wprintf(L"  vs reference: mean error %.2f, %.2f%% of blocks off by more than %d  %s\n",
+                    comparison.MeanError,
+                    comparison.LargeErrorFraction * 100.0,
+                    LargeErrorThreshold,
+                    framesMatch ? L"" : (comparison.FrameCountsMatch ? L"(MISMATCH)" : L"(FRAME COUNT MISMATCH)"));
+                passed = passed && framesMatch;
+                results.push_back(std::move(result));
+            }
+            wprintf(L"\n");
+
+            std::error_code error;
+            std::filesystem::remove_all(folder, error);
+        }
+        std::error_code error;
+        std::filesystem::remove_all(rootPath, error);
+
+        if (!resultsPath.empty())
+        {
+            SaveRegressionResults(resultsPath, results);
+        }
+        wprintf(L"%s\n", passed ? L"PASSED" : L"FAILED");
+        return passed;
+    }
+}
+
+bool TryParseBenchmarkType(std::wstring const& value, BenchmarkType& type)
+{
+    if (value == L"diff")
+    {
+        type = BenchmarkType::Diff;
+        return true;
+    }
+    else if (value == L"pipeline")
+    {
+        type = BenchmarkType::Pipeline;
+        return true;
+    }
+    else if (value == L"lzw")
+    {
+        type = BenchmarkType::Lzw;
+        return true;
+    }
+    else if (value == L"regression")
+    {
+        type = BenchmarkType::Regression;
+        return true;
+    }
+    return false;
+}
+
+bool RunBenchmark(BenchmarkOptions const& options)
+{
+    switch (options.Type)
+    {
+    case BenchmarkType::Diff:
+        RunDiffBenchmark();
+        break;
+    case BenchmarkType::Pipeline:
+        RunPipelineBenchmark();
+        break;
+    case BenchmarkType::Lzw:
+        RunLzwBenchmark(options.FramesPath);
+        break;
+    case BenchmarkType::Regression:
+        return RunRegressionBenchmark(options.ResultsPath, options.BaselinePath);
+    default:
+        break;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+enum class BenchmarkType
+{
+    None,
+    Diff,
+    Pipeline,
+    Lzw,
+    Regression,
+};
+
+struct BenchmarkOptions
+{
+    BenchmarkType Type = BenchmarkType::None;
+    // The lzw benchmark compresses these frames if set
+    std::wstring FramesPath;
+    // The regression benchmark writes its results here if set, and fails if
+    // they're worse than the ones in BaselinePath
+    std::wstring ResultsPath;
+    std::wstring BaselinePath;
+};
+
+// Parses the value passed to -bench. Returns false for unknown benchmarks.
+bool TryParseBenchmarkType(std::wstring const& value, BenchmarkType& type);
+// Returns false if the benchmark found a regression.
+bool RunBenchmark(BenchmarkOptions const& options);
@@ -0,0 +1,77 @@
+﻿#include "pch.h"
+#include "BitmapLoader.h"
+
+std::vector<std::filesystem::path> GetImageFilePaths(std::wstring const& path)
+{
+    // Find all the files in the folder
+    auto fullPath = std::filesystem::canonical(path);
+    if (!std::filesystem::is_directory(fullPath))
+    {
+        throw winrt::hresult_invalid_argument(L"Path was not a folder!");
+    }
+    std::vector<std::filesystem::path> files;
+    for (auto const& entry : std::filesystem::directory_iterator(fullPath))
+    {
+        auto path = entry.path();
+        if (std::filesystem::is_regular_file(path) && path.has_extension())
+        {
+            auto extension = path.extension().wstring();
+            if (extension == L".png")
+            {
+                files.push_back(path);
+            }
+        }
+    }
+    // Sort the filesnames
+    std::sort(files.begin(), files.end(), [](auto const& left, auto const& right)
+        {
+            return left.filename().wstring() < right.filename().wstring();
+        });
+    return files;
+}
+
+winrt::com_ptr<ID2D1Bitmap1> CreateBitmapFromImage(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    DecodedImage const& image)
+{
+    auto texture = CreateTextureFromImage(d3dDevice, image);
+    return CreateBitmapFromTexture(texture, d2dContext);
+}
+
+std::vector<winrt::com_ptr<ID2D1Bitmap1>> LoadBitmaps(
+    ParallelDecoder& decoder,
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    std::wstring const& path)
+{
+    auto files = GetImageFilePaths(path);
+
+    // Queue up all the decodes before we wait on any of them
+    std::vector<std::future<DecodedImage>> decodes;
+    decodes.reserve(files.size());
+    for (auto&& file : files)
+    {
+        decodes.push_back(decoder.DecodeAsync(file));
+    }
+
+    std::vector<winrt::com_ptr<ID2D1Bitmap1>> bitmaps;
+    bitmaps.reserve(decodes.size());
+    for (auto&& decode : decodes)
+    {
+        auto image = decode.get();
+        bitmaps.push_back(CreateBitmapFromImage(d3dDevice, d2dContext, image));
+    }
+
+    return bitmaps;
+}
+
+winrt::com_ptr<ID2D1Bitmap1> CreateBitmapFromTexture(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext)
+{
+    auto dxgiSurface = texture.as<IDXGISurface>();
+    winrt::com_ptr<ID2D1Bitmap1> bitmap;
+    winrt::check_hresult(d2dContext->CreateBitmapFromDxgiSurface(dxgiSurface.get(), nullptr, bitmap.put()));
+    return bitmap;
+}
@@ -0,0 +1,19 @@
+﻿#pragma once
+#include "ImageDecoder.h"
+
+std::vector<std::filesystem::path> GetImageFilePaths(std::wstring const& path);
+
+winrt::com_ptr<ID2D1Bitmap1> CreateBitmapFromImage(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    DecodedImage const& image);
+
+std::vector<winrt::com_ptr<ID2D1Bitmap1>> LoadBitmaps(
+    ParallelDecoder& decoder,
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    std::wstring const& path);
+
+winrt::com_ptr<ID2D1Bitmap1> CreateBitmapFromTexture(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext);
@@ -0,0 +1,221 @@
+﻿#include "pch.h"
+#include "BufferedFileStream.h"
+#include <io.h>
+
+namespace
+{
+    wil::unique_handle g_stdoutHandle;
+}
+
+BufferedFileStream::BufferedFileStream(wil::unique_handle handle, size_t bufferSize)
+{
+    m_handle = std::move(handle);
+    m_isFile = GetFileType(m_handle.get()) == FILE_TYPE_DISK;
+    m_buffer.resize(bufferSize);
+}
+
+BufferedFileStream::~BufferedFileStream()
+{
+    // Callers should Commit to see errors, this is a last resort
+    FlushBuffer();
+}
+
+IFACEMETHODIMP BufferedFileStream::Read(void* data, ULONG size, ULONG* read) noexcept
+{
+    if (!m_isFile)
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+    RETURN_IF_FAILED(FlushBuffer());
+    DWORD bytesRead = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(ReadFile(m_handle.get(), data, size, &bytesRead, nullptr));
+    if (read != nullptr)
+    {
+        *read = bytesRead;
+    }
+    return bytesRead < size ? S_FALSE : S_OK;
+}
+
+IFACEMETHODIMP BufferedFileStream::Write(void const* data, ULONG size, ULONG* written) noexcept
+{
+    auto bytes = static_cast<uint8_t const*>(data);
+    if (m_bufferedSize + size > m_buffer.size())
+    {
+        RETURN_IF_FAILED(FlushBuffer());
+    }
+    if (size >= m_buffer.size())
+    {
+        // Too big to be worth buffering
+        RETURN_IF_FAILED(WriteToHandle(bytes, size));
+    }
+    else
+    {
+        memcpy(m_buffer.data() + m_bufferedSize, bytes, size);
+        m_bufferedSize += size;
+    }
+    if (written != nullptr)
+    {
+        *written = size;
+    }
+    return S_OK;
+}
+
+IFACEMETHODIMP BufferedFileStream::Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition) noexcept
+{
+    if (!m_isFile)
+    {
+        // Pipes can still tell you where they are
+        if (origin != STREAM_SEEK_CUR || move.QuadPart != 0)
+        {
+            return STG_E_INVALIDFUNCTION;
+        }
+        if (newPosition != nullptr)
+        {
+            newPosition->QuadPart = m_pipePosition + m_bufferedSize;
+        }
+        return S_OK;
+    }
+    RETURN_IF_FAILED(FlushBuffer());
+    // The STREAM_SEEK values match FILE_BEGIN, FILE_CURRENT and FILE_END
+    LARGE_INTEGER position = {};
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_handle.get(), move, &position, origin));
+    if (newPosition != nullptr)
+    {
+        newPosition->QuadPart = static_cast<uint64_t>(position.QuadPart);
+    }
+    return S_OK;
+}
+
+IFACEMETHODIMP BufferedFileStream::SetSize(ULARGE_INTEGER newSize) noexcept
+{
+    if (!m_isFile)
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+    RETURN_IF_FAILED(FlushBuffer());
+    LARGE_INTEGER position = {};
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_handle.get(), {}, &position, FILE_CURRENT));
+    LARGE_INTEGER size = {};
+    size.QuadPart = static_cast<int64_t>(newSize.QuadPart);
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_handle.get(), size, nullptr, FILE_BEGIN));
+    RETURN_IF_WIN32_BOOL_FALSE(SetEndOfFile(m_handle.get()));
+    RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(m_handle.get(), position, nullptr, FILE_BEGIN));
+    return S_OK;
+}
+
+IFACEMETHODIMP BufferedFileStream::CopyTo(IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER*) noexcept
+{
+    return E_NOTIMPL;
+}
+
+IFACEMETHODIMP BufferedFileStream::Commit(DWORD) noexcept
+{
+    RETURN_IF_FAILED(FlushBuffer());
+    // Waiting on a pipe would mean waiting for the reader
+    if (m_isFile)
+    {
+        RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_handle.get()));
+    }
+    return S_OK;
+}
+
+IFACEMETHODIMP BufferedFileStream::Revert() noexcept
+{
+    return STG_E_INVALIDFUNCTION;
+}
+
+IFACEMETHODIMP BufferedFileStream::LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) noexcept
+{
+    return STG_E_INVALIDFUNCTION;
+}
+
+IFACEMETHODIMP BufferedFileStream::UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) noexcept
+{
+    return STG_E_INVALIDFUNCTION;
+}
+
+IFACEMETHODIMP BufferedFileStream::Stat(STATSTG* stats, DWORD) noexcept
+{
+    RETURN_HR_IF_NULL(E_POINTER, stats);
+    *stats = {};
+    stats->type = STGTY_STREAM;
+    stats->grfMode = STGM_READWRITE;
+    if (m_isFile)
+    {
+        RETURN_IF_FAILED(FlushBuffer());
+        LARGE_INTEGER size = {};
+        RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(m_handle.get(), &size));
+        stats->cbSize.QuadPart = static_cast<uint64_t>(size.QuadPart);
+    }
+    else
+    {
+        stats->cbSize.QuadPart = m_pipePosition + m_bufferedSize;
+    }
+    return S_OK;
+}
+
+IFACEMETHODIMP BufferedFileStream::Clone(IStream**) noexcept
+{
+    return E_NOTIMPL;
+}
+
+HRESULT BufferedFileStream::FlushBuffer() noexcept
+{
+    if (m_bufferedSize > 0)
+    {
+        RETURN_IF_FAILED(WriteToHandle(m_buffer.data(), m_bufferedSize));
+        m_bufferedSize = 0;
+    }
+    return S_OK;
+}
+
+HRESULT BufferedFileStream::WriteToHandle(uint8_t const* data, size_t size) noexcept
+{
+    size_t offset = 0;
+    while (offset < size)
+    {
+        auto chunkSize = static_cast<DWORD>(std::min<size_t>(size - offset, UINT32_MAX));
+        DWORD written = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_handle.get(), data + offset, chunkSize, &written, nullptr));
+        offset += written;
+    }
+    if (!m_isFile)
+    {
+        m_pipePosition += size;
+    }
+    return S_OK;
+}
+
+winrt::com_ptr<IStream> CreateOutputStream(std::wstring const& path)
+{
+    wil::unique_handle handle;
+    if (path == L"-")
+    {
+        if (!g_stdoutHandle)
+        {
+            throw winrt::hresult_illegal_method_call(L"Stdout wasn't reserved for output!");
+        }
+        handle = std::move(g_stdoutHandle);
+    }
+    else
+    {
+        handle.reset(CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+        if (!handle)
+        {
+            winrt::throw_last_error();
+        }
+    }
+    return winrt::make<BufferedFileStream>(std::move(handle)).as<IStream>();
+}
+
+void ReserveStdoutForOutput()
+{
+    fflush(stdout);
+    winrt::check_bool(DuplicateHandle(GetCurrentProcess(), GetStdHandle(STD_OUTPUT_HANDLE), GetCurrentProcess(), g_stdoutHandle.put(), 0, FALSE, DUPLICATE_SAME_ACCESS));
+    // This also closes the original handle, so the reader sees the end of
+    // the stream once we close ours.
+    if (_dup2(_fileno(stderr), _fileno(stdout)) != 0)
+    {
+        throw winrt::hresult_error(E_FAIL, L"Failed to redirect stdout!");
+    }
+}
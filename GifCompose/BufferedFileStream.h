@@ -0,0 +1,49 @@
+﻿#pragma once
+
+// An IStream over a Win32 handle that collects writes in a large buffer, so
+// the encoders' many small writes reach the file (or network share) as a few
+// big ones. The handle can also be a pipe, in which case the stream can only
+// be written to.
+class BufferedFileStream : public winrt::implements<BufferedFileStream, IStream, ISequentialStream>
+{
+public:
+    static constexpr size_t DefaultBufferSize = 4 * 1024 * 1024;
+
+    BufferedFileStream(wil::unique_handle handle, size_t bufferSize = DefaultBufferSize);
+    ~BufferedFileStream();
+
+    // ISequentialStream
+    IFACEMETHOD(Read)(void* data, ULONG size, ULONG* read) noexcept override;
+    IFACEMETHOD(Write)(void const* data, ULONG size, ULONG* written) noexcept override;
+
+    // IStream
+    IFACEMETHOD(Seek)(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition) noexcept override;
+    IFACEMETHOD(SetSize)(ULARGE_INTEGER newSize) noexcept override;
+    IFACEMETHOD(CopyTo)(IStream* stream, ULARGE_INTEGER size, ULARGE_INTEGER* read, ULARGE_INTEGER* written) noexcept override;
+    IFACEMETHOD(Commit)(DWORD flags) noexcept override;
+    IFACEMETHOD(Revert)() noexcept override;
+    IFACEMETHOD(LockRegion)(ULARGE_INTEGER offset, ULARGE_INTEGER size, DWORD lockType) noexcept override;
+    IFACEMETHOD(UnlockRegion)(ULARGE_INTEGER offset, ULARGE_INTEGER size, DWORD lockType) noexcept override;
+    IFACEMETHOD(Stat)(STATSTG* stats, DWORD flags) noexcept override;
+    IFACEMETHOD(Clone)(IStream** stream) noexcept override;
+
+private:
+    HRESULT FlushBuffer() noexcept;
+    HRESULT WriteToHandle(uint8_t const* data, size_t size) noexcept;
+
+private:
+    wil::unique_handle m_handle;
+    bool m_isFile = false;
+    std::vector<uint8_t> m_buffer;
+    size_t m_bufferedSize = 0;
+    // Only tracked for pipes, files ask the handle
+    uint64_t m_pipePosition = 0;
+};
+
+// Creates (or replaces) the file at path and returns a buffered stream over
+// it. A path of "-" writes to the handle set aside by ReserveStdoutForOutput.
+winrt::com_ptr<IStream> CreateOutputStream(std::wstring const& path);
+// Keeps the original stdout handle for the GIF and points the CRT's stdout
+// at stderr, so console messages don't end up in the output. Must be called
+// before anything is printed.
+void ReserveStdoutForOutput();
@@ -0,0 +1,139 @@
+﻿#include "pch.h"
+#include "DecodeCache.h"
+#include "Hash.h"
+
+namespace
+{
+    constexpr uint32_t CacheFileMagic = 0x43444347; // 'GCDC'
+    constexpr uint32_t CacheFileVersion = 1;
+
+    // The pixels follow the header directly. Keep this a multiple of 16 bytes
+    // so they stay aligned.
+    struct CacheFileHeader
+    {
+        uint32_t Magic;
+        uint32_t Version;
+        uint64_t ContentHash;
+        uint64_t FileSize;
+        int64_t LastWriteTime;
+        uint32_t Width;
+        uint32_t Height;
+        PixelRect Bounds;
+        uint32_t IsOpaque;
+        uint32_t Reserved;
+    };
+    static_assert(sizeof(CacheFileHeader) % 16 == 0);
+}
+
+DecodeCache::DecodeCache(std::filesystem::path const& directory)
+{
+    std::filesystem::create_directories(directory);
+    m_directory = std::filesystem::canonical(directory);
+}
+
+DecodeCacheKey DecodeCache::CreateKey(std::filesystem::path const& path, MappedFile const& file)
+{
+    DecodeCacheKey key;
+    key.Path = std::filesystem::canonical(path);
+    key.ContentHash = MurmurHash64A(file.Data(), file.Size());
+    key.FileSize = file.Size();
+    key.LastWriteTime = std::filesystem::last_write_time(key.Path).time_since_epoch().count();
+    return key;
+}
+
+std::optional<DecodedImage> DecodeCache::TryLoad(DecodeCacheKey const& key)
+{
+    auto entryPath = GetEntryPath(key);
+    std::error_code error;
+    if (!std::filesystem::exists(entryPath, error))
+    {
+        return std::nullopt;
+    }
+
+    // Another run might be replacing the entry right now
+    std::shared_ptr<MappedFile> file;
+    try
+    {
+        file = std::make_shared<MappedFile>(entryPath);
+    }
+    catch (winrt::hresult_error const&)
+    {
+        return std::nullopt;
+    }
+    if (file->Size() < sizeof(CacheFileHeader))
+    {
+        return std::nullopt;
+    }
+    CacheFileHeader header = {};
+    memcpy(&header, file->Data(), sizeof(header));
+    if (header.Magic != CacheFileMagic ||
+        header.Version != CacheFileVersion ||
+        header.ContentHash != key.ContentHash ||
+        header.FileSize != key.FileSize ||
+        header.LastWriteTime != key.LastWriteTime)
+    {
+        return std::nullopt;
+    }
+    auto pixelsSize = static_cast<size_t>(header.Width) * 4 * header.Height;
+    if (file->Size() != sizeof(CacheFileHeader) + pixelsSize)
+    {
+        return std::nullopt;
+    }
+
+    DecodedImage image;
+    image.Width = header.Width;
+    image.Height = header.Height;
+    image.Coverage.Bounds = header.Bounds;
+    image.Coverage.IsOpaque = header.IsOpaque != 0;
+    image.MappedPixels = file->Data() + sizeof(CacheFileHeader);
+    image.Mapping = std::move(file);
+    return image;
+}
+
+void DecodeCache::Store(DecodeCacheKey const& key, DecodedImage const& image)
+{
+    CacheFileHeader header = {};
+    header.Magic = CacheFileMagic;
+    header.Version = CacheFileVersion;
+    header.ContentHash = key.ContentHash;
+    header.FileSize = key.FileSize;
+    header.LastWriteTime = key.LastWriteTime;
+    header.Width = image.Width;
+    header.Height = image.Height;
+    header.Bounds = image.Coverage.Bounds;
+    header.IsOpaque = image.Coverage.IsOpaque ? 1 : 0;
+
+    // Write to a temporary file first so that nobody ever maps a partial
+    // entry, then move it into place.
+    auto entryPath = GetEntryPath(key);
+    auto tempPath = entryPath;
+    tempPath += L"." + std::to_wstring(GetCurrentProcessId()) + L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+    {
+        std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+        stream.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<char const*>(image.Data()), image.Size());
+        if (!stream)
+        {
+            stream.close();
+            std::error_code error;
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tempPath, entryPath, error);
+    if (error)
+    {
+        std::filesystem::remove(tempPath, error);
+    }
+}
+
+std::filesystem::path DecodeCache::GetEntryPath(DecodeCacheKey const& key) const
+{
+    // Entries for the same path replace each other as the file changes
+    auto&& path = key.Path.native();
+    auto pathHash = MurmurHash64A(path.data(), path.size() * sizeof(wchar_t));
+    wchar_t name[32] = {};
+    swprintf_s(name, L"%016llx.bgra", pathHash);
+    return m_directory / name;
+}
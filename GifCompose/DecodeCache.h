@@ -0,0 +1,35 @@
+﻿#pragma once
+#include "ImageDecoder.h"
+#include "MappedFile.h"
+
+// Identifies the contents of a source image at a point in time.
+struct DecodeCacheKey
+{
+    std::filesystem::path Path;
+    uint64_t ContentHash = 0;
+    uint64_t FileSize = 0;
+    int64_t LastWriteTime = 0;
+};
+
+// Keeps decoded BGRA8 images on disk so repeat runs over the same frames
+// don't have to decode them again. Entries are stored as uncompressed
+// files that can be mapped and uploaded straight from the mapped pages.
+// Safe to use from multiple threads (and processes).
+class DecodeCache
+{
+public:
+    DecodeCache(std::filesystem::path const& directory);
+
+    // Hashes the contents of an already mapped source file.
+    static DecodeCacheKey CreateKey(std::filesystem::path const& path, MappedFile const& file);
+
+    std::optional<DecodedImage> TryLoad(DecodeCacheKey const& key);
+    // Failing to write an entry isn't fatal, the image just won't be cached.
+    void Store(DecodeCacheKey const& key, DecodedImage const& image);
+
+private:
+    std::filesystem::path GetEntryPath(DecodeCacheKey const& key) const;
+
+private:
+    std::filesystem::path m_directory;
+};
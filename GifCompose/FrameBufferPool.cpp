@@ -0,0 +1,21 @@
+﻿#include "pch.h"
+#include "FrameBufferPool.h"
+
+std::shared_ptr<std::vector<uint8_t>> FrameBufferPool::Acquire(size_t size)
+{
+    for (auto&& buffer : m_buffers)
+    {
+        // Only we can hand out new references, so once this drops to 1 it
+        // stays there.
+        if (buffer.use_count() == 1)
+        {
+            // Make sure whoever released it is done reading
+            std::atomic_thread_fence(std::memory_order_acquire);
+            buffer->resize(size);
+            return buffer;
+        }
+    }
+    auto buffer = std::make_shared<std::vector<uint8_t>>(size);
+    m_buffers.push_back(buffer);
+    return buffer;
+}
@@ -0,0 +1,17 @@
+﻿#pragma once
+
+// Hands out byte buffers that can be reused once nothing else references
+// them. Frames are read back into these instead of new allocations, so in
+// steady state the readback path doesn't touch the heap. The pool keeps a
+// reference to every buffer it creates, and a buffer is free again when
+// that's the only reference left.
+class FrameBufferPool
+{
+public:
+    // Returns a buffer of exactly size bytes. Its contents are undefined.
+    std::shared_ptr<std::vector<uint8_t>> Acquire(size_t size);
+    size_t BufferCount() const { return m_buffers.size(); }
+
+private:
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> m_buffers;
+};
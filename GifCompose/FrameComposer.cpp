@@ -0,0 +1,68 @@
+﻿#include "pch.h"
+#include "FrameComposer.h"
+
+namespace
+{
+    inline uint64_t GetArea(PixelRect const& rect)
+    {
+        return static_cast<uint64_t>(rect.Width) * rect.Height;
+    }
+}
+
+FrameComposer::FrameComposer(
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    winrt::com_ptr<ID2D1Bitmap1> const& backgroundTemplate,
+    winrt::com_ptr<ID2D1Bitmap1> const& renderTarget)
+{
+    m_d2dContext = d2dContext;
+    m_backgroundTemplate = backgroundTemplate;
+    m_renderTarget = renderTarget;
+    auto size = m_renderTarget->GetPixelSize();
+    m_fullRect = { 0, 0, size.width, size.height };
+    // We don't know what's in the render target yet
+    m_previousBounds = m_fullRect;
+}
+
+void FrameComposer::Compose(SourceFrame const& frame)
+{
+    auto&& coverage = frame.Coverage;
+    m_stats.FramesComposed++;
+    m_stats.PixelsWithoutCoverage += GetArea(m_fullRect) * 2;
+
+    m_d2dContext->SetTarget(m_renderTarget.get());
+    m_d2dContext->BeginDraw();
+    // An opaque frame replaces everything, otherwise put back the background
+    // wherever the last frame drew.
+    if (coverage.IsOpaque)
+    {
+        m_stats.BackgroundsSkipped++;
+    }
+    else if (!m_previousBounds.IsEmpty())
+    {
+        DrawRegion(m_backgroundTemplate, m_previousBounds);
+    }
+    if (!coverage.Bounds.IsEmpty())
+    {
+        DrawRegion(frame.Bitmap, coverage.Bounds);
+    }
+    winrt::check_hresult(m_d2dContext->EndDraw());
+
+    m_previousBounds = coverage.Bounds;
+}
+
+void FrameComposer::Reset()
+{
+    m_previousBounds = m_fullRect;
+}
+
+void FrameComposer::DrawRegion(winrt::com_ptr<ID2D1Bitmap1> const& bitmap, PixelRect const& region)
+{
+    // Bitmaps and the render target are all at 96 DPI, so DIPs are pixels
+    auto rect = D2D1::RectF(
+        static_cast<float>(region.Left),
+        static_cast<float>(region.Top),
+        static_cast<float>(region.Left + region.Width),
+        static_cast<float>(region.Top + region.Height));
+    m_d2dContext->DrawBitmap(bitmap.get(), &rect, 1.0f, D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR, &rect, nullptr);
+    m_stats.PixelsDrawn += GetArea(region);
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+#include "FrameSource.h"
+
+struct CompositionStats
+{
+    uint64_t FramesComposed = 0;
+    // Frames that were opaque, so the background wasn't drawn at all.
+    uint64_t BackgroundsSkipped = 0;
+    uint64_t PixelsDrawn = 0;
+    // What drawing the whole background and the whole frame every time would
+    // have cost.
+    uint64_t PixelsWithoutCoverage = 0;
+};
+
+// Draws frames on top of the background template into a render target that
+// keeps its contents between frames. Instead of redrawing the whole
+// background every time, only the part the previous frame covered is
+// restored, and opaque frames skip the background entirely.
+class FrameComposer
+{
+public:
+    FrameComposer(
+        winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+        winrt::com_ptr<ID2D1Bitmap1> const& backgroundTemplate,
+        winrt::com_ptr<ID2D1Bitmap1> const& renderTarget);
+
+    CompositionStats const& Stats() const { return m_stats; }
+
+    void Compose(SourceFrame const& frame);
+    // Call if something else has drawn into the render target. The next
+    // frame restores the whole background.
+    void Reset();
+
+private:
+    void DrawRegion(winrt::com_ptr<ID2D1Bitmap1> const& bitmap, PixelRect const& region);
+
+private:
+    winrt::com_ptr<ID2D1DeviceContext> m_d2dContext;
+    winrt::com_ptr<ID2D1Bitmap1> m_backgroundTemplate;
+    winrt::com_ptr<ID2D1Bitmap1> m_renderTarget;
+    PixelRect m_fullRect;
+    // The part of the render target that doesn't match the background
+    PixelRect m_previousBounds;
+    CompositionStats m_stats;
+};
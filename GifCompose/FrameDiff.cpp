@@ -0,0 +1,316 @@
+﻿#include "pch.h"
+#include "FrameDiff.h"
+#include <intrin.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define GIFCOMPOSE_DIFF_X86
+#include <immintrin.h>
+#elif defined(_M_ARM64)
+#define GIFCOMPOSE_DIFF_NEON
+#include <arm64_neon.h>
+#endif
+
+namespace
+{
+    // Each segment function compares count pixels. If any differ, it returns
+    // true along with the offsets of the first and last differing pixel.
+    using DiffSegmentFunc = bool(*)(uint32_t const* current, uint32_t const* previous, uint32_t count, uint32_t& first, uint32_t& last);
+
+    inline bool DiffPixelsScalar(uint32_t const* current, uint32_t const* previous, uint32_t begin, uint32_t end, bool found, uint32_t& first, uint32_t& last)
+    {
+        for (auto x = begin; x < end; x++)
+        {
+            if (current[x] != previous[x])
+            {
+                if (!found)
+                {
+                    first = x;
+                    found = true;
+                }
+                last = x;
+            }
+        }
+        return found;
+    }
+
+    inline void AccumulateMask(uint32_t mask, uint32_t offset, bool& found, uint32_t& first, uint32_t& last)
+    {
+        unsigned long index = 0;
+        if (!found)
+        {
+            _BitScanForward(&index, mask);
+            first = offset + index;
+            found = true;
+        }
+        _BitScanReverse(&index, mask);
+        last = offset + index;
+    }
+
+    bool DiffSegmentScalar(uint32_t const* current, uint32_t const* previous, uint32_t count, uint32_t& first, uint32_t& last)
+    {
+        return DiffPixelsScalar(current, previous, 0, count, false, first, last);
+    }
+
+#ifdef GIFCOMPOSE_DIFF_X86
+    bool DiffSegmentSse2(uint32_t const* current, uint32_t const* previous, uint32_t count, uint32_t& first, uint32_t& last)
+    {
+        auto found = false;
+        uint32_t x = 0;
+        for (; x + 4 <= count; x += 4)
+        {
+            auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(current + x));
+            auto b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(previous + x));
+            auto equal = _mm_cmpeq_epi32(a, b);
+            auto mask = ~static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(equal))) & 0xF;
+            if (mask != 0)
+            {
+                AccumulateMask(mask, x, found, first, last);
+            }
+        }
+        return DiffPixelsScalar(current, previous, x, count, found, first, last);
+    }
+
+    bool DiffSegmentAvx2(uint32_t const* current, uint32_t const* previous, uint32_t count, uint32_t& first, uint32_t& last)
+    {
+        auto found = false;
+        uint32_t x = 0;
+        for (; x + 8 <= count; x += 8)
+        {
+            auto a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(current + x));
+            auto b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(previous + x));
+            auto equal = _mm256_cmpeq_epi32(a, b);
+            auto mask = ~static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(equal))) & 0xFF;
+            if (mask != 0)
+            {
+                AccumulateMask(mask, x, found, first, last);
+            }
+        }
+        return DiffPixelsScalar(current, previous, x, count, found, first, last);
+    }
+
+    bool IsAvx2Supported()
+    {
+        int info[4] = {};
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        // The OS needs to save the YMM registers for us
+        __cpuid(info, 1);
+        auto osxsave = (info[2] & (1 << 27)) != 0;
+        auto avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+
+    bool IsSse2Supported()
+    {
+#ifdef _M_X64
+        return true;
+#else
+        int info[4] = {};
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+#endif
+    }
+#endif
+
+#ifdef GIFCOMPOSE_DIFF_NEON
+    bool DiffSegmentNeon(uint32_t const* current, uint32_t const* previous, uint32_t count, uint32_t& first, uint32_t& last)
+    {
+        auto found = false;
+        uint32_t x = 0;
+        for (; x + 4 <= count; x += 4)
+        {
+            auto a = vld1q_u32(current + x);
+            auto b = vld1q_u32(previous + x);
+            // All lanes are 0xFFFFFFFF if nothing changed
+            if (vminvq_u32(vceqq_u32(a, b)) != 0xFFFFFFFF)
+            {
+                found = DiffPixelsScalar(current, previous, x, x + 4, found, first, last);
+            }
+        }
+        return DiffPixelsScalar(current, previous, x, count, found, first, last);
+    }
+#endif
+
+    DiffSegmentFunc GetDiffSegmentFunc(DiffKernel kernel)
+    {
+        switch (kernel)
+        {
+#ifdef GIFCOMPOSE_DIFF_X86
+        case DiffKernel::Sse2:
+            return DiffSegmentSse2;
+        case DiffKernel::Avx2:
+            return DiffSegmentAvx2;
+#endif
+#ifdef GIFCOMPOSE_DIFF_NEON
+        case DiffKernel::Neon:
+            return DiffSegmentNeon;
+#endif
+        case DiffKernel::Scalar:
+            return DiffSegmentScalar;
+        default:
+            throw winrt::hresult_not_implemented(L"Unsupported diff kernel!");
+        }
+    }
+}
+
+bool IsDiffKernelSupported(DiffKernel kernel)
+{
+    switch (kernel)
+    {
+    case DiffKernel::Scalar:
+        return true;
+#ifdef GIFCOMPOSE_DIFF_X86
+    case DiffKernel::Sse2:
+        return IsSse2Supported();
+    case DiffKernel::Avx2:
+        return IsAvx2Supported();
+#endif
+#ifdef GIFCOMPOSE_DIFF_NEON
+    case DiffKernel::Neon:
+        // NEON is always available on ARM64
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+DiffKernel GetBestDiffKernel()
+{
+    static auto const bestKernel = []()
+    {
+        for (auto kernel : { DiffKernel::Avx2, DiffKernel::Neon, DiffKernel::Sse2 })
+        {
+            if (IsDiffKernelSupported(kernel))
+            {
+                return kernel;
+            }
+        }
+        return DiffKernel::Scalar;
+    }();
+    return bestKernel;
+}
+
+std::wstring_view GetDiffKernelName(DiffKernel kernel)
+{
+    switch (kernel)
+    {
+    case DiffKernel::Sse2:
+        return L"SSE2";
+    case DiffKernel::Avx2:
+        return L"AVX2";
+    case DiffKernel::Neon:
+        return L"NEON";
+    default:
+        return L"Scalar";
+    }
+}
+
+FrameDiffResult DiffFrames(
+    uint8_t const* current,
+    uint8_t const* previous,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    DiffKernel kernel)
+{
+    auto diffSegment = GetDiffSegmentFunc(kernel);
+
+    FrameDiffResult result;
+    result.TileColumns = (width + DiffTileSize - 1) / DiffTileSize;
+    result.TileRows = (height + DiffTileSize - 1) / DiffTileSize;
+    result.DirtyTiles.resize(static_cast<size_t>(result.TileColumns) * result.TileRows, 0);
+
+    auto left = width;
+    auto right = 0u;
+    auto top = height;
+    auto bottom = 0u;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto currentRow = reinterpret_cast<uint32_t const*>(current + (static_cast<size_t>(y) * stride));
+        auto previousRow = reinterpret_cast<uint32_t const*>(previous + (static_cast<size_t>(y) * stride));
+        auto dirtyTiles = result.DirtyTiles.data() + (static_cast<size_t>(y / DiffTileSize) * result.TileColumns);
+        for (uint32_t column = 0; column < result.TileColumns; column++)
+        {
+            auto begin = column * DiffTileSize;
+            auto count = std::min(DiffTileSize, width - begin);
+            uint32_t first = 0;
+            uint32_t last = 0;
+            if (diffSegment(currentRow + begin, previousRow + begin, count, first, last))
+            {
+                dirtyTiles[column] = 1;
+                left = std::min(left, begin + first);
+                right = std::max(right, begin + last + 1);
+                top = std::min(top, y);
+                bottom = y + 1;
+            }
+        }
+    }
+
+    if (left < right && top < bottom)
+    {
+        result.DirtyRect = { left, top, right - left, bottom - top };
+    }
+    return result;
+}
+
+PixelRect FindDirtyRect(
+    uint8_t const* current,
+    uint8_t const* previous,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride)
+{
+    return DiffFrames(current, previous, width, height, stride).DirtyRect;
+}
+
+PixelRect FindDirtyRect8(
+    uint8_t const* current,
+    uint8_t const* previous,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride)
+{
+    // Indexed frames are a quarter of the size of BGRA8 ones, so rows are
+    // cheap enough to skip with memcmp.
+    uint32_t left = width;
+    uint32_t right = 0;
+    uint32_t top = height;
+    uint32_t bottom = 0;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto currentRow = current + (static_cast<size_t>(y) * stride);
+        auto previousRow = previous + (static_cast<size_t>(y) * stride);
+        if (memcmp(currentRow, previousRow, width) == 0)
+        {
+            continue;
+        }
+        uint32_t first = 0;
+        while (currentRow[first] == previousRow[first])
+        {
+            first++;
+        }
+        uint32_t last = width - 1;
+        while (currentRow[last] == previousRow[last])
+        {
+            last--;
+        }
+        left = std::min(left, first);
+        right = std::max(right, last + 1);
+        top = std::min(top, y);
+        bottom = y + 1;
+    }
+    if (top >= bottom)
+    {
+        return {};
+    }
+    return { left, top, right - left, bottom - top };
+}
@@ -0,0 +1,67 @@
+﻿#pragma once
+
+struct PixelRect
+{
+    uint32_t Left = 0;
+    uint32_t Top = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+
+    bool IsEmpty() const { return Width == 0 || Height == 0; }
+};
+
+enum class DiffKernel
+{
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon,
+};
+
+// Frames are compared in square tiles of this many pixels.
+constexpr uint32_t DiffTileSize = 32;
+
+struct FrameDiffResult
+{
+    // Bounding rectangle of the pixels that changed, empty if none did.
+    PixelRect DirtyRect;
+    uint32_t TileColumns = 0;
+    uint32_t TileRows = 0;
+    // One entry per tile in row major order, non-zero if any pixel in the
+    // tile changed.
+    std::vector<uint8_t> DirtyTiles;
+
+    bool IsTileDirty(uint32_t column, uint32_t row) const { return DirtyTiles[(static_cast<size_t>(row) * TileColumns) + column] != 0; }
+};
+
+// Returns the fastest kernel supported by this processor.
+DiffKernel GetBestDiffKernel();
+std::wstring_view GetDiffKernelName(DiffKernel kernel);
+bool IsDiffKernelSupported(DiffKernel kernel);
+
+// Compares two BGRA8 images of the same size.
+FrameDiffResult DiffFrames(
+    uint8_t const* current,
+    uint8_t const* previous,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    DiffKernel kernel = GetBestDiffKernel());
+
+// Finds the bounding rectangle of the pixels that differ between two BGRA8
+// images of the same size. Returns an empty rectangle if they are identical.
+PixelRect FindDirtyRect(
+    uint8_t const* current,
+    uint8_t const* previous,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride);
+
+// Same as FindDirtyRect, but for images with one byte per pixel (e.g. palette
+// indices).
+PixelRect FindDirtyRect8(
+    uint8_t const* current,
+    uint8_t const* previous,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride);
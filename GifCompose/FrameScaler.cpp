@@ -0,0 +1,104 @@
+﻿#include "pch.h"
+#include "FrameScaler.h"
+#include "BitmapLoader.h"
+
+bool TryParseOutputScale(std::wstring const& value, OutputScale& result)
+{
+    try
+    {
+        size_t processed = 0;
+        auto separator = value.find(L'x');
+        if (separator == std::wstring::npos)
+        {
+            auto factor = std::stod(value, &processed);
+            if (processed != value.size() || !(factor > 0.0 && factor <= 1.0))
+            {
+                return false;
+            }
+            result = {};
+            result.Factor = factor;
+            return true;
+        }
+
+        auto widthString = value.substr(0, separator);
+        auto heightString = value.substr(separator + 1);
+        auto width = std::stoul(widthString, &processed);
+        if (processed != widthString.size())
+        {
+            return false;
+        }
+        auto height = std::stoul(heightString, &processed);
+        if (processed != heightString.size() || (width == 0 && height == 0) || width > UINT16_MAX || height > UINT16_MAX)
+        {
+            return false;
+        }
+        result = {};
+        result.Width = static_cast<uint32_t>(width);
+        result.Height = static_cast<uint32_t>(height);
+        return true;
+    }
+    catch (std::exception const&)
+    {
+        return false;
+    }
+}
+
+D2D1_SIZE_U GetScaledSize(OutputScale const& scale, D2D1_SIZE_U frameSize)
+{
+    auto scaleSide = [](uint32_t side, double factor)
+    {
+        return std::max<uint32_t>(static_cast<uint32_t>(std::lround(side * factor)), 1);
+    };
+    if (scale.Width == 0 && scale.Height == 0)
+    {
+        return { scaleSide(frameSize.width, scale.Factor), scaleSide(frameSize.height, scale.Factor) };
+    }
+    if (scale.Width == 0)
+    {
+        return { scaleSide(frameSize.width, static_cast<double>(scale.Height) / frameSize.height), scale.Height };
+    }
+    if (scale.Height == 0)
+    {
+        return { scale.Width, scaleSide(frameSize.height, static_cast<double>(scale.Width) / frameSize.width) };
+    }
+    return { scale.Width, scale.Height };
+}
+
+FrameScaler::FrameScaler(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    winrt::com_ptr<ID2D1Bitmap1> const& source,
+    D2D1_SIZE_U outputSize)
+{
+    m_d2dContext = d2dContext;
+    m_source = source;
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = outputSize.width;
+    desc.Height = outputSize.height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+    desc.SampleDesc.Count = 1;
+    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_texture.put()));
+    m_target = CreateBitmapFromTexture(m_texture, d2dContext);
+    // Bitmaps and the render target are all at 96 DPI, so DIPs are pixels
+    m_outputRect = D2D1::RectF(0.0f, 0.0f, static_cast<float>(outputSize.width), static_cast<float>(outputSize.height));
+}
+
+D3D11_TEXTURE2D_DESC FrameScaler::TextureDesc() const
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    m_texture->GetDesc(&desc);
+    return desc;
+}
+
+void FrameScaler::Scale()
+{
+    m_d2dContext->SetTarget(m_target.get());
+    m_d2dContext->BeginDraw();
+    m_d2dContext->DrawBitmap(m_source.get(), &m_outputRect, 1.0f, D2D1_INTERPOLATION_MODE_HIGH_QUALITY_CUBIC, nullptr, nullptr);
+    winrt::check_hresult(m_d2dContext->EndDraw());
+}
@@ -0,0 +1,43 @@
+﻿#pragma once
+
+// How the composed frames are resized before they're read back. Either a
+// factor, or a size where one side can be 0 to keep the aspect ratio.
+struct OutputScale
+{
+    double Factor = 1.0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+
+    bool IsIdentity() const { return Width == 0 && Height == 0 && Factor == 1.0; }
+};
+
+// Accepts a factor between 0 and 1 (e.g. "0.5") or a size (e.g. "854x480"
+// or "0x480").
+bool TryParseOutputScale(std::wstring const& value, OutputScale& result);
+D2D1_SIZE_U GetScaledSize(OutputScale const& scale, D2D1_SIZE_U frameSize);
+
+// Resamples a composed frame into a smaller texture on the GPU with D2D's
+// high quality cubic filter. Readback, quantizing and encoding all cost less
+// with fewer pixels.
+class FrameScaler
+{
+public:
+    FrameScaler(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+        winrt::com_ptr<ID2D1Bitmap1> const& source,
+        D2D1_SIZE_U outputSize);
+
+    winrt::com_ptr<ID3D11Texture2D> const& Texture() const { return m_texture; }
+    D3D11_TEXTURE2D_DESC TextureDesc() const;
+
+    // The device lock must be held.
+    void Scale();
+
+private:
+    winrt::com_ptr<ID2D1DeviceContext> m_d2dContext;
+    winrt::com_ptr<ID2D1Bitmap1> m_source;
+    winrt::com_ptr<ID3D11Texture2D> m_texture;
+    winrt::com_ptr<ID2D1Bitmap1> m_target;
+    D2D1_RECT_F m_outputRect = {};
+};
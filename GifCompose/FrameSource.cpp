@@ -0,0 +1,86 @@
+﻿#include "pch.h"
+#include "FrameSource.h"
+#include "BitmapLoader.h"
+#include "ImageHeader.h"
+
+ImageFrameSource::ImageFrameSource(
+    ParallelDecoder& decoder,
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    std::vector<std::filesystem::path> const& paths,
+    size_t windowSize,
+    PipelineProfiler* profiler) : m_decoder(decoder)
+{
+    m_d3dDevice = d3dDevice;
+    m_d2dContext = d2dContext;
+    m_paths = paths;
+    m_windowSize = windowSize;
+    m_profiler = profiler;
+    if (m_windowSize == 0)
+    {
+        m_windowSize = m_paths.size();
+    }
+}
+
+void ImageFrameSource::Initialize()
+{
+    if (m_paths.empty())
+    {
+        throw winrt::hresult_invalid_argument(L"No frames found!");
+    }
+    // Only the headers are read, so a bad frame fails before we've spent
+    // any time decoding.
+    auto frameSize = ReadPngSize(m_paths.front());
+    CheckImageSizes(m_paths, frameSize, L"Frame");
+    m_frameSize = frameSize;
+    FillWindow();
+}
+
+std::optional<SourceFrame> ImageFrameSource::TryGetNextFrame()
+{
+    if (m_window.empty() && m_nextIndex == m_paths.size())
+    {
+        return std::nullopt;
+    }
+    return GetNextFrame();
+}
+
+SourceFrame ImageFrameSource::GetNextFrame()
+{
+    auto image = GetNextImage();
+    StageTimer timer(m_profiler, PipelineStage::Upload);
+    SourceFrame frame;
+    frame.Bitmap = CreateBitmapFromImage(m_d3dDevice, m_d2dContext, image);
+    frame.Coverage = image.Coverage;
+    return frame;
+}
+
+DecodedImage ImageFrameSource::GetNextImage()
+{
+    FillWindow();
+    if (m_window.empty())
+    {
+        throw winrt::hresult_out_of_bounds(L"No more frames!");
+    }
+    auto decode = std::move(m_window.front());
+    m_window.pop_front();
+    // Keep the decoders busy while we upload this frame
+    FillWindow();
+
+    // Make sure all the frames are the same size
+    auto image = decode.get();
+    if (image.Width != m_frameSize->width || image.Height != m_frameSize->height)
+    {
+        throw winrt::hresult_invalid_argument(L"All frames must be of the same size!");
+    }
+    return image;
+}
+
+void ImageFrameSource::FillWindow()
+{
+    while (m_window.size() < m_windowSize && m_nextIndex < m_paths.size())
+    {
+        m_window.push_back(m_decoder.DecodeAsync(m_paths[m_nextIndex]));
+        m_nextIndex++;
+    }
+}
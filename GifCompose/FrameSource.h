@@ -0,0 +1,63 @@
+﻿#pragma once
+#include "ImageDecoder.h"
+#include "PipelineProfiler.h"
+
+struct SourceFrame
+{
+    winrt::com_ptr<ID2D1Bitmap1> Bitmap;
+    ImageCoverage Coverage;
+    // In hundredths of a second. Only set by sources that carry their own
+    // timing, like videos.
+    std::optional<uint16_t> Delay;
+};
+
+// Produces the frames to compose, in order.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    virtual D2D1_SIZE_U FrameSize() const = 0;
+    // Returns nothing once every frame has been read.
+    virtual std::optional<SourceFrame> TryGetNextFrame() = 0;
+};
+
+// Loads frames from disk on demand. Decoding runs ahead of the consumer on
+// the decoder's worker threads, with at most windowSize frames in flight at
+// once. A windowSize of 0 decodes every frame up front. Initialize checks
+// that the frames are all the same size from their headers alone.
+class ImageFrameSource : public FrameSource
+{
+public:
+    ImageFrameSource(
+        ParallelDecoder& decoder,
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+        std::vector<std::filesystem::path> const& paths,
+        size_t windowSize,
+        PipelineProfiler* profiler = nullptr);
+
+    size_t FrameCount() const { return m_paths.size(); }
+    // Only valid after Initialize has been called.
+    D2D1_SIZE_U FrameSize() const override { return m_frameSize.value(); }
+
+    void Initialize();
+    std::optional<SourceFrame> TryGetNextFrame() override;
+    SourceFrame GetNextFrame();
+    // Same as GetNextFrame, but without uploading the frame to the GPU.
+    DecodedImage GetNextImage();
+
+private:
+    void FillWindow();
+
+private:
+    ParallelDecoder& m_decoder;
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID2D1DeviceContext> m_d2dContext;
+    std::vector<std::filesystem::path> m_paths;
+    size_t m_windowSize = 0;
+    PipelineProfiler* m_profiler = nullptr;
+    size_t m_nextIndex = 0;
+    std::deque<std::future<DecodedImage>> m_window;
+    std::optional<D2D1_SIZE_U> m_frameSize;
+};
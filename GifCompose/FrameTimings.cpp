@@ -0,0 +1,90 @@
+﻿#include "pch.h"
+#include "FrameTimings.h"
+
+namespace winrt
+{
+    using namespace Windows::Data::Json;
+}
+
+std::unordered_map<std::wstring, uint16_t> LoadFrameTimings(std::filesystem::path const& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+    {
+        throw winrt::hresult_invalid_argument(L"Could not open the timings file!");
+    }
+    std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    auto timingsObject = winrt::JsonObject::Parse(winrt::to_hstring(text));
+
+    std::unordered_map<std::wstring, uint16_t> timings;
+    for (auto&& pair : timingsObject.GetNamedObject(L"frames"))
+    {
+        auto delay = pair.Value().GetNumber();
+        if (delay < 0 || delay > UINT16_MAX || delay != std::floor(delay))
+        {
+            throw winrt::hresult_invalid_argument(L"Frame delays must be whole numbers between 0 and 65535!");
+        }
+        timings.emplace(pair.Key(), static_cast<uint16_t>(delay));
+    }
+    return timings;
+}
+
+std::vector<uint16_t> GetFrameDelays(
+    std::vector<std::filesystem::path> const& framePaths,
+    std::unordered_map<std::wstring, uint16_t> const& timings,
+    uint16_t baseDelay)
+{
+    std::vector<uint16_t> delays;
+    delays.reserve(framePaths.size());
+    for (auto&& path : framePaths)
+    {
+        auto it = timings.find(path.filename().wstring());
+        delays.push_back(it != timings.end() ? it->second : baseDelay);
+    }
+    return delays;
+}
+
+void LimitFrameRate(
+    std::vector<std::filesystem::path>& framePaths,
+    std::vector<uint16_t>& frameDelays,
+    uint32_t maxFramesPerSecond)
+{
+    if (maxFramesPerSecond == 0 || framePaths.empty())
+    {
+        return;
+    }
+    if (framePaths.size() != frameDelays.size())
+    {
+        throw winrt::hresult_invalid_argument(L"Every frame needs a delay!");
+    }
+
+    // Tick k is at k * 100 / maxFramesPerSecond hundredths of a second.
+    // Comparing start * maxFramesPerSecond with k * 100 keeps it exact.
+    uint64_t nextTick = 0;
+    uint64_t start = 0;
+    size_t keptCount = 0;
+    for (size_t i = 0; i < framePaths.size(); i++)
+    {
+        auto delay = frameDelays[i];
+        auto scaledStart = start * maxFramesPerSecond;
+        if (keptCount == 0 || scaledStart >= nextTick * 100)
+        {
+            if (keptCount != i)
+            {
+                framePaths[keptCount] = std::move(framePaths[i]);
+            }
+            frameDelays[keptCount] = delay;
+            keptCount++;
+            // The first tick after this frame starts
+            nextTick = (scaledStart / 100) + 1;
+        }
+        else
+        {
+            auto&& keptDelay = frameDelays[keptCount - 1];
+            keptDelay = static_cast<uint16_t>(std::min<uint32_t>(static_cast<uint32_t>(keptDelay) + delay, UINT16_MAX));
+        }
+        start += delay;
+    }
+    framePaths.resize(keptCount);
+    frameDelays.resize(keptCount);
+}
@@ -0,0 +1,21 @@
+﻿#pragma once
+
+// Per frame delays in hundredths of a second, loaded from a json file:
+//   { "frames": { "0001.png": 4, "0002.png": 20 } }
+// Frames are matched by file name.
+std::unordered_map<std::wstring, uint16_t> LoadFrameTimings(std::filesystem::path const& path);
+
+// Returns the delay of each frame, frames without a timing use baseDelay.
+std::vector<uint16_t> GetFrameDelays(
+    std::vector<std::filesystem::path> const& framePaths,
+    std::unordered_map<std::wstring, uint16_t> const& timings,
+    uint16_t baseDelay);
+
+// Drops frames so that no more than maxFramesPerSecond start in any second.
+// A frame is kept if it starts on or after the next tick of the new rate,
+// and is shown until the next kept frame starts, so the total duration
+// doesn't change. The paths and delays are kept in step.
+void LimitFrameRate(
+    std::vector<std::filesystem::path>& framePaths,
+    std::vector<uint16_t>& frameDelays,
+    uint32_t maxFramesPerSecond);
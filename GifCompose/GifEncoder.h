@@ -0,0 +1,38 @@
+﻿#pragma once
+#include "FrameDiff.h"
+#include "Quantizer.h"
+
+// A composed frame in premultiplied BGRA8 with tightly packed rows, or an
+// already quantized frame with one palette index per pixel.
+struct GifFrame
+{
+    std::shared_ptr<std::vector<uint8_t> const> Bytes;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    // In hundredths of a second, as stored in /grctlext/Delay.
+    uint16_t Delay = 0;
+    // The part of the frame that gets encoded, everything outside of it is
+    // left as it was in the previous frame.
+    PixelRect Region;
+    // If set, pixels in Region that match the previous frame may be encoded
+    // as transparent.
+    std::shared_ptr<std::vector<uint8_t> const> Previous;
+    // If set, Bytes (and Previous) hold palette indices instead of BGRA8.
+    std::shared_ptr<std::vector<PaletteColor> const> Palette;
+    // The palette entry unchanged pixels are mapped to, -1 if there isn't one.
+    int32_t TransparentIndex = -1;
+    // How many consecutive source frames this frame stands in for, more than
+    // one if duplicates were merged into it.
+    uint32_t SourceFrameCount = 1;
+};
+
+// Writes an infinitely looping GIF. Frames must be written in order, and
+// FinishAsync must be awaited before the encoder is destroyed.
+class GifEncoder
+{
+public:
+    virtual ~GifEncoder() {}
+
+    virtual winrt::Windows::Foundation::IAsyncAction WriteFrameAsync(GifFrame frame) = 0;
+    virtual winrt::Windows::Foundation::IAsyncAction FinishAsync() = 0;
+};
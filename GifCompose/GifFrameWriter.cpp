@@ -0,0 +1,107 @@
+﻿#include "pch.h"
+#include "GifFrameWriter.h"
+#include "Hash.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+namespace
+{
+    bool HasSamePalette(
+        std::shared_ptr<std::vector<PaletteColor> const> const& left,
+        std::shared_ptr<std::vector<PaletteColor> const> const& right)
+    {
+        if (left == right)
+        {
+            return true;
+        }
+        if (left == nullptr || right == nullptr || left->size() != right->size())
+        {
+            return false;
+        }
+        return memcmp(left->data(), right->data(), left->size() * sizeof(PaletteColor)) == 0;
+    }
+}
+
+GifFrameWriter::GifFrameWriter(
+    GifEncoder& encoder,
+    D2D1_SIZE_U frameSize,
+    bool useDeltaEncoding,
+    bool mergeDuplicateFrames,
+    int32_t transparentIndex,
+    size_t keyFrameInterval) : m_encoder(encoder)
+{
+    m_frameSize = frameSize;
+    m_useDeltaEncoding = useDeltaEncoding;
+    m_mergeDuplicateFrames = mergeDuplicateFrames;
+    m_transparentIndex = transparentIndex;
+    m_keyFrameInterval = keyFrameInterval;
+}
+
+winrt::IAsyncAction GifFrameWriter::WriteFrameAsync(
+    std::shared_ptr<std::vector<uint8_t> const> bytes,
+    std::shared_ptr<std::vector<PaletteColor> const> palette,
+    uint16_t delay)
+{
+    auto isKeyFrame = m_keyFrameInterval != 0 && (m_frameIndex % m_keyFrameInterval) == 0;
+    m_frameIndex++;
+
+    // Identical frames just extend how long the last one is shown. The hash
+    // avoids comparing every pair of frames.
+    uint64_t hash = 0;
+    if (m_mergeDuplicateFrames)
+    {
+        hash = MurmurHash64A(bytes->data(), bytes->size());
+        if (m_pendingFrame.has_value() &&
+            hash == m_previousHash &&
+            static_cast<uint32_t>(m_pendingFrame->Delay) + delay <= UINT16_MAX &&
+            HasSamePalette(m_pendingFrame->Palette, palette) &&
+            memcmp(bytes->data(), m_previousBytes->data(), bytes->size()) == 0)
+        {
+            m_pendingFrame->Delay += delay;
+            m_pendingFrame->SourceFrameCount++;
+            m_framesMerged++;
+            co_return;
+        }
+    }
+    co_await FlushAsync();
+
+    GifFrame gifFrame = {};
+    gifFrame.Bytes = bytes;
+    gifFrame.Width = m_frameSize.width;
+    gifFrame.Height = m_frameSize.height;
+    gifFrame.Delay = delay;
+    gifFrame.Region = { 0, 0, m_frameSize.width, m_frameSize.height };
+    gifFrame.Palette = palette;
+    gifFrame.TransparentIndex = m_transparentIndex;
+
+    // Only encode what changed since the last frame
+    if (m_useDeltaEncoding && m_previousBytes != nullptr && !isKeyFrame)
+    {
+        auto dirtyRect = gifFrame.Palette ?
+            FindDirtyRect8(bytes->data(), m_previousBytes->data(), m_frameSize.width, m_frameSize.height, m_frameSize.width) :
+            FindDirtyRect(bytes->data(), m_previousBytes->data(), m_frameSize.width, m_frameSize.height, m_frameSize.width * 4);
+        if (dirtyRect.IsEmpty())
+        {
+            // We still need a frame to hold the delay
+            dirtyRect = { 0, 0, 1, 1 };
+        }
+        gifFrame.Region = dirtyRect;
+        gifFrame.Previous = m_previousBytes;
+    }
+    m_previousBytes = bytes;
+    m_previousHash = hash;
+    m_pendingFrame = std::move(gifFrame);
+}
+
+winrt::IAsyncAction GifFrameWriter::FlushAsync()
+{
+    if (m_pendingFrame.has_value())
+    {
+        auto frame = std::move(m_pendingFrame.value());
+        m_pendingFrame.reset();
+        co_await m_encoder.WriteFrameAsync(std::move(frame));
+    }
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+#include "GifEncoder.h"
+
+// Turns composed frames into GifFrames for an encoder. With delta encoding
+// only the part of each frame that changed is encoded, and consecutive
+// identical frames can be merged into one that's shown for all of their
+// delays. The last frame is held back until the next one is known to be
+// different, so FlushAsync must be awaited after the last frame.
+//
+// If keyFrameInterval isn't 0, every keyFrameInterval-th source frame is
+// written in full even when delta encoding. Everything from a full frame on
+// can be decoded without the frames before it.
+class GifFrameWriter
+{
+public:
+    GifFrameWriter(
+        GifEncoder& encoder,
+        D2D1_SIZE_U frameSize,
+        bool useDeltaEncoding,
+        bool mergeDuplicateFrames,
+        int32_t transparentIndex = -1,
+        size_t keyFrameInterval = 0);
+
+    size_t FramesMerged() const { return m_framesMerged; }
+
+    // Bytes holds BGRA8 pixels, or palette indices if palette is set.
+    winrt::Windows::Foundation::IAsyncAction WriteFrameAsync(
+        std::shared_ptr<std::vector<uint8_t> const> bytes,
+        std::shared_ptr<std::vector<PaletteColor> const> palette,
+        uint16_t delay);
+    winrt::Windows::Foundation::IAsyncAction FlushAsync();
+
+private:
+    GifEncoder& m_encoder;
+    D2D1_SIZE_U m_frameSize = {};
+    bool m_useDeltaEncoding = false;
+    bool m_mergeDuplicateFrames = false;
+    int32_t m_transparentIndex = -1;
+    size_t m_keyFrameInterval = 0;
+    size_t m_frameIndex = 0;
+    std::shared_ptr<std::vector<uint8_t> const> m_previousBytes;
+    uint64_t m_previousHash = 0;
+    std::optional<GifFrame> m_pendingFrame;
+    size_t m_framesMerged = 0;
+};
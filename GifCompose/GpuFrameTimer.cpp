@@ -0,0 +1,137 @@
+﻿#include "pch.h"
+#include "GpuFrameTimer.h"
+
+namespace
+{
+    template <typename T>
+    bool TryGetQueryData(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        winrt::com_ptr<ID3D11Query> const& query,
+        T& data)
+    {
+        auto hr = d3dContext->GetData(query.get(), &data, sizeof(data), D3D11_ASYNC_GETDATA_DONOTFLUSH);
+        winrt::check_hresult(hr);
+        return hr == S_OK;
+    }
+}
+
+GpuFrameTimer::GpuFrameTimer(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    size_t depth)
+{
+    if (depth == 0)
+    {
+        throw winrt::hresult_invalid_argument(L"The timer depth must be at least 1!");
+    }
+    m_annotation = d3dContext.try_as<ID3DUserDefinedAnnotation>();
+
+    D3D11_QUERY_DESC disjointDesc = {};
+    disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+    D3D11_QUERY_DESC timestampDesc = {};
+    timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+
+    m_slots.resize(depth);
+    for (auto&& slot : m_slots)
+    {
+        winrt::check_hresult(d3dDevice->CreateQuery(&disjointDesc, slot.Disjoint.put()));
+        for (auto&& timestamp : slot.Timestamps)
+        {
+            winrt::check_hresult(d3dDevice->CreateQuery(&timestampDesc, timestamp.put()));
+        }
+    }
+}
+
+void GpuFrameTimer::BeginCompose(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext)
+{
+    if (m_pendingCount == m_slots.size())
+    {
+        throw winrt::hresult_illegal_method_call(L"The GPU frame timer is full!");
+    }
+    d3dContext->Begin(CurrentSlot().Disjoint.get());
+    if (m_annotation)
+    {
+        m_annotation->BeginEvent(L"Compose");
+    }
+    Mark(d3dContext, ComposeStart);
+}
+
+void GpuFrameTimer::EndCompose(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext)
+{
+    Mark(d3dContext, ComposeEnd);
+    if (m_annotation)
+    {
+        m_annotation->EndEvent();
+    }
+}
+
+void GpuFrameTimer::BeginCopy(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext)
+{
+    if (m_annotation)
+    {
+        m_annotation->BeginEvent(L"CopyResource");
+    }
+    Mark(d3dContext, CopyStart);
+}
+
+void GpuFrameTimer::EndCopy(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext)
+{
+    Mark(d3dContext, CopyEnd);
+    if (m_annotation)
+    {
+        m_annotation->EndEvent();
+    }
+    d3dContext->End(CurrentSlot().Disjoint.get());
+    m_pendingCount++;
+}
+
+void GpuFrameTimer::CollectOldest(
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    PipelineProfiler* profiler)
+{
+    if (m_pendingCount == 0)
+    {
+        throw winrt::hresult_illegal_method_call(L"No frames are being timed!");
+    }
+    auto&& slot = m_slots[m_oldest];
+    m_oldest = (m_oldest + 1) % m_slots.size();
+    m_pendingCount--;
+
+    D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint = {};
+    if (!TryGetQueryData(d3dContext, slot.Disjoint, disjoint) || disjoint.Disjoint || disjoint.Frequency == 0)
+    {
+        return;
+    }
+    std::array<uint64_t, TimestampCount> ticks = {};
+    for (size_t i = 0; i < ticks.size(); i++)
+    {
+        if (!TryGetQueryData(d3dContext, slot.Timestamps[i], ticks[i]))
+        {
+            return;
+        }
+    }
+
+    auto toDuration = [frequency = disjoint.Frequency](uint64_t start, uint64_t end)
+    {
+        auto seconds = static_cast<double>(end - start) / static_cast<double>(frequency);
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    };
+    auto record = [profiler](PipelineStage stage, std::chrono::steady_clock::duration duration)
+    {
+        if (profiler != nullptr)
+        {
+            profiler->Record(stage, duration);
+        }
+        if (IsStageTracingEnabled())
+        {
+            TraceStage(stage, duration);
+        }
+    };
+    record(PipelineStage::GpuCompose, toDuration(ticks[ComposeStart], ticks[ComposeEnd]));
+    record(PipelineStage::GpuCopyResource, toDuration(ticks[CopyStart], ticks[CopyEnd]));
+}
+
+void GpuFrameTimer::Mark(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext, Timestamp timestamp)
+{
+    d3dContext->End(CurrentSlot().Timestamps[timestamp].get());
+}
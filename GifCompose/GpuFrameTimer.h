@@ -0,0 +1,54 @@
+﻿#pragma once
+#include "PipelineProfiler.h"
+
+// Times how long the GPU spends composing and copying each frame with
+// timestamp queries, and marks the same work with PIX events. Frames are
+// tracked in a ring the same depth as the readback ring, and a frame's
+// timings are collected after it has been read back, by which point the GPU
+// is done with it. We never wait on the queries, a frame whose timestamps
+// aren't ready yet is just left out.
+class GpuFrameTimer
+{
+public:
+    GpuFrameTimer(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        size_t depth);
+
+    void BeginCompose(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext);
+    void EndCompose(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext);
+    void BeginCopy(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext);
+    // Also ends the frame
+    void EndCopy(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext);
+
+    // Records the GPU stages of the oldest frame to the profiler and traces
+    // them, then frees its queries for another frame.
+    void CollectOldest(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        PipelineProfiler* profiler);
+
+private:
+    enum Timestamp
+    {
+        ComposeStart,
+        ComposeEnd,
+        CopyStart,
+        CopyEnd,
+        TimestampCount,
+    };
+
+    struct Slot
+    {
+        winrt::com_ptr<ID3D11Query> Disjoint;
+        std::array<winrt::com_ptr<ID3D11Query>, TimestampCount> Timestamps;
+    };
+
+    Slot& CurrentSlot() { return m_slots[(m_oldest + m_pendingCount) % m_slots.size()]; }
+    void Mark(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext, Timestamp timestamp);
+
+    // Null if the context doesn't support annotations
+    winrt::com_ptr<ID3DUserDefinedAnnotation> m_annotation;
+    std::vector<Slot> m_slots;
+    size_t m_oldest = 0;
+    size_t m_pendingCount = 0;
+};
@@ -0,0 +1,175 @@
+﻿#include "pch.h"
+#include "GpuQuantizer.h"
+#include "QuantizeHistogram.h"
+#include "QuantizeMap.h"
+
+namespace
+{
+    // Must match numthreads in the shaders
+    constexpr uint32_t ThreadGroupSize = 16;
+}
+
+GpuQuantizer::GpuQuantizer(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    uint32_t width,
+    uint32_t height)
+{
+    m_d3dDevice = d3dDevice;
+    m_width = width;
+    m_height = height;
+
+    winrt::check_hresult(m_d3dDevice->CreateComputeShader(g_QuantizeHistogram, sizeof(g_QuantizeHistogram), nullptr, m_histogramShader.put()));
+    winrt::check_hresult(m_d3dDevice->CreateComputeShader(g_QuantizeMap, sizeof(g_QuantizeMap), nullptr, m_mapShader.put()));
+
+    // Create our histogram
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.ByteWidth = ColorHistogramSize * sizeof(uint32_t);
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+    bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+    std::vector<uint32_t> zeros(ColorHistogramSize, 0);
+    D3D11_SUBRESOURCE_DATA initialData = {};
+    initialData.pSysMem = zeros.data();
+    winrt::check_hresult(m_d3dDevice->CreateBuffer(&bufferDesc, &initialData, m_histogramBuffer.put()));
+    D3D11_UNORDERED_ACCESS_VIEW_DESC histogramViewDesc = {};
+    histogramViewDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    histogramViewDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+    histogramViewDesc.Buffer.NumElements = ColorHistogramSize;
+    histogramViewDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+    winrt::check_hresult(m_d3dDevice->CreateUnorderedAccessView(m_histogramBuffer.get(), &histogramViewDesc, m_histogramView.put()));
+
+    bufferDesc.Usage = D3D11_USAGE_STAGING;
+    bufferDesc.BindFlags = 0;
+    bufferDesc.MiscFlags = 0;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    winrt::check_hresult(m_d3dDevice->CreateBuffer(&bufferDesc, nullptr, m_histogramStagingBuffer.put()));
+
+    m_histogram.resize(ColorHistogramSize, 0);
+    auto pixelCount = static_cast<uint64_t>(width) * height;
+    m_maxFramesBetweenFlushes = static_cast<uint32_t>(std::max<uint64_t>(UINT32_MAX / std::max<uint64_t>(pixelCount, 1), 1));
+
+    // Create our lookup table
+    bufferDesc = {};
+    bufferDesc.ByteWidth = ColorHistogramSize * sizeof(uint32_t);
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bufferDesc.StructureByteStride = sizeof(uint32_t);
+    winrt::check_hresult(m_d3dDevice->CreateBuffer(&bufferDesc, &initialData, m_lookupBuffer.put()));
+    D3D11_SHADER_RESOURCE_VIEW_DESC lookupViewDesc = {};
+    lookupViewDesc.Format = DXGI_FORMAT_UNKNOWN;
+    lookupViewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    lookupViewDesc.Buffer.FirstElement = 0;
+    lookupViewDesc.Buffer.NumElements = ColorHistogramSize;
+    winrt::check_hresult(m_d3dDevice->CreateShaderResourceView(m_lookupBuffer.get(), &lookupViewDesc, m_lookupView.put()));
+
+    // Create our index texture
+    auto indexDesc = IndexTextureDesc();
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&indexDesc, nullptr, m_indexTexture.put()));
+    winrt::check_hresult(m_d3dDevice->CreateUnorderedAccessView(m_indexTexture.get(), nullptr, m_indexView.put()));
+}
+
+D3D11_TEXTURE2D_DESC GpuQuantizer::IndexTextureDesc() const
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = m_width;
+    desc.Height = m_height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_R8_UINT;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+    desc.SampleDesc.Count = 1;
+    return desc;
+}
+
+void GpuQuantizer::AccumulateHistogram(
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    auto inputView = GetInputView(texture);
+    ID3D11ShaderResourceView* shaderResources[] = { inputView.get() };
+    ID3D11UnorderedAccessView* unorderedAccessViews[] = { m_histogramView.get() };
+    d3dContext->CSSetShader(m_histogramShader.get(), nullptr, 0);
+    d3dContext->CSSetShaderResources(0, 1, shaderResources);
+    d3dContext->CSSetUnorderedAccessViews(0, 1, unorderedAccessViews, nullptr);
+    d3dContext->Dispatch((m_width + ThreadGroupSize - 1) / ThreadGroupSize, (m_height + ThreadGroupSize - 1) / ThreadGroupSize, 1);
+
+    // Unbind everything so D2D can render to the texture again
+    ID3D11ShaderResourceView* nullShaderResources[] = { nullptr };
+    ID3D11UnorderedAccessView* nullUnorderedAccessViews[] = { nullptr };
+    d3dContext->CSSetShaderResources(0, 1, nullShaderResources);
+    d3dContext->CSSetUnorderedAccessViews(0, 1, nullUnorderedAccessViews, nullptr);
+
+    m_framesSinceFlush++;
+    if (m_framesSinceFlush >= m_maxFramesBetweenFlushes)
+    {
+        FlushHistogram(d3dContext);
+    }
+}
+
+ColorPalette GpuQuantizer::BuildPalette(
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    bool reserveTransparentIndex)
+{
+    FlushHistogram(d3dContext);
+    ColorHistogram histogram;
+    histogram.Counts = m_histogram;
+    std::fill(m_histogram.begin(), m_histogram.end(), 0);
+    return BuildMedianCutPalette(histogram, reserveTransparentIndex);
+}
+
+void GpuQuantizer::SetPalette(
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    ColorPalette const& palette)
+{
+    std::vector<uint32_t> lookup(palette.Lookup.begin(), palette.Lookup.end());
+    d3dContext->UpdateSubresource(m_lookupBuffer.get(), 0, nullptr, lookup.data(), 0, 0);
+}
+
+void GpuQuantizer::MapToPalette(
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    auto inputView = GetInputView(texture);
+    ID3D11ShaderResourceView* shaderResources[] = { inputView.get(), m_lookupView.get() };
+    ID3D11UnorderedAccessView* unorderedAccessViews[] = { m_indexView.get() };
+    d3dContext->CSSetShader(m_mapShader.get(), nullptr, 0);
+    d3dContext->CSSetShaderResources(0, 2, shaderResources);
+    d3dContext->CSSetUnorderedAccessViews(0, 1, unorderedAccessViews, nullptr);
+    d3dContext->Dispatch((m_width + ThreadGroupSize - 1) / ThreadGroupSize, (m_height + ThreadGroupSize - 1) / ThreadGroupSize, 1);
+
+    ID3D11ShaderResourceView* nullShaderResources[] = { nullptr, nullptr };
+    ID3D11UnorderedAccessView* nullUnorderedAccessViews[] = { nullptr };
+    d3dContext->CSSetShaderResources(0, 2, nullShaderResources);
+    d3dContext->CSSetUnorderedAccessViews(0, 1, nullUnorderedAccessViews, nullptr);
+}
+
+winrt::com_ptr<ID3D11ShaderResourceView> GpuQuantizer::GetInputView(winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    // We almost always get the same render target
+    if (texture != m_lastInput)
+    {
+        m_lastInputView = nullptr;
+        winrt::check_hresult(m_d3dDevice->CreateShaderResourceView(texture.get(), nullptr, m_lastInputView.put()));
+        m_lastInput = texture;
+    }
+    return m_lastInputView;
+}
+
+void GpuQuantizer::FlushHistogram(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext)
+{
+    d3dContext->CopyResource(m_histogramStagingBuffer.get(), m_histogramBuffer.get());
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    winrt::check_hresult(d3dContext->Map(m_histogramStagingBuffer.get(), 0, D3D11_MAP_READ, 0, &mapped));
+    auto counts = reinterpret_cast<uint32_t const*>(mapped.pData);
+    for (uint32_t i = 0; i < ColorHistogramSize; i++)
+    {
+        m_histogram[i] += counts[i];
+    }
+    d3dContext->Unmap(m_histogramStagingBuffer.get(), 0);
+
+    UINT const zeros[4] = {};
+    d3dContext->ClearUnorderedAccessViewUint(m_histogramView.get(), zeros);
+    m_framesSinceFlush = 0;
+}
@@ -0,0 +1,66 @@
+﻿#pragma once
+#include "Quantizer.h"
+
+// Quantizes frames on the GPU with compute shaders. The histogram of a
+// frame is built on the GPU and turned into a median cut palette on the
+// CPU, then every pixel is mapped to its palette index on the GPU. Only the
+// 8-bit index texture needs to be read back.
+class GpuQuantizer
+{
+public:
+    GpuQuantizer(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        uint32_t width,
+        uint32_t height);
+
+    // An R8_UINT texture holding the result of the last MapToPalette call.
+    winrt::com_ptr<ID3D11Texture2D> IndexTexture() const { return m_indexTexture; }
+    D3D11_TEXTURE2D_DESC IndexTextureDesc() const;
+
+    // Adds the colors of the texture to the running histogram. The texture
+    // must be BGRA8 and bindable as a shader resource.
+    void AccumulateHistogram(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        winrt::com_ptr<ID3D11Texture2D> const& texture);
+    // Builds a palette out of everything accumulated since the last call,
+    // and clears the histogram. This waits on the GPU.
+    ColorPalette BuildPalette(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        bool reserveTransparentIndex);
+    // The palette used by MapToPalette.
+    void SetPalette(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        ColorPalette const& palette);
+    void MapToPalette(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        winrt::com_ptr<ID3D11Texture2D> const& texture);
+
+private:
+    winrt::com_ptr<ID3D11ShaderResourceView> GetInputView(winrt::com_ptr<ID3D11Texture2D> const& texture);
+    void FlushHistogram(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext);
+
+private:
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    winrt::com_ptr<ID3D11ComputeShader> m_histogramShader;
+    winrt::com_ptr<ID3D11ComputeShader> m_mapShader;
+
+    winrt::com_ptr<ID3D11Buffer> m_histogramBuffer;
+    winrt::com_ptr<ID3D11UnorderedAccessView> m_histogramView;
+    winrt::com_ptr<ID3D11Buffer> m_histogramStagingBuffer;
+    // The GPU histogram uses 32-bit counters, so we move the counts over
+    // here before they can overflow.
+    std::vector<uint64_t> m_histogram;
+    uint32_t m_framesSinceFlush = 0;
+    uint32_t m_maxFramesBetweenFlushes = 0;
+
+    winrt::com_ptr<ID3D11Buffer> m_lookupBuffer;
+    winrt::com_ptr<ID3D11ShaderResourceView> m_lookupView;
+
+    winrt::com_ptr<ID3D11Texture2D> m_indexTexture;
+    winrt::com_ptr<ID3D11UnorderedAccessView> m_indexView;
+
+    winrt::com_ptr<ID3D11Texture2D> m_lastInput;
+    winrt::com_ptr<ID3D11ShaderResourceView> m_lastInputView;
+};
@@ -0,0 +1,44 @@
+﻿#include "pch.h"
+#include "Hash.h"
+
+uint64_t MurmurHash64A(void const* data, size_t size, uint64_t seed)
+{
+    constexpr uint64_t m = 0xc6a4a7935bd1e995ull;
+    constexpr int r = 47;
+
+    auto hash = seed ^ (size * m);
+
+    auto bytes = reinterpret_cast<uint8_t const*>(data);
+    auto blockCount = size / 8;
+    for (size_t i = 0; i < blockCount; i++)
+    {
+        uint64_t k = 0;
+        memcpy(&k, bytes + (i * 8), sizeof(k));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        hash ^= k;
+        hash *= m;
+    }
+
+    auto tail = bytes + (blockCount * 8);
+    switch (size & 7)
+    {
+    case 7: hash ^= static_cast<uint64_t>(tail[6]) << 48; [[fallthrough]];
+    case 6: hash ^= static_cast<uint64_t>(tail[5]) << 40; [[fallthrough]];
+    case 5: hash ^= static_cast<uint64_t>(tail[4]) << 32; [[fallthrough]];
+    case 4: hash ^= static_cast<uint64_t>(tail[3]) << 24; [[fallthrough]];
+    case 3: hash ^= static_cast<uint64_t>(tail[2]) << 16; [[fallthrough]];
+    case 2: hash ^= static_cast<uint64_t>(tail[1]) << 8; [[fallthrough]];
+    case 1: hash ^= static_cast<uint64_t>(tail[0]);
+        hash *= m;
+    }
+
+    hash ^= hash >> r;
+    hash *= m;
+    hash ^= hash >> r;
+
+    return hash;
+}
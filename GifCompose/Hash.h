@@ -0,0 +1,5 @@
+﻿#pragma once
+
+// MurmurHash64A by Austin Appleby. Not cryptographic, but fast and well
+// distributed, which is all we need to tell files apart.
+uint64_t MurmurHash64A(void const* data, size_t size, uint64_t seed = 0);
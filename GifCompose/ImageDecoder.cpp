@@ -0,0 +1,164 @@
+﻿#include "pch.h"
+#include "ImageDecoder.h"
+#include "DecodeCache.h"
+
+namespace
+{
+    DecodedImage DecodeFrame(
+        winrt::com_ptr<IWICImagingFactory2> const& wicFactory,
+        winrt::com_ptr<IWICBitmapDecoder> const& decoder)
+    {
+        winrt::com_ptr<IWICBitmapFrameDecode> frame;
+        winrt::check_hresult(decoder->GetFrame(0, frame.put()));
+
+        // Convert to the same format the D2D bitmaps expect
+        winrt::com_ptr<IWICFormatConverter> converter;
+        winrt::check_hresult(wicFactory->CreateFormatConverter(converter.put()));
+        winrt::check_hresult(converter->Initialize(frame.get(), GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom));
+
+        DecodedImage image;
+        winrt::check_hresult(converter->GetSize(&image.Width, &image.Height));
+        image.Bytes.resize(image.Size());
+        winrt::check_hresult(converter->CopyPixels(nullptr, image.Stride(), static_cast<uint32_t>(image.Bytes.size()), image.Bytes.data()));
+        // We're already on a worker thread, so this is cheap compared to paying
+        // for it during composition.
+        image.Coverage = ComputeCoverage(image);
+        return image;
+    }
+}
+
+winrt::com_ptr<IWICImagingFactory2> CreateWICFactory()
+{
+    return winrt::create_instance<IWICImagingFactory2>(CLSID_WICImagingFactory2, CLSCTX_INPROC_SERVER);
+}
+
+ImageCoverage ComputeCoverage(DecodedImage const& image)
+{
+    uint32_t left = image.Width;
+    uint32_t right = 0;
+    uint32_t top = image.Height;
+    uint32_t bottom = 0;
+    auto isOpaque = true;
+    for (uint32_t y = 0; y < image.Height; y++)
+    {
+        auto row = image.Data() + (static_cast<size_t>(y) * image.Stride());
+        for (uint32_t x = 0; x < image.Width; x++)
+        {
+            auto alpha = row[(x * 4) + 3];
+            if (alpha != 255)
+            {
+                isOpaque = false;
+            }
+            if (alpha != 0)
+            {
+                left = std::min(left, x);
+                right = std::max(right, x + 1);
+                top = std::min(top, y);
+                bottom = y + 1;
+            }
+        }
+    }
+
+    ImageCoverage coverage;
+    coverage.IsOpaque = isOpaque && image.Width > 0 && image.Height > 0;
+    if (top < bottom)
+    {
+        coverage.Bounds = { left, top, right - left, bottom - top };
+    }
+    return coverage;
+}
+
+DecodedImage DecodeImageFile(
+    winrt::com_ptr<IWICImagingFactory2> const& wicFactory,
+    std::filesystem::path const& path)
+{
+    // WIC reads straight out of the mapping instead of going through a file
+    // stream, which adds up over thousands of small frames.
+    MappedFile file(path);
+    return DecodeImageMemory(wicFactory, file.Data(), file.Size());
+}
+
+DecodedImage DecodeImageMemory(
+    winrt::com_ptr<IWICImagingFactory2> const& wicFactory,
+    uint8_t const* data,
+    size_t size)
+{
+    if (data == nullptr || size == 0)
+    {
+        throw winrt::hresult_invalid_argument(L"Image files can't be empty!");
+    }
+    if (size > UINT32_MAX)
+    {
+        throw winrt::hresult_invalid_argument(L"Image files must be smaller than 4GB!");
+    }
+    winrt::com_ptr<IWICStream> stream;
+    winrt::check_hresult(wicFactory->CreateStream(stream.put()));
+    // WIC only reads from the buffer
+    winrt::check_hresult(stream->InitializeFromMemory(const_cast<uint8_t*>(data), static_cast<DWORD>(size)));
+    winrt::com_ptr<IWICBitmapDecoder> decoder;
+    winrt::check_hresult(wicFactory->CreateDecoderFromStream(stream.get(), nullptr, WICDecodeMetadataCacheOnDemand, decoder.put()));
+    return DecodeFrame(wicFactory, decoder);
+}
+
+winrt::com_ptr<ID3D11Texture2D> CreateTextureFromImage(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    DecodedImage const& image)
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = image.Width;
+    desc.Height = image.Height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    desc.SampleDesc.Count = 1;
+
+    D3D11_SUBRESOURCE_DATA data = {};
+    data.pSysMem = image.Data();
+    data.SysMemPitch = image.Stride();
+    data.SysMemSlicePitch = static_cast<uint32_t>(image.Size());
+
+    winrt::com_ptr<ID3D11Texture2D> texture;
+    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, &data, texture.put()));
+    return texture;
+}
+
+ParallelDecoder::ParallelDecoder(
+    uint32_t workerCount,
+    std::shared_ptr<DecodeCache> const& cache,
+    PipelineProfiler* profiler) : m_pool(workerCount)
+{
+    m_wicFactory = CreateWICFactory();
+    m_cache = cache;
+    m_profiler = profiler;
+}
+
+std::future<DecodedImage> ParallelDecoder::DecodeAsync(std::filesystem::path const& path)
+{
+    return m_pool.Submit([wicFactory = m_wicFactory, cache = m_cache, profiler = m_profiler, path]()
+        {
+            std::optional<MappedFile> mapping;
+            {
+                StageTimer timer(profiler, PipelineStage::FileOpen);
+                mapping.emplace(path);
+            }
+            auto&& file = mapping.value();
+            StageTimer timer(profiler, PipelineStage::Decode);
+            if (!cache)
+            {
+                return DecodeImageMemory(wicFactory, file.Data(), file.Size());
+            }
+
+            // We have to read the whole file to hash it anyway, so on a miss
+            // we decode from the same mapping.
+            auto key = DecodeCache::CreateKey(path, file);
+            if (auto cached = cache->TryLoad(key))
+            {
+                return std::move(cached.value());
+            }
+            auto image = DecodeImageMemory(wicFactory, file.Data(), file.Size());
+            cache->Store(key, image);
+            return image;
+        });
+}
@@ -0,0 +1,66 @@
+﻿#pragma once
+#include "ThreadPool.h"
+#include "FrameDiff.h"
+#include "MappedFile.h"
+#include "PipelineProfiler.h"
+
+class DecodeCache;
+
+// Which part of an image actually draws anything.
+struct ImageCoverage
+{
+    // Bounding rectangle of the pixels that aren't fully transparent.
+    PixelRect Bounds;
+    // True if every pixel in the image is fully opaque.
+    bool IsOpaque = false;
+};
+
+// A decoded image in premultiplied BGRA8 with tightly packed rows.
+struct DecodedImage
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<uint8_t> Bytes;
+    // Used instead of Bytes when the pixels live in a mapped cache file
+    std::shared_ptr<MappedFile> Mapping;
+    uint8_t const* MappedPixels = nullptr;
+    ImageCoverage Coverage;
+
+    uint32_t Stride() const { return Width * 4; }
+    uint8_t const* Data() const { return MappedPixels != nullptr ? MappedPixels : Bytes.data(); }
+    size_t Size() const { return static_cast<size_t>(Stride()) * Height; }
+};
+
+winrt::com_ptr<IWICImagingFactory2> CreateWICFactory();
+ImageCoverage ComputeCoverage(DecodedImage const& image);
+DecodedImage DecodeImageFile(
+    winrt::com_ptr<IWICImagingFactory2> const& wicFactory,
+    std::filesystem::path const& path);
+DecodedImage DecodeImageMemory(
+    winrt::com_ptr<IWICImagingFactory2> const& wicFactory,
+    uint8_t const* data,
+    size_t size);
+winrt::com_ptr<ID3D11Texture2D> CreateTextureFromImage(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    DecodedImage const& image);
+
+// Decodes images to CPU memory on a pool of worker threads. Only the
+// texture upload needs to happen on the thread that owns the device. If a
+// cache is provided, images that have been decoded before are loaded from it.
+class ParallelDecoder
+{
+public:
+    ParallelDecoder(
+        uint32_t workerCount,
+        std::shared_ptr<DecodeCache> const& cache = nullptr,
+        PipelineProfiler* profiler = nullptr);
+
+    uint32_t WorkerCount() const { return m_pool.ThreadCount(); }
+    std::future<DecodedImage> DecodeAsync(std::filesystem::path const& path);
+
+private:
+    winrt::com_ptr<IWICImagingFactory2> m_wicFactory;
+    std::shared_ptr<DecodeCache> m_cache;
+    PipelineProfiler* m_profiler = nullptr;
+    ThreadPool m_pool;
+};
@@ -0,0 +1,47 @@
+﻿#include "pch.h"
+#include "ImageHeader.h"
+
+namespace
+{
+    uint32_t ReadUInt32BigEndian(uint8_t const* bytes)
+    {
+        return (static_cast<uint32_t>(bytes[0]) << 24) |
+            (static_cast<uint32_t>(bytes[1]) << 16) |
+            (static_cast<uint32_t>(bytes[2]) << 8) |
+            static_cast<uint32_t>(bytes[3]);
+    }
+
+    std::wstring FormatSize(D2D1_SIZE_U size)
+    {
+        return std::to_wstring(size.width) + L"x" + std::to_wstring(size.height);
+    }
+}
+
+D2D1_SIZE_U ReadPngSize(std::filesystem::path const& path)
+{
+    // The signature is followed by the IHDR chunk, which has to come first:
+    // its length (13), its type, then the width and height.
+    std::array<uint8_t, 24> header = {};
+    std::ifstream file(path, std::ios::binary);
+    file.read(reinterpret_cast<char*>(header.data()), header.size());
+    static constexpr std::array<uint8_t, 16> expected = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n', 0, 0, 0, 13, 'I', 'H', 'D', 'R' };
+    if (file.gcount() != static_cast<std::streamsize>(header.size()) || !std::equal(expected.begin(), expected.end(), header.begin()))
+    {
+        throw winrt::hresult_invalid_argument(L"Not a valid PNG: " + path.filename().wstring());
+    }
+    return D2D1_SIZE_U{ ReadUInt32BigEndian(header.data() + 16), ReadUInt32BigEndian(header.data() + 20) };
+}
+
+void CheckImageSizes(std::vector<std::filesystem::path> const& paths, D2D1_SIZE_U size, std::wstring const& kind)
+{
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        auto imageSize = ReadPngSize(paths[i]);
+        if (imageSize.width != size.width || imageSize.height != size.height)
+        {
+            throw winrt::hresult_invalid_argument(
+                kind + L" " + std::to_wstring(i) + L" (" + paths[i].filename().wstring() + L") is " +
+                FormatSize(imageSize) + L", expected " + FormatSize(size) + L"!");
+        }
+    }
+}
@@ -0,0 +1,8 @@
+﻿#pragma once
+
+// Reads the size of a PNG from its IHDR chunk without decoding any pixels.
+D2D1_SIZE_U ReadPngSize(std::filesystem::path const& path);
+
+// Makes sure every image is the given size using only their headers. Throws
+// naming the first one that isn't, kind is used in the message (e.g. "Frame").
+void CheckImageSizes(std::vector<std::filesystem::path> const& paths, D2D1_SIZE_U size, std::wstring const& kind);
@@ -0,0 +1,162 @@
+﻿#include "pch.h"
+#include "IncrementalManifest.h"
+#include "MappedFile.h"
+#include "Hash.h"
+
+namespace winrt
+{
+    using namespace Windows::Data::Json;
+}
+
+namespace
+{
+    constexpr double ManifestVersion = 1;
+
+    // Stands in for the frame before the first one and after the last one
+    constexpr uint64_t NoFrameHash = 0x6e6f6672616d6521ull;
+
+    std::wstring ToHexString(uint64_t value)
+    {
+        wchar_t buffer[17] = {};
+        swprintf_s(buffer, L"%016llx", value);
+        return buffer;
+    }
+
+    uint64_t ParseHexString(winrt::hstring const& text)
+    {
+        if (text.size() != 16)
+        {
+            throw winrt::hresult_invalid_argument(L"Invalid hash in manifest!");
+        }
+        size_t processed = 0;
+        auto value = std::stoull(std::wstring(text), &processed, 16);
+        if (processed != text.size())
+        {
+            throw winrt::hresult_invalid_argument(L"Invalid hash in manifest!");
+        }
+        return value;
+    }
+
+    uint64_t GetNamedInteger(winrt::JsonObject const& object, wchar_t const* name)
+    {
+        auto value = object.GetNamedNumber(name);
+        if (value < 0 || value != std::floor(value))
+        {
+            throw winrt::hresult_invalid_argument(L"Invalid number in manifest!");
+        }
+        return static_cast<uint64_t>(value);
+    }
+}
+
+std::optional<IncrementalManifest> TryLoadIncrementalManifest(std::filesystem::path const& path)
+{
+    std::error_code error;
+    if (!std::filesystem::exists(path, error))
+    {
+        return std::nullopt;
+    }
+    // A manifest we can't read just means starting over
+    try
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+        {
+            return std::nullopt;
+        }
+        std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        auto manifestObject = winrt::JsonObject::Parse(winrt::to_hstring(text));
+        if (manifestObject.GetNamedNumber(L"version") != ManifestVersion)
+        {
+            return std::nullopt;
+        }
+
+        IncrementalManifest manifest;
+        manifest.SettingsHash = ParseHexString(manifestObject.GetNamedString(L"settings"));
+        manifest.OutputHash = ParseHexString(manifestObject.GetNamedString(L"outputHash"));
+        size_t nextFrame = 0;
+        uint64_t nextOffset = 0;
+        for (auto&& value : manifestObject.GetNamedArray(L"blocks"))
+        {
+            auto blockObject = value.GetObject();
+            ManifestBlock block;
+            block.FirstFrame = static_cast<size_t>(GetNamedInteger(blockObject, L"first"));
+            block.FrameCount = static_cast<size_t>(GetNamedInteger(blockObject, L"count"));
+            block.Key = ParseHexString(blockObject.GetNamedString(L"key"));
+            block.IsKeyFrame = blockObject.GetNamedBoolean(L"keyFrame");
+            block.Offset = GetNamedInteger(blockObject, L"offset");
+            block.Size = GetNamedInteger(blockObject, L"size");
+            if (block.FirstFrame != nextFrame || block.FrameCount == 0 || block.Offset != nextOffset)
+            {
+                return std::nullopt;
+            }
+            nextFrame += block.FrameCount;
+            nextOffset += block.Size;
+            manifest.Blocks.push_back(block);
+        }
+        return manifest;
+    }
+    catch (winrt::hresult_error const&)
+    {
+        return std::nullopt;
+    }
+    catch (std::exception const&)
+    {
+        return std::nullopt;
+    }
+}
+
+void SaveIncrementalManifest(std::filesystem::path const& path, IncrementalManifest const& manifest)
+{
+    winrt::JsonArray blocks;
+    for (auto&& block : manifest.Blocks)
+    {
+        winrt::JsonObject blockObject;
+        blockObject.Insert(L"first", winrt::JsonValue::CreateNumberValue(static_cast<double>(block.FirstFrame)));
+        blockObject.Insert(L"count", winrt::JsonValue::CreateNumberValue(static_cast<double>(block.FrameCount)));
+        blockObject.Insert(L"key", winrt::JsonValue::CreateStringValue(ToHexString(block.Key)));
+        blockObject.Insert(L"keyFrame", winrt::JsonValue::CreateBooleanValue(block.IsKeyFrame));
+        blockObject.Insert(L"offset", winrt::JsonValue::CreateNumberValue(static_cast<double>(block.Offset)));
+        blockObject.Insert(L"size", winrt::JsonValue::CreateNumberValue(static_cast<double>(block.Size)));
+        blocks.Append(blockObject);
+    }
+    winrt::JsonObject manifestObject;
+    manifestObject.Insert(L"version", winrt::JsonValue::CreateNumberValue(ManifestVersion));
+    manifestObject.Insert(L"settings", winrt::JsonValue::CreateStringValue(ToHexString(manifest.SettingsHash)));
+    manifestObject.Insert(L"outputHash", winrt::JsonValue::CreateStringValue(ToHexString(manifest.OutputHash)));
+    manifestObject.Insert(L"blocks", blocks);
+
+    auto text = winrt::to_string(manifestObject.Stringify());
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write(text.data(), text.size());
+    if (!stream)
+    {
+        throw winrt::hresult_error(E_FAIL, L"Could not write the manifest!");
+    }
+}
+
+uint64_t HashFile(std::filesystem::path const& path)
+{
+    MappedFile file(path);
+    return MurmurHash64A(file.Data(), file.Size());
+}
+
+uint64_t ComputeBlockKey(
+    uint64_t settingsHash,
+    std::vector<uint64_t> const& frameHashes,
+    std::vector<uint16_t> const& frameDelays,
+    size_t firstFrame,
+    size_t frameCount)
+{
+    std::vector<uint64_t> values;
+    values.reserve((frameCount * 2) + 3);
+    values.push_back(settingsHash);
+    values.push_back(firstFrame > 0 ? frameHashes[firstFrame - 1] : NoFrameHash);
+    for (size_t i = firstFrame; i < firstFrame + frameCount; i++)
+    {
+        values.push_back(frameHashes[i]);
+        values.push_back(frameDelays[i]);
+    }
+    auto nextFrame = firstFrame + frameCount;
+    values.push_back(nextFrame < frameHashes.size() ? frameHashes[nextFrame] : NoFrameHash);
+    return MurmurHash64A(values.data(), values.size() * sizeof(uint64_t));
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+
+// A run of source frames that was encoded as one GIF frame in the last
+// output. Offset doesn't include the header.
+struct ManifestBlock
+{
+    size_t FirstFrame = 0;
+    size_t FrameCount = 0;
+    // See ComputeBlockKey
+    uint64_t Key = 0;
+    bool IsKeyFrame = false;
+    uint64_t Offset = 0;
+    uint64_t Size = 0;
+};
+
+// Written next to the output in incremental mode, so the next run can tell
+// which encoded frames it can copy instead of composing them again:
+//   { "version": 1, "settings": "<hash>", "outputHash": "<hash>",
+//     "blocks": [ { "first": 0, "count": 1, "key": "<hash>", "keyFrame": true,
+//                   "offset": 0, "size": 1024 }, ... ] }
+// Hashes are hex strings, JSON numbers can't hold all 64 bits.
+struct IncrementalManifest
+{
+    uint64_t SettingsHash = 0;
+    // Of the whole output file, so we notice if it was changed or replaced
+    uint64_t OutputHash = 0;
+    // In order, covering consecutive frames starting at the first one
+    std::vector<ManifestBlock> Blocks;
+};
+
+// Returns nothing if the manifest doesn't exist or can't be used.
+std::optional<IncrementalManifest> TryLoadIncrementalManifest(std::filesystem::path const& path);
+void SaveIncrementalManifest(std::filesystem::path const& path, IncrementalManifest const& manifest);
+
+uint64_t HashFile(std::filesystem::path const& path);
+
+// Identifies a block by everything its encoded bytes depend on: the settings,
+// the inputs and delays of its own frames, and the inputs of the frames on
+// either side of it, since those decide the delta and whether frames were
+// merged.
+uint64_t ComputeBlockKey(
+    uint64_t settingsHash,
+    std::vector<uint64_t> const& frameHashes,
+    std::vector<uint16_t> const& frameDelays,
+    size_t firstFrame,
+    size_t frameCount);
@@ -0,0 +1,271 @@
+﻿#include "pch.h"
+#include "LzwEncoder.h"
+
+namespace
+{
+    constexpr uint32_t MaxCodeSize = 12;
+    constexpr uint32_t MaxCodeCount = 1 << MaxCodeSize;
+
+    class BitWriter
+    {
+    public:
+        BitWriter(std::vector<uint8_t>& output) : m_output(output) {}
+
+        void Write(uint32_t code, uint32_t bitCount)
+        {
+            m_buffer |= static_cast<uint64_t>(code) << m_bitCount;
+            m_bitCount += bitCount;
+            m_totalBitCount += bitCount;
+            while (m_bitCount >= 8)
+            {
+                m_output.push_back(static_cast<uint8_t>(m_buffer & 0xFF));
+                m_buffer >>= 8;
+                m_bitCount -= 8;
+            }
+        }
+
+        void Flush()
+        {
+            if (m_bitCount > 0)
+            {
+                m_output.push_back(static_cast<uint8_t>(m_buffer & 0xFF));
+                m_buffer = 0;
+                m_bitCount = 0;
+            }
+        }
+
+        // Counts bytes that were added to the output directly. Only valid
+        // while nothing is buffered.
+        void Skip(uint64_t bitCount)
+        {
+            m_totalBitCount += bitCount;
+        }
+
+        // Every bit written, including the ones not flushed yet
+        uint64_t TotalBitCount() const { return m_totalBitCount; }
+
+    private:
+        std::vector<uint8_t>& m_output;
+        uint64_t m_buffer = 0;
+        uint32_t m_bitCount = 0;
+        uint64_t m_totalBitCount = 0;
+    };
+
+    // Both dictionaries map (prefix code << 8 | next index) to the code for
+    // that string. A miss is always followed by an insert of the same key
+    // (unless we're out of codes), so the flat table remembers where the
+    // probe ended.
+    class MapDictionary
+    {
+    public:
+        MapDictionary() { m_entries.reserve(MaxCodeCount); }
+
+        bool TryFind(uint32_t key, uint32_t& code)
+        {
+            auto found = m_entries.find(key);
+            if (found == m_entries.end())
+            {
+                return false;
+            }
+            code = found->second;
+            return true;
+        }
+
+        void InsertMissed(uint32_t key, uint32_t code) { m_entries.emplace(key, static_cast<uint16_t>(code)); }
+        void Clear() { m_entries.clear(); }
+
+    private:
+        std::unordered_map<uint32_t, uint16_t> m_entries;
+    };
+
+    // Open addressed with linear probing. Each slot packs the 20 bit key
+    // above the 12 bit code, so the whole table is 32KB and stays in cache.
+    // There are never more than 4096 entries, so it's at most half full.
+    class FlatDictionary
+    {
+    public:
+        FlatDictionary() { Clear(); }
+
+        bool TryFind(uint32_t key, uint32_t& code)
+        {
+            // Fibonacci hashing spreads the low bits (the next index) across
+            // the whole table
+            auto slot = (key * 2654435761u) >> (32 - TableBits);
+            while (true)
+            {
+                auto entry = m_slots[slot];
+                if (entry == EmptySlot)
+                {
+                    m_missedSlot = slot;
+                    return false;
+                }
+                if ((entry >> 12) == key)
+                {
+                    code = entry & 0xFFF;
+                    return true;
+                }
+                slot = (slot + 1) & (TableSize - 1);
+            }
+        }
+
+        void InsertMissed(uint32_t key, uint32_t code) { m_slots[m_missedSlot] = (key << 12) | code; }
+        void Clear() { m_slots.fill(EmptySlot); }
+
+    private:
+        static constexpr uint32_t TableBits = 13;
+        static constexpr uint32_t TableSize = 1 << TableBits;
+        // Code 4095 is the last one we hand out, and nothing can be added
+        // after it, so no entry is ever all ones
+        static constexpr uint32_t EmptySlot = UINT32_MAX;
+
+        std::array<uint32_t, TableSize> m_slots;
+        uint32_t m_missedSlot = 0;
+    };
+
+    template <typename Dictionary>
+    LzwStrip CompressStrip(uint8_t const* indices, size_t count, uint8_t minCodeSize, bool isFirst, bool isLast)
+    {
+        LzwStrip strip;
+        auto&& output = strip.Bytes;
+        output.reserve(count / 2);
+        BitWriter writer(output);
+
+        uint32_t const clearCode = 1u << minCodeSize;
+        uint32_t const endCode = clearCode + 1;
+        uint32_t nextCode = endCode + 1;
+        uint32_t codeSize = minCodeSize + 1u;
+
+        Dictionary dictionary;
+
+        if (isFirst)
+        {
+            writer.Write(clearCode, codeSize);
+        }
+        if (count > 0)
+        {
+            uint32_t prefix = indices[0];
+            for (size_t i = 1; i < count; i++)
+            {
+                uint32_t value = indices[i];
+                auto key = (prefix << 8) | value;
+                uint32_t code = 0;
+                if (dictionary.TryFind(key, code))
+                {
+                    prefix = code;
+                    continue;
+                }
+
+                writer.Write(prefix, codeSize);
+                if (nextCode < MaxCodeCount)
+                {
+                    dictionary.InsertMissed(key, nextCode);
+                    // The decoder adds its entry one code behind us, so we
+                    // need to widen as soon as the new code doesn't fit.
+                    if (nextCode >= (1u << codeSize))
+                    {
+                        codeSize++;
+                    }
+                    nextCode++;
+                }
+                else
+                {
+                    // Out of codes, start over with a fresh dictionary
+                    writer.Write(clearCode, codeSize);
+                    dictionary.Clear();
+                    nextCode = endCode + 1;
+                    codeSize = minCodeSize + 1u;
+                }
+                prefix = value;
+            }
+            writer.Write(prefix, codeSize);
+            // The decoder still adds an entry for the last code it reads,
+            // which can widen the end code (or the clear code that starts
+            // the next strip).
+            if (nextCode < MaxCodeCount && nextCode >= (1u << codeSize))
+            {
+                codeSize++;
+            }
+        }
+        writer.Write(isLast ? endCode : clearCode, codeSize);
+        strip.BitCount = writer.TotalBitCount();
+        writer.Flush();
+
+        return strip;
+    }
+}
+
+std::wstring_view GetLzwDictionaryName(LzwDictionary dictionary)
+{
+    switch (dictionary)
+    {
+    case LzwDictionary::Map:
+        return L"map";
+    case LzwDictionary::Flat:
+        return L"flat";
+    default:
+        return L"unknown";
+    }
+}
+
+std::vector<uint8_t> LzwCompress(uint8_t const* indices, size_t count, uint8_t minCodeSize, LzwDictionary dictionary)
+{
+    return LzwCompressStrip(indices, count, minCodeSize, true, true, dictionary).Bytes;
+}
+
+LzwStrip LzwCompressStrip(uint8_t const* indices, size_t count, uint8_t minCodeSize, bool isFirst, bool isLast, LzwDictionary dictionary)
+{
+    if (dictionary == LzwDictionary::Map)
+    {
+        return CompressStrip<MapDictionary>(indices, count, minCodeSize, isFirst, isLast);
+    }
+    return CompressStrip<FlatDictionary>(indices, count, minCodeSize, isFirst, isLast);
+}
+
+std::vector<uint8_t> JoinLzwStrips(std::vector<LzwStrip> const& strips)
+{
+    size_t size = 0;
+    for (auto&& strip : strips)
+    {
+        size += strip.Bytes.size();
+    }
+    std::vector<uint8_t> output;
+    output.reserve(size);
+    BitWriter writer(output);
+    for (auto&& strip : strips)
+    {
+        auto fullBytes = static_cast<size_t>(strip.BitCount / 8);
+        if (writer.TotalBitCount() % 8 == 0)
+        {
+            // Byte aligned, so there's nothing to shift
+            output.insert(output.end(), strip.Bytes.begin(), strip.Bytes.begin() + fullBytes);
+            writer.Skip(fullBytes * 8);
+        }
+        else
+        {
+            for (size_t i = 0; i < fullBytes; i++)
+            {
+                writer.Write(strip.Bytes[i], 8);
+            }
+        }
+        auto remainingBits = static_cast<uint32_t>(strip.BitCount % 8);
+        if (remainingBits > 0)
+        {
+            writer.Write(strip.Bytes[fullBytes] & ((1u << remainingBits) - 1), remainingBits);
+        }
+    }
+    writer.Flush();
+    return output;
+}
+
+void AppendSubBlocks(std::vector<uint8_t>& output, std::vector<uint8_t> const& data)
+{
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+        auto blockSize = std::min<size_t>(data.size() - offset, 255);
+        output.push_back(static_cast<uint8_t>(blockSize));
+        output.insert(output.end(), data.begin() + offset, data.begin() + offset + blockSize);
+        offset += blockSize;
+    }
+    output.push_back(0);
+}
@@ -0,0 +1,47 @@
+﻿#pragma once
+
+enum class LzwDictionary
+{
+    // std::unordered_map, kept to benchmark against
+    Map,
+    // A flat open addressed table that fits in L1
+    Flat,
+};
+
+std::wstring_view GetLzwDictionaryName(LzwDictionary dictionary);
+
+// Compresses a stream of palette indices using GIF's variable length LZW
+// scheme. The codes are packed least significant bit first, but are not yet
+// split into data sub-blocks.
+std::vector<uint8_t> LzwCompress(
+    uint8_t const* indices,
+    size_t count,
+    uint8_t minCodeSize,
+    LzwDictionary dictionary = LzwDictionary::Flat);
+
+// Appends data as a series of GIF data sub-blocks followed by the block
+// terminator.
+void AppendSubBlocks(std::vector<uint8_t>& output, std::vector<uint8_t> const& data);
+
+// Part of a code stream, as written by LzwCompressStrip. The last byte can
+// be partly filled.
+struct LzwStrip
+{
+    std::vector<uint8_t> Bytes;
+    uint64_t BitCount = 0;
+};
+
+// Compresses one strip of a frame's indices on its own, so strips can be
+// compressed in parallel and joined with JoinLzwStrips. Every strip starts
+// with a fresh dictionary: the strip before it ends with a clear code
+// instead of the end code. Only the first strip starts with a clear code.
+LzwStrip LzwCompressStrip(
+    uint8_t const* indices,
+    size_t count,
+    uint8_t minCodeSize,
+    bool isFirst,
+    bool isLast,
+    LzwDictionary dictionary = LzwDictionary::Flat);
+
+// Packs the strips one after the other into a single code stream.
+std::vector<uint8_t> JoinLzwStrips(std::vector<LzwStrip> const& strips);
@@ -0,0 +1,30 @@
+﻿#include "pch.h"
+#include "MappedFile.h"
+
+MappedFile::MappedFile(std::filesystem::path const& path)
+{
+    m_file.reset(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_file)
+    {
+        winrt::throw_last_error();
+    }
+    LARGE_INTEGER size = {};
+    winrt::check_bool(GetFileSizeEx(m_file.get(), &size));
+    m_size = static_cast<size_t>(size.QuadPart);
+    // You can't map an empty file
+    if (m_size == 0)
+    {
+        return;
+    }
+
+    m_mapping.reset(CreateFileMappingW(m_file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (!m_mapping)
+    {
+        winrt::throw_last_error();
+    }
+    m_view.reset(reinterpret_cast<uint8_t const*>(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+    if (!m_view)
+    {
+        winrt::throw_last_error();
+    }
+}
@@ -0,0 +1,18 @@
+﻿#pragma once
+
+// A read-only view of an entire file. Empty files have no view, Data
+// returns nullptr for them.
+class MappedFile
+{
+public:
+    MappedFile(std::filesystem::path const& path);
+
+    uint8_t const* Data() const { return m_view.get(); }
+    size_t Size() const { return m_size; }
+
+private:
+    wil::unique_hfile m_file;
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<uint8_t const> m_view;
+    size_t m_size = 0;
+};
@@ -0,0 +1,130 @@
+﻿#include "pch.h"
+#include "MemoryBudget.h"
+
+namespace
+{
+    uint64_t GetFrameByteSize(D2D1_SIZE_U size)
+    {
+        return static_cast<uint64_t>(size.width) * size.height * 4;
+    }
+
+    // Frames the decoder keeps ahead of composition. Videos are read one
+    // frame at a time.
+    uint64_t GetWindowFrameCount(PipelineOptions const& options, size_t frameCount)
+    {
+        if (options.WindowSize == 0 || options.WindowSize > frameCount)
+        {
+            return frameCount;
+        }
+        return options.WindowSize;
+    }
+}
+
+MemoryEstimate EstimateMemoryUse(
+    PipelineOptions const& options,
+    D2D1_SIZE_U frameSize,
+    D2D1_SIZE_U outputSize,
+    size_t frameCount)
+{
+    auto frameBytes = GetFrameByteSize(frameSize);
+    auto outputBytes = GetFrameByteSize(outputSize);
+    auto windowFrames = GetWindowFrameCount(options, frameCount);
+    // See EncodeFramesAsync, the ring has two more slots than ReadbackDepth
+    auto ringSlots = static_cast<uint64_t>(options.ReadbackDepth) + 2;
+    // The native encoder keeps two frames per worker in flight, each with
+    // the previous frame for delta encoding and its encoded bytes
+    auto encoderFrames = options.Encoder == EncoderType::Native ? static_cast<uint64_t>(options.EncodeThreads) * 2 : 2;
+
+    MemoryEstimate estimate;
+    // Decoded images, read back frames and what the encoder holds on to
+    estimate.CpuBytes =
+        (windowFrames * frameBytes) +
+        (ringSlots * outputBytes) +
+        (encoderFrames * outputBytes * 3);
+    // Uploaded images, the render target, the background template, the
+    // scaled copy and the staging textures
+    estimate.GpuBytes =
+        (windowFrames * frameBytes) +
+        (frameBytes * 2) +
+        (outputBytes != frameBytes ? outputBytes : 0) +
+        (ringSlots * outputBytes);
+    return estimate;
+}
+
+void FitToMemoryBudget(
+    PipelineOptions& options,
+    D2D1_SIZE_U frameSize,
+    D2D1_SIZE_U outputSize,
+    size_t frameCount)
+{
+    auto budget = options.MemoryBudget;
+    if (budget == 0)
+    {
+        return;
+    }
+
+    // WindowSize is 0 for "all of them", pin it down so it can be shrunk
+    if (frameCount > 0)
+    {
+        options.WindowSize = static_cast<uint32_t>(std::min<uint64_t>(GetWindowFrameCount(options, frameCount), UINT32_MAX));
+    }
+    auto frameBytes = GetFrameByteSize(frameSize);
+    auto outputBytes = GetFrameByteSize(outputSize);
+    while (true)
+    {
+        auto estimate = EstimateMemoryUse(options, frameSize, outputSize, frameCount);
+        if (estimate.CpuBytes <= budget && estimate.GpuBytes <= budget)
+        {
+            break;
+        }
+
+        // Take one away from whichever uses the most
+        uint64_t windowBytes = options.WindowSize > 1 ? static_cast<uint64_t>(options.WindowSize) * frameBytes : 0;
+        uint64_t ringBytes = options.ReadbackDepth > 1 ? static_cast<uint64_t>(options.ReadbackDepth) * outputBytes : 0;
+        uint64_t encoderBytes = options.Encoder == EncoderType::Native && options.EncodeThreads > 1 ?
+            static_cast<uint64_t>(options.EncodeThreads) * outputBytes * 6 : 0;
+        if (windowBytes == 0 && ringBytes == 0 && encoderBytes == 0)
+        {
+            break;
+        }
+        if (windowBytes >= ringBytes && windowBytes >= encoderBytes)
+        {
+            options.WindowSize--;
+        }
+        else if (encoderBytes >= ringBytes)
+        {
+            options.EncodeThreads--;
+        }
+        else
+        {
+            options.ReadbackDepth--;
+        }
+    }
+}
+
+bool IsOverMemoryBudget(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint64_t budget)
+{
+    if (budget != 0)
+    {
+        PROCESS_MEMORY_COUNTERS_EX counters = {};
+        winrt::check_bool(GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters)));
+        if (counters.PrivateUsage > budget)
+        {
+            return true;
+        }
+    }
+
+    auto dxgiDevice = d3dDevice.as<IDXGIDevice>();
+    winrt::com_ptr<IDXGIAdapter> adapter;
+    winrt::check_hresult(dxgiDevice->GetAdapter(adapter.put()));
+    auto adapter3 = adapter.try_as<IDXGIAdapter3>();
+    if (!adapter3)
+    {
+        return false;
+    }
+    // The OS budget shrinks when other processes need the GPU
+    DXGI_QUERY_VIDEO_MEMORY_INFO info = {};
+    winrt::check_hresult(adapter3->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info));
+    auto limit = budget != 0 ? std::min(budget, info.Budget) : info.Budget;
+    return info.CurrentUsage > limit;
+}
@@ -0,0 +1,33 @@
+﻿#pragma once
+#include "Pipeline.h"
+
+// How much memory the tunable parts of a job are expected to use, in bytes.
+struct MemoryEstimate
+{
+    uint64_t CpuBytes = 0;
+    uint64_t GpuBytes = 0;
+};
+
+// Estimates what a job with these options keeps resident at once: the
+// decode-ahead window, the staging ring and the frames queued up in the
+// encoder, plus the render targets that are always there.
+MemoryEstimate EstimateMemoryUse(
+    PipelineOptions const& options,
+    D2D1_SIZE_U frameSize,
+    D2D1_SIZE_U outputSize,
+    size_t frameCount);
+
+// Shrinks WindowSize, ReadbackDepth and EncodeThreads (largest user first)
+// until the estimate fits in options.MemoryBudget, on both the CPU and the
+// GPU. They never go below 1, so a budget that's too small for even that is
+// left to IsOverMemoryBudget to deal with. Does nothing without a budget.
+void FitToMemoryBudget(
+    PipelineOptions& options,
+    D2D1_SIZE_U frameSize,
+    D2D1_SIZE_U outputSize,
+    size_t frameCount);
+
+// True if the process is using more memory than budget, or the device more
+// video memory than budget or what the OS currently lets us have, whichever
+// is lower. A budget of 0 only checks the OS budget.
+bool IsOverMemoryBudget(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint64_t budget);
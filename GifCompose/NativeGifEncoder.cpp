@@ -0,0 +1,374 @@
+﻿#include "pch.h"
+#include "NativeGifEncoder.h"
+#include "Quantizer.h"
+#include "LzwEncoder.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+namespace
+{
+    // Not dispose, the next frame is drawn on top of this one
+    constexpr uint8_t DisposalDoNotDispose = 1;
+
+    inline void AppendUInt16(std::vector<uint8_t>& output, uint32_t value)
+    {
+        output.push_back(static_cast<uint8_t>(value & 0xFF));
+        output.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+    }
+
+    // Returns the number of bits needed to index the palette, at least 1
+    uint32_t GetPaletteBits(size_t paletteSize)
+    {
+        uint32_t bits = 1;
+        while ((1u << bits) < paletteSize)
+        {
+            bits++;
+        }
+        return bits;
+    }
+
+    void AppendColorTable(std::vector<uint8_t>& output, std::vector<PaletteColor> const& palette, uint32_t paletteBits)
+    {
+        auto tableSize = 1u << paletteBits;
+        for (uint32_t i = 0; i < tableSize; i++)
+        {
+            auto color = i < palette.size() ? palette[i] : PaletteColor{ 0, 0, 0 };
+            output.push_back(color.R);
+            output.push_back(color.G);
+            output.push_back(color.B);
+        }
+    }
+
+    // Frames with fewer indices than this are compressed in one piece. Each
+    // strip starts with an empty dictionary, so smaller strips would cost
+    // more in size than they save in time.
+    constexpr size_t MinStripSize = 256 * 1024;
+
+    // Splits large frames into strips that are compressed on the pool. The
+    // strips are also queued behind whatever else is on the pool, so the
+    // calling worker runs any strip nobody has picked up yet instead of
+    // waiting on it. That way a pool full of workers doing this can't
+    // deadlock.
+    std::vector<uint8_t> LzwCompressParallel(ThreadPool& pool, uint8_t const* indices, size_t count, uint8_t minCodeSize)
+    {
+        auto stripCount = std::min<size_t>(pool.ThreadCount(), count / MinStripSize);
+        if (stripCount <= 1)
+        {
+            return LzwCompress(indices, count, minCodeSize);
+        }
+
+        struct StripWork
+        {
+            std::packaged_task<LzwStrip()> Task;
+            std::atomic<bool> IsClaimed = false;
+
+            void TryRun()
+            {
+                if (!IsClaimed.exchange(true))
+                {
+                    Task();
+                }
+            }
+        };
+        std::vector<std::shared_ptr<StripWork>> work;
+        std::vector<std::future<LzwStrip>> results;
+        work.reserve(stripCount);
+        results.reserve(stripCount);
+        auto stripSize = (count + stripCount - 1) / stripCount;
+        for (size_t i = 0; i < stripCount; i++)
+        {
+            auto first = i * stripSize;
+            auto stripLength = std::min(stripSize, count - first);
+            auto isFirst = i == 0;
+            auto isLast = i + 1 == stripCount;
+            auto strip = std::make_shared<StripWork>();
+            strip->Task = std::packaged_task<LzwStrip()>([=]()
+                {
+                    return LzwCompressStrip(indices + first, stripLength, minCodeSize, isFirst, isLast);
+                });
+            results.push_back(strip->Task.get_future());
+            work.push_back(std::move(strip));
+        }
+        // The first strip is always ours
+        for (size_t i = 1; i < stripCount; i++)
+        {
+            pool.Submit([strip = work[i]]() { strip->TryRun(); });
+        }
+        for (auto&& strip : work)
+        {
+            strip->TryRun();
+        }
+
+        std::vector<LzwStrip> strips;
+        strips.reserve(stripCount);
+        for (auto&& result : results)
+        {
+            strips.push_back(result.get());
+        }
+        return JoinLzwStrips(strips);
+    }
+
+    // Copies the region out of a frame that has already been quantized.
+    IndexedImage GetIndexedRegion(GifFrame const& frame)
+    {
+        auto&& region = frame.Region;
+        IndexedImage image;
+        image.Width = region.Width;
+        image.Height = region.Height;
+        image.Palette = *frame.Palette;
+        image.Indices.resize(static_cast<size_t>(region.Width) * region.Height);
+        auto useTransparency = frame.Previous != nullptr && frame.TransparentIndex >= 0;
+        if (useTransparency)
+        {
+            image.TransparentIndex = frame.TransparentIndex;
+        }
+        for (uint32_t y = 0; y < region.Height; y++)
+        {
+            auto rowOffset = (static_cast<size_t>(region.Top + y) * frame.Width) + region.Left;
+            auto source = frame.Bytes->data() + rowOffset;
+            auto dest = image.Indices.data() + (static_cast<size_t>(y) * region.Width);
+            if (useTransparency)
+            {
+                auto previous = frame.Previous->data() + rowOffset;
+                auto transparentIndex = static_cast<uint8_t>(frame.TransparentIndex);
+                for (uint32_t x = 0; x < region.Width; x++)
+                {
+                    dest[x] = source[x] == previous[x] ? transparentIndex : source[x];
+                }
+            }
+            else
+            {
+                memcpy(dest, source, region.Width);
+            }
+        }
+        return image;
+    }
+
+    std::vector<uint8_t> EncodeFrame(GifFrame const& frame, std::vector<PaletteColor> const* globalPalette, DitherMode dither, ThreadPool& pool)
+    {
+        auto&& region = frame.Region;
+        IndexedImage image;
+        if (frame.Palette)
+        {
+            image = GetIndexedRegion(frame);
+        }
+        else
+        {
+            auto stride = frame.Width * 4;
+            auto regionOffset = (static_cast<size_t>(region.Top) * stride) + (region.Left * 4);
+            auto previousPixels = frame.Previous != nullptr ? frame.Previous->data() + regionOffset : nullptr;
+            image = QuantizeImage(frame.Bytes->data() + regionOffset, region.Width, region.Height, stride, previousPixels, dither);
+        }
+        // Frames using the global palette don't need a local one
+        auto useLocalPalette = frame.Palette == nullptr || frame.Palette.get() != globalPalette;
+        auto paletteBits = GetPaletteBits(image.Palette.size());
+        // LZW needs at least 2 bits
+        auto minCodeSize = static_cast<uint8_t>(std::max<uint32_t>(paletteBits, 2));
+        auto compressed = LzwCompressParallel(pool, image.Indices.data(), image.Indices.size(), minCodeSize);
+
+        std::vector<uint8_t> output;
+        output.reserve(compressed.size() + (compressed.size() / 255) + 1024);
+
+        // Graphic control extension
+        output.push_back(0x21);
+        output.push_back(0xF9);
+        output.push_back(4);
+        auto hasTransparency = image.TransparentIndex >= 0;
+        output.push_back(static_cast<uint8_t>((DisposalDoNotDispose << 2) | (hasTransparency ? 1 : 0)));
+        AppendUInt16(output, frame.Delay);
+        output.push_back(static_cast<uint8_t>(hasTransparency ? image.TransparentIndex : 0));
+        output.push_back(0);
+
+        // Image descriptor, followed by the local color table if we have one
+        output.push_back(0x2C);
+        AppendUInt16(output, region.Left);
+        AppendUInt16(output, region.Top);
+        AppendUInt16(output, region.Width);
+        AppendUInt16(output, region.Height);
+        if (useLocalPalette)
+        {
+            output.push_back(static_cast<uint8_t>(0x80 | (paletteBits - 1)));
+            AppendColorTable(output, image.Palette, paletteBits);
+        }
+        else
+        {
+            output.push_back(0);
+        }
+
+        // Image data
+        output.push_back(minCodeSize);
+        AppendSubBlocks(output, compressed);
+
+        return output;
+    }
+}
+
+NativeGifEncoder::NativeGifEncoder(
+    winrt::com_ptr<IStream> const& stream,
+    uint32_t width,
+    uint32_t height,
+    uint32_t workerCount,
+    std::shared_ptr<std::vector<PaletteColor> const> const& globalPalette,
+    PipelineProfiler* profiler,
+    bool framesOnly,
+    DitherMode dither) : m_pool(workerCount)
+{
+    if (width > UINT16_MAX || height > UINT16_MAX)
+    {
+        throw winrt::hresult_invalid_argument(L"GIFs can't be larger than 65535x65535!");
+    }
+    m_stream = stream;
+    m_width = width;
+    m_height = height;
+    m_globalPalette = globalPalette;
+    m_profiler = profiler;
+    m_framesOnly = framesOnly;
+    m_dither = dither;
+    if (m_globalPalette && (m_globalPalette->empty() || m_globalPalette->size() > MaxPaletteSize))
+    {
+        throw winrt::hresult_invalid_argument(L"The global palette must have between 1 and 256 colors!");
+    }
+    // Give the workers some slack so they don't go idle waiting on the writer
+    m_maxPending = static_cast<size_t>(m_pool.ThreadCount()) * 2;
+    if (!m_framesOnly)
+    {
+        WriteHeader();
+    }
+}
+
+winrt::IAsyncAction NativeGifEncoder::WriteFrameAsync(GifFrame frame)
+{
+    if (frame.Width != m_width || frame.Height != m_height)
+    {
+        throw winrt::hresult_invalid_argument(L"All frames must be the same size as the GIF!");
+    }
+    if (frame.Palette && frame.Palette->size() > MaxPaletteSize)
+    {
+        throw winrt::hresult_invalid_argument(L"Frame palettes can't have more than 256 colors!");
+    }
+    EncodedBlock block;
+    block.SourceFrameCount = frame.SourceFrameCount;
+    block.IsKeyFrame = frame.Previous == nullptr && frame.Region.Left == 0 && frame.Region.Top == 0 &&
+        frame.Region.Width == m_width && frame.Region.Height == m_height;
+    m_pendingBlocks.push_back(block);
+    m_pending.push_back(m_pool.Submit([frame = std::move(frame), globalPalette = m_globalPalette, profiler = m_profiler, dither = m_dither, pool = &m_pool]()
+        {
+            StageTimer timer(profiler, PipelineStage::EncodeFrame);
+            return EncodeFrame(frame, globalPalette.get(), dither, *pool);
+        }));
+    WriteEncodedFrames(m_maxPending);
+    co_return;
+}
+
+winrt::IAsyncAction NativeGifEncoder::FinishAsync()
+{
+    WriteEncodedFrames(0);
+    if (!m_framesOnly)
+    {
+        // Trailer
+        Write({ 0x3B });
+    }
+    StageTimer timer(m_profiler, PipelineStage::Flush);
+    winrt::check_hresult(m_stream->Commit(STGC_DEFAULT));
+    co_return;
+}
+
+void NativeGifEncoder::AppendEncodedFrames(winrt::com_ptr<IStream> const& frames)
+{
+    WriteEncodedFrames(0);
+    StageTimer timer(m_profiler, PipelineStage::Write);
+    winrt::check_hresult(frames->Seek({}, STREAM_SEEK_SET, nullptr));
+    ULARGE_INTEGER size = {};
+    size.QuadPart = UINT64_MAX;
+    ULARGE_INTEGER written = {};
+    winrt::check_hresult(frames->CopyTo(m_stream.get(), size, nullptr, &written));
+    m_bytesWritten += written.QuadPart;
+}
+
+void NativeGifEncoder::AppendEncodedFrames(uint8_t const* data, size_t size)
+{
+    WriteEncodedFrames(0);
+    StageTimer timer(m_profiler, PipelineStage::Write);
+    Write(data, size);
+}
+
+void NativeGifEncoder::WriteHeader()
+{
+    std::vector<uint8_t> header;
+    std::string signature("GIF89a");
+    header.insert(header.end(), signature.begin(), signature.end());
+
+    // Logical screen descriptor. Unless we were given a global palette, each
+    // frame gets its own.
+    AppendUInt16(header, m_width);
+    AppendUInt16(header, m_height);
+    if (m_globalPalette)
+    {
+        auto paletteBits = GetPaletteBits(m_globalPalette->size());
+        header.push_back(static_cast<uint8_t>(0xF0 | (paletteBits - 1)));
+        header.push_back(0);
+        header.push_back(0);
+        AppendColorTable(header, *m_globalPalette, paletteBits);
+    }
+    else
+    {
+        header.push_back(0x70);
+        header.push_back(0);
+        header.push_back(0);
+    }
+
+    // Write the application block
+    // http://www.vurdalakov.net/misc/gif/netscape-looping-application-extension
+    std::string text("NETSCAPE2.0");
+    WINRT_VERIFY(text.size() == 11);
+    header.push_back(0x21);
+    header.push_back(0xFF);
+    header.push_back(static_cast<uint8_t>(text.size()));
+    header.insert(header.end(), text.begin(), text.end());
+    // The first value is the size of the block, which is the fixed value 3.
+    // The second value is the looping extension, which is the fixed value 1.
+    // The third and fourth values comprise an unsigned 2-byte integer (little endian).
+    //     The value of 0 means to loop infinitely.
+    // The final value is the block terminator, which is the fixed value 0.
+    header.insert(header.end(), { 3, 1, 0, 0, 0 });
+
+    Write(header);
+}
+
+void NativeGifEncoder::WriteEncodedFrames(size_t maxPending)
+{
+    while (m_pending.size() > maxPending)
+    {
+        auto bytes = m_pending.front().get();
+        m_pending.pop_front();
+        auto block = m_pendingBlocks.front();
+        m_pendingBlocks.pop_front();
+        StageTimer timer(m_profiler, PipelineStage::Write);
+        Write(bytes);
+        if (m_blockLog)
+        {
+            block.Size = bytes.size();
+            m_blockLog->push_back(block);
+        }
+    }
+}
+
+void NativeGifEncoder::Write(uint8_t const* data, size_t size)
+{
+    size_t offset = 0;
+    while (offset < size)
+    {
+        auto chunkSize = static_cast<ULONG>(std::min<size_t>(size - offset, UINT32_MAX));
+        ULONG written = 0;
+        winrt::check_hresult(m_stream->Write(data + offset, chunkSize, &written));
+        if (written == 0)
+        {
+            throw winrt::hresult_error(STG_E_MEDIUMFULL);
+        }
+        offset += written;
+    }
+    m_bytesWritten += size;
+}
@@ -0,0 +1,76 @@
+﻿#pragma once
+#include "GifEncoder.h"
+#include "ThreadPool.h"
+#include "PipelineProfiler.h"
+
+// One frame as it was written to the stream.
+struct EncodedBlock
+{
+    uint32_t SourceFrameCount = 0;
+    // Written in full, so it doesn't depend on the frames before it
+    bool IsKeyFrame = false;
+    uint64_t Size = 0;
+};
+
+// A GIF89a writer that quantizes and compresses frames in parallel on a
+// pool of worker threads. Encoded frames are written to the stream in the
+// order they were submitted. Large frames are also split into strips that
+// are compressed on separate workers.
+//
+// If a global palette is provided it is written to the header, and frames
+// whose Palette is that same object are written without a local one.
+//
+// If framesOnly is true, the header and trailer are left out. The result
+// can be added to another GIF of the same size with AppendEncodedFrames,
+// which is how shards encoded separately are joined together.
+//
+// Where each frame ends up in the stream can be logged with LogBlocks.
+//
+// Frames that arrive as BGRA8 are quantized with the given dither mode.
+class NativeGifEncoder : public GifEncoder
+{
+public:
+    NativeGifEncoder(
+        winrt::com_ptr<IStream> const& stream,
+        uint32_t width,
+        uint32_t height,
+        uint32_t workerCount,
+        std::shared_ptr<std::vector<PaletteColor> const> const& globalPalette = nullptr,
+        PipelineProfiler* profiler = nullptr,
+        bool framesOnly = false,
+        DitherMode dither = DitherMode::None);
+
+    winrt::Windows::Foundation::IAsyncAction WriteFrameAsync(GifFrame frame) override;
+    winrt::Windows::Foundation::IAsyncAction FinishAsync() override;
+    // Copies everything in frames, from the start, after the frames written
+    // so far.
+    void AppendEncodedFrames(winrt::com_ptr<IStream> const& frames);
+    void AppendEncodedFrames(uint8_t const* data, size_t size);
+    // Every frame written from now on is added to log, appended frames
+    // aren't.
+    void LogBlocks(std::shared_ptr<std::vector<EncodedBlock>> const& log) { m_blockLog = log; }
+    // Including the header
+    uint64_t BytesWritten() const { return m_bytesWritten; }
+
+private:
+    void WriteHeader();
+    void WriteEncodedFrames(size_t maxPending);
+    void Write(std::vector<uint8_t> const& bytes) { Write(bytes.data(), bytes.size()); }
+    void Write(uint8_t const* data, size_t size);
+
+private:
+    winrt::com_ptr<IStream> m_stream;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::shared_ptr<std::vector<PaletteColor> const> m_globalPalette;
+    size_t m_maxPending = 0;
+    bool m_framesOnly = false;
+    DitherMode m_dither = DitherMode::None;
+    PipelineProfiler* m_profiler = nullptr;
+    ThreadPool m_pool;
+    std::deque<std::future<std::vector<uint8_t>>> m_pending;
+    // Blocks that are still being encoded, without their sizes
+    std::deque<EncodedBlock> m_pendingBlocks;
+    std::shared_ptr<std::vector<EncodedBlock>> m_blockLog;
+    uint64_t m_bytesWritten = 0;
+};
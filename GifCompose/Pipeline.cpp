@@ -0,0 +1,914 @@
+﻿#include "pch.h"
+#include "Pipeline.h"
+#include "BitmapLoader.h"
+#include "BackgroundTemplate.h"
+#include "FrameSource.h"
+#include "VideoFrameSource.h"
+#include "DecodeCache.h"
+#include "ReadbackRing.h"
+#include "FrameBufferPool.h"
+#include "WicGifEncoder.h"
+#include "NativeGifEncoder.h"
+#include "GpuQuantizer.h"
+#include "FrameDiff.h"
+#include "AllocationCounter.h"
+#include "ThreadPool.h"
+#include "StageQueue.h"
+#include "ImageHeader.h"
+#include "BufferedFileStream.h"
+#include "FrameTimings.h"
+#include "GifFrameWriter.h"
+#include "TiledComposer.h"
+#include "GpuFrameTimer.h"
+#include "FrameScaler.h"
+#include "IncrementalManifest.h"
+#include "Hash.h"
+#include "MemoryBudget.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Storage::Streams;
+}
+
+namespace
+{
+    // Called once the frame size and global palette (if any) are known.
+    // workerCount replaces options.EncodeThreads, it may have been lowered to
+    // fit the memory budget.
+    using CreateEncoderFunc = std::function<std::future<std::unique_ptr<GifEncoder>>(
+        D2D1_SIZE_U frameSize,
+        uint32_t workerCount,
+        std::shared_ptr<std::vector<PaletteColor> const> const& globalPalette)>;
+
+    // Used when the frames are too large for a texture and no tile size was
+    // asked for
+    constexpr uint32_t DefaultTileSize = 2048;
+
+    uint32_t GetTileSize(PipelineOptions const& options, D2D1_SIZE_U frameSize)
+    {
+        if (options.TileSize != 0)
+        {
+            return options.TileSize;
+        }
+        if (frameSize.width > TiledComposer::MaxTileSize || frameSize.height > TiledComposer::MaxTileSize)
+        {
+            return DefaultTileSize;
+        }
+        return 0;
+    }
+
+    std::vector<uint16_t> LoadFrameDelays(PipelineOptions const& options, std::vector<std::filesystem::path> const& framePaths)
+    {
+        std::unordered_map<std::wstring, uint16_t> timings;
+        if (!options.TimingsPath.empty())
+        {
+            timings = LoadFrameTimings(options.TimingsPath);
+        }
+        return GetFrameDelays(framePaths, timings, options.FrameDelay);
+    }
+
+    void AddJobStats(
+        PipelineStats* stats,
+        size_t frameCount,
+        size_t framesMerged,
+        CompositionStats const& composition,
+        uint64_t steadyStateAllocations)
+    {
+        if (stats == nullptr)
+        {
+            return;
+        }
+        std::scoped_lock statsLock(stats->Lock);
+        stats->FrameCount += frameCount;
+        stats->FramesMerged += framesMerged;
+        stats->Composition.FramesComposed += composition.FramesComposed;
+        stats->Composition.BackgroundsSkipped += composition.BackgroundsSkipped;
+        stats->Composition.PixelsDrawn += composition.PixelsDrawn;
+        stats->Composition.PixelsWithoutCoverage += composition.PixelsWithoutCoverage;
+        if (frameCount > 1)
+        {
+            stats->SteadyStateAllocations += steadyStateAllocations;
+            stats->SteadyStateFrames += frameCount - 1;
+        }
+    }
+
+    std::shared_ptr<ParallelDecoder> CreateDecoder(PipelineOptions const& options, PipelineStats* stats)
+    {
+        // Image decoding happens on our own worker threads
+        std::shared_ptr<DecodeCache> cache;
+        if (!options.CachePath.empty())
+        {
+            cache = std::make_shared<DecodeCache>(options.CachePath);
+        }
+        return std::make_shared<ParallelDecoder>(options.DecodeThreads, cache, stats != nullptr ? &stats->Profiler : nullptr);
+    }
+
+    winrt::IRandomAccessStream GetRandomAccessStream(winrt::com_ptr<IStream> const& stream)
+    {
+        winrt::IRandomAccessStream result{ nullptr };
+        winrt::check_hresult(CreateRandomAccessStreamOverStream(stream.get(), BSOS_DEFAULT, winrt::guid_of<winrt::IRandomAccessStream>(), winrt::put_abi(result)));
+        return result;
+    }
+
+    // Composes each frame a tile at a time with a TiledComposer. Frames never
+    // live on the GPU as a whole, so there's no GPU quantizer or global
+    // palette.
+    winrt::IAsyncAction EncodeTiledFramesAsync(
+        PipelineResources resources,
+        PipelineOptions options,
+        std::vector<std::filesystem::path> framePaths,
+        std::vector<uint16_t> frameDelays,
+        uint32_t tileSize,
+        CreateEncoderFunc createEncoder,
+        PipelineStats* stats)
+    {
+        if (options.Quantizer == QuantizerType::Gpu)
+        {
+            throw winrt::hresult_invalid_argument(L"The GPU quantizer can't be used with tiles!");
+        }
+        if (!options.Scale.IsIdentity())
+        {
+            throw winrt::hresult_invalid_argument(L"Frames can't be scaled when composing in tiles!");
+        }
+        auto profiler = stats != nullptr ? &stats->Profiler : nullptr;
+        auto&& device = resources.Device;
+        auto d2dContext = device.CreateDeviceContext();
+        auto&& decoder = *resources.Decoder;
+
+        // Only the tiles live on the GPU, so this overestimates video memory
+        auto imageSize = ReadPngSize(framePaths.front());
+        FitToMemoryBudget(options, imageSize, imageSize, framePaths.size());
+        ImageFrameSource frameSource(decoder, device.D3DDevice, d2dContext, framePaths, options.WindowSize, profiler);
+        frameSource.Initialize();
+        auto frameSize = frameSource.FrameSize();
+
+        // The backgrounds are only needed until the composer has combined them
+        std::optional<TiledComposer> composer;
+        {
+            auto backgroundPaths = GetImageFilePaths(options.BackgroundPath);
+            CheckImageSizes(backgroundPaths, frameSize, L"Background");
+            std::vector<std::future<DecodedImage>> decodes;
+            for (auto&& path : backgroundPaths)
+            {
+                decodes.push_back(decoder.DecodeAsync(path));
+            }
+            std::vector<DecodedImage> backgrounds;
+            for (auto&& decode : decodes)
+            {
+                backgrounds.push_back(decode.get());
+            }
+            composer.emplace(device, d2dContext, frameSize, tileSize, backgrounds, profiler);
+        }
+
+        auto frameCount = frameSource.FrameCount();
+        uint64_t steadyStateAllocations = 0;
+        size_t framesMerged = 0;
+        {
+            auto encoder = co_await createEncoder(frameSize, options.EncodeThreads, nullptr);
+            GifFrameWriter writer(*encoder, frameSize, options.UseDeltaEncoding, options.MergeDuplicateFrames, -1, options.KeyFrameInterval);
+            FrameBufferPool bufferPool;
+            uint64_t steadyStateStart = 0;
+            for (size_t i = 0; i < frameCount; i++)
+            {
+                if (i == 1)
+                {
+                    steadyStateStart = GetAllocationCount();
+                }
+                auto image = frameSource.GetNextImage();
+                auto buffer = bufferPool.Acquire(composer->FrameByteSize());
+                composer->Compose(image, *buffer);
+                if (profiler != nullptr)
+                {
+                    profiler->SampleVideoMemory(device.D3DDevice);
+                }
+                co_await writer.WriteFrameAsync(buffer, nullptr, frameDelays[i]);
+            }
+            co_await writer.FlushAsync();
+            framesMerged = writer.FramesMerged();
+            if (frameCount > 1)
+            {
+                steadyStateAllocations = GetAllocationCount() - steadyStateStart;
+            }
+
+            co_await encoder->FinishAsync();
+        }
+
+        AddJobStats(stats, frameCount, framesMerged, composer->Stats(), steadyStateAllocations);
+    }
+
+    // Videos are read from FramesPath directly, otherwise the frames are
+    // the images in framePaths.
+    std::unique_ptr<FrameSource> CreateFrameSource(
+        PipelineResources const& resources,
+        winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+        PipelineOptions const& options,
+        std::vector<std::filesystem::path> const& framePaths,
+        PipelineProfiler* profiler)
+    {
+        if (IsVideoFile(options.FramesPath))
+        {
+            return std::make_unique<VideoFrameSource>(resources.Device, d2dContext, options.FramesPath, options.MaxFrameRate, profiler);
+        }
+        auto source = std::make_unique<ImageFrameSource>(*resources.Decoder, resources.Device.D3DDevice, d2dContext, framePaths, options.WindowSize, profiler);
+        source->Initialize();
+        return source;
+    }
+
+    // Composes the frames onto the backgrounds and writes them to the
+    // encoder returned by createEncoder. Videos carry their own timing, so
+    // framePaths and frameDelays are empty for them.
+    winrt::IAsyncAction EncodeFramesAsync(
+        PipelineResources resources,
+        PipelineOptions options,
+        std::vector<std::filesystem::path> framePaths,
+        std::vector<uint16_t> frameDelays,
+        CreateEncoderFunc createEncoder,
+        PipelineStats* stats)
+    {
+        // Video frames always fit in a texture
+        auto isVideo = IsVideoFile(options.FramesPath);
+        if (isVideo && options.TileSize != 0)
+        {
+            throw winrt::hresult_invalid_argument(L"Videos can't be composed in tiles!");
+        }
+        auto tileSize = isVideo ? 0 : GetTileSize(options, ReadPngSize(framePaths.front()));
+        if (tileSize != 0)
+        {
+            co_await EncodeTiledFramesAsync(resources, options, framePaths, frameDelays, tileSize, createEncoder, stats);
+            co_return;
+        }
+
+        auto profiler = stats != nullptr ? &stats->Profiler : nullptr;
+        auto&& device = resources.Device;
+        auto d3dDevice = device.D3DDevice;
+        auto d3dContext = device.D3DContext;
+        auto d2dContext = device.CreateDeviceContext();
+        auto&& decoder = *resources.Decoder;
+
+        // Everything that grows with the frame size has to fit the memory
+        // budget before the decoder starts reading ahead. Videos only decode
+        // one frame at a time, so they can be opened first.
+        std::unique_ptr<FrameSource> frameSource;
+        if (isVideo)
+        {
+            frameSource = CreateFrameSource(resources, d2dContext, options, framePaths, profiler);
+        }
+        auto frameSize = frameSource ? frameSource->FrameSize() : ReadPngSize(framePaths.front());
+        FitToMemoryBudget(options, frameSize, GetScaledSize(options.Scale, frameSize), framePaths.size());
+        if (!frameSource)
+        {
+            frameSource = CreateFrameSource(resources, d2dContext, options, framePaths, profiler);
+        }
+
+        // Create our background template, or reuse one from an earlier job
+        auto createBackgroundTemplate = [&]()
+        {
+            return CreateBackgroundTemplate(device, d2dContext, decoder, options.BackgroundPath, frameSize);
+        };
+        auto backgroundTemplate = resources.Backgrounds ?
+            resources.Backgrounds->GetOrCreate(options.BackgroundPath, frameSize, createBackgroundTemplate) :
+            createBackgroundTemplate();
+
+        // Create our render target
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = frameSize.width;
+        desc.Height = frameSize.height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        desc.SampleDesc.Count = 1;
+        winrt::com_ptr<ID3D11Texture2D> renderTargetTexture;
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, renderTargetTexture.put()));
+        auto renderTarget = CreateBitmapFromTexture(renderTargetTexture, d2dContext);
+
+        // Frames are composed at the size of the source and then scaled, so
+        // everything after composition only deals with the output size
+        auto outputSize = GetScaledSize(options.Scale, frameSize);
+        auto outputTexture = renderTargetTexture;
+        auto outputDesc = desc;
+        std::optional<FrameScaler> scaler;
+        if (outputSize.width != frameSize.width || outputSize.height != frameSize.height)
+        {
+            scaler.emplace(d3dDevice, d2dContext, renderTarget, outputSize);
+            outputTexture = scaler->Texture();
+            outputDesc = scaler->TextureDesc();
+        }
+
+        // When quantizing on the GPU we only read back palette indices
+        std::unique_ptr<GpuQuantizer> quantizer;
+        if (options.Quantizer == QuantizerType::Gpu)
+        {
+            quantizer = std::make_unique<GpuQuantizer>(d3dDevice, outputSize.width, outputSize.height);
+        }
+
+        // Create our staging textures. Besides the frames waiting for the
+        // write stage, there's the one it's reading back and the one we just
+        // copied that's waiting for room in the queue.
+        ReadbackRing readback(d3dDevice, quantizer ? quantizer->IndexTextureDesc() : outputDesc, options.ReadbackDepth + 2);
+        // Frames are read back into buffers that get reused once the encoder is
+        // done with them
+        FrameBufferPool bufferPool;
+
+        FrameComposer composer(d2dContext, backgroundTemplate, renderTarget);
+
+        // The timestamp queries are only worth issuing if someone is going to
+        // look at the timings
+        std::optional<GpuFrameTimer> gpuTimer;
+        if (profiler != nullptr || IsStageTracingEnabled())
+        {
+            gpuTimer.emplace(d3dDevice, d3dContext, readback.Depth());
+        }
+
+        // A global palette needs to see every frame before we can encode any of
+        // them, so compose them all once just to build the histogram.
+        std::shared_ptr<std::vector<PaletteColor> const> globalPalette;
+        int32_t transparentIndex = -1;
+        if (quantizer && options.Palette == PaletteMode::Global)
+        {
+            auto histogramSource = CreateFrameSource(resources, d2dContext, options, framePaths, profiler);
+            while (auto frame = histogramSource->TryGetNextFrame())
+            {
+                auto lock = device.Lock();
+                {
+                    StageTimer timer(profiler, PipelineStage::Compose);
+                    composer.Compose(frame.value());
+                    if (scaler)
+                    {
+                        scaler->Scale();
+                    }
+                }
+                StageTimer timer(profiler, PipelineStage::Quantize);
+                quantizer->AccumulateHistogram(d3dContext, outputTexture);
+            }
+            auto lock = device.Lock();
+            StageTimer timer(profiler, PipelineStage::Quantize);
+            auto palette = quantizer->BuildPalette(d3dContext, options.UseDeltaEncoding);
+            quantizer->SetPalette(d3dContext, palette);
+            globalPalette = std::make_shared<std::vector<PaletteColor>>(palette.Colors);
+            transparentIndex = palette.TransparentIndex;
+        }
+
+        // Iterate through each frame and compose it with the background template. After that,
+        // extract the image and encode it as a frame. This is split into stages: this thread
+        // composes frame i and queues its copy, the write stage reads back an earlier frame
+        // from the staging ring and hands it to the encoder, and the encoder works on the
+        // frames before that on its own workers.
+        size_t frameCount = 0;
+        uint64_t steadyStateAllocations = 0;
+        size_t framesMerged = 0;
+        {
+            auto encoder = co_await createEncoder(outputSize, options.EncodeThreads, globalPalette);
+            GifFrameWriter writer(*encoder, outputSize, options.UseDeltaEncoding, options.MergeDuplicateFrames, transparentIndex, options.KeyFrameInterval);
+
+            // One for each frame in the readback ring. The palette is only
+            // set if quantized.
+            struct PendingFrame
+            {
+                std::shared_ptr<std::vector<PaletteColor> const> Palette;
+                uint16_t Delay = 0;
+            };
+            // Composition stops once it's ReadbackDepth frames ahead of the
+            // write stage
+            StageQueue<PendingFrame> pendingFrames(options.ReadbackDepth);
+            ThreadPool writeStage(1);
+            auto written = writeStage.Submit([&]()
+                {
+                    try
+                    {
+                        while (auto pending = pendingFrames.Pop())
+                        {
+                            // Get the bytes out of the render target
+                            std::shared_ptr<std::vector<uint8_t> const> bytes;
+                            {
+                                // The compose stage needs the device while we wait on the GPU
+                                StageTimer timer(profiler, PipelineStage::Readback);
+                                uint64_t copyFence = 0;
+                                {
+                                    auto readbackLock = device.Lock();
+                                    copyFence = readback.OldestCopyFence();
+                                }
+                                if (copyFence != 0)
+                                {
+                                    readback.WaitForCopy(copyFence);
+                                }
+                                while (!bytes)
+                                {
+                                    {
+                                        auto readbackLock = device.Lock();
+                                        if (readback.IsOldestReady(d3dContext))
+                                        {
+                                            auto buffer = bufferPool.Acquire(readback.FrameByteSize());
+                                            readback.Dequeue(d3dContext, *buffer);
+                                            if (gpuTimer)
+                                            {
+                                                gpuTimer->CollectOldest(d3dContext, profiler);
+                                            }
+                                            bytes = buffer;
+                                            break;
+                                        }
+                                    }
+                                    // Only reached on devices without fences. Give the lock
+                                    // back to the compose stage while the GPU catches up.
+                                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                                }
+                            }
+                            writer.WriteFrameAsync(bytes, pending->Palette, pending->Delay).get();
+                        }
+                    }
+                    catch (...)
+                    {
+                        pendingFrames.Close();
+                        throw;
+                    }
+                });
+
+            uint64_t steadyStateStart = 0;
+            try
+            {
+                while (true)
+                {
+                    if (frameCount == 1)
+                    {
+                        steadyStateStart = GetAllocationCount();
+                    }
+                    // Reading the next frame takes more memory, so if we're
+                    // over budget let the write stage and the encoder catch
+                    // up first. Check again each time the write stage takes
+                    // a frame, once it has nothing left there's nothing to
+                    // wait for.
+                    if (IsOverMemoryBudget(d3dDevice, options.MemoryBudget))
+                    {
+                        StageTimer timer(profiler, PipelineStage::Throttle);
+                        do
+                        {
+                            if (!pendingFrames.WaitForPop())
+                            {
+                                break;
+                            }
+                        } while (IsOverMemoryBudget(d3dDevice, options.MemoryBudget));
+                    }
+                    auto nextFrame = frameSource->TryGetNextFrame();
+                    if (!nextFrame.has_value())
+                    {
+                        break;
+                    }
+                    auto&& frame = nextFrame.value();
+                    PendingFrame pending;
+                    pending.Delay = frame.Delay.has_value() ? frame.Delay.value() : frameDelays[frameCount];
+                    frameCount++;
+
+                    // Render the frame
+                    {
+                        auto lock = device.Lock();
+                        {
+                            // EndDraw submits the D2D batch to the immediate context,
+                            // so the timestamps on either side bracket all of it.
+                            StageTimer timer(profiler, PipelineStage::Compose);
+                            if (gpuTimer)
+                            {
+                                gpuTimer->BeginCompose(d3dContext);
+                            }
+                            composer.Compose(frame);
+                            if (scaler)
+                            {
+                                scaler->Scale();
+                            }
+                            if (gpuTimer)
+                            {
+                                gpuTimer->EndCompose(d3dContext);
+                            }
+                        }
+                        if (quantizer)
+                        {
+                            StageTimer timer(profiler, PipelineStage::Quantize);
+                            pending.Palette = globalPalette;
+                            if (!pending.Palette)
+                            {
+                                // Building a palette per frame means waiting on the GPU
+                                // for each histogram.
+                                quantizer->AccumulateHistogram(d3dContext, outputTexture);
+                                auto palette = quantizer->BuildPalette(d3dContext, false);
+                                quantizer->SetPalette(d3dContext, palette);
+                                pending.Palette = std::make_shared<std::vector<PaletteColor>>(palette.Colors);
+                            }
+                            quantizer->MapToPalette(d3dContext, outputTexture);
+                        }
+                        {
+                            StageTimer timer(profiler, PipelineStage::CopyResource);
+                            if (gpuTimer)
+                            {
+                                gpuTimer->BeginCopy(d3dContext);
+                            }
+                            readback.Enqueue(d3dContext, quantizer ? quantizer->IndexTexture() : outputTexture);
+                            if (gpuTimer)
+                            {
+                                gpuTimer->EndCopy(d3dContext);
+                            }
+                        }
+                    }
+                    if (profiler != nullptr)
+                    {
+                        profiler->SampleVideoMemory(d3dDevice);
+                    }
+
+                    // Waits while the ring is full. Fails if the write stage
+                    // stopped, which written will tell us about.
+                    if (!pendingFrames.Push(std::move(pending)))
+                    {
+                        break;
+                    }
+                }
+            }
+            catch (...)
+            {
+                pendingFrames.Close();
+                written.wait();
+                throw;
+            }
+            // The write stage finishes whatever is left once we're out of frames
+            pendingFrames.Close();
+            written.get();
+            co_await writer.FlushAsync();
+            framesMerged = writer.FramesMerged();
+            if (frameCount > 1)
+            {
+                steadyStateAllocations = GetAllocationCount() - steadyStateStart;
+            }
+
+            co_await encoder->FinishAsync();
+        }
+
+        AddJobStats(stats, frameCount, framesMerged, composer.Stats(), steadyStateAllocations);
+        co_return;
+    }
+}
+
+PipelineResources CreatePipelineResources(PipelineOptions const& options, PipelineStats* stats)
+{
+    PipelineResources resources;
+    resources.Device = CreatePipelineDevice(options.UseDebugLayer, options.Adapter);
+    resources.Decoder = CreateDecoder(options, stats);
+    return resources;
+}
+
+winrt::IAsyncAction CreateGifAsync(PipelineOptions options, PipelineStats* stats)
+{
+    if (options.UseAllAdapters)
+    {
+        co_await CreateShardedGifAsync(options, stats);
+        co_return;
+    }
+    if (options.UseIncremental)
+    {
+        co_await CreateIncrementalGifAsync(options, stats);
+        co_return;
+    }
+    auto resources = CreatePipelineResources(options, stats);
+    co_await CreateGifAsync(resources, options, stats);
+}
+
+winrt::IAsyncAction CreateGifAsync(PipelineResources resources, PipelineOptions options, PipelineStats* stats)
+{
+    auto profiler = stats != nullptr ? &stats->Profiler : nullptr;
+
+    // Find all frames. Frames are loaded on demand as we encode them, with at
+    // most WindowSize frames resident at once. Videos are read as we go.
+    std::vector<std::filesystem::path> framePaths;
+    std::vector<uint16_t> frameDelays;
+    if (!IsVideoFile(options.FramesPath))
+    {
+        framePaths = GetImageFilePaths(options.FramesPath);
+        if (framePaths.empty())
+        {
+            wprintf(L"No frames found, exiting...\n");
+            co_return;
+        }
+        frameDelays = LoadFrameDelays(options, framePaths);
+        LimitFrameRate(framePaths, frameDelays, options.MaxFrameRate);
+    }
+
+    auto createEncoder = [options, profiler](D2D1_SIZE_U frameSize, uint32_t workerCount, std::shared_ptr<std::vector<PaletteColor> const> const& globalPalette)
+        -> std::future<std::unique_ptr<GifEncoder>>
+    {
+        auto stream = CreateOutputStream(options.OutputPath);
+        if (options.Encoder == EncoderType::Native)
+        {
+            co_return std::make_unique<NativeGifEncoder>(stream, frameSize.width, frameSize.height, workerCount, globalPalette, profiler, false, options.Dither);
+        }
+        co_return co_await WicGifEncoder::CreateAsync(GetRandomAccessStream(stream), frameSize.width, frameSize.height, profiler);
+    };
+    co_await EncodeFramesAsync(resources, options, framePaths, frameDelays, createEncoder, stats);
+}
+
+winrt::IAsyncAction CreateShardedGifAsync(PipelineOptions options, PipelineStats* stats)
+{
+    if (options.Encoder != EncoderType::Native || options.Palette == PaletteMode::Global)
+    {
+        throw winrt::hresult_invalid_argument(L"Sharding requires the native encoder and per frame palettes!");
+    }
+    if (IsVideoFile(options.FramesPath))
+    {
+        throw winrt::hresult_invalid_argument(L"Videos can't be sharded!");
+    }
+    auto profiler = stats != nullptr ? &stats->Profiler : nullptr;
+
+    auto framePaths = GetImageFilePaths(options.FramesPath);
+    if (framePaths.empty())
+    {
+        wprintf(L"No frames found, exiting...\n");
+        co_return;
+    }
+    // Check every frame up front, rather than one shard failing after the
+    // others have done all their work
+    CheckImageSizes(framePaths, ReadPngSize(framePaths.front()), L"Frame");
+    // Frames are dropped before splitting, so the shards line up with the
+    // frame rate
+    auto frameDelays = LoadFrameDelays(options, framePaths);
+    LimitFrameRate(framePaths, frameDelays, options.MaxFrameRate);
+    auto adapters = GetHardwareAdapters();
+    if (adapters.empty())
+    {
+        throw winrt::hresult_error(DXGI_ERROR_NOT_FOUND, L"No hardware adapters found!");
+    }
+
+    // Each adapter gets a contiguous range of frames, which is encoded into
+    // memory without a header. Decoding doesn't depend on the device, so
+    // the decoder is shared.
+    struct Shard
+    {
+        PipelineResources Resources;
+        std::vector<std::filesystem::path> FramePaths;
+        std::vector<uint16_t> FrameDelays;
+        winrt::com_ptr<IStream> Stream;
+        D2D1_SIZE_U FrameSize = {};
+    };
+    auto decoder = CreateDecoder(options, stats);
+    auto shardCount = std::min(adapters.size(), framePaths.size());
+    std::vector<Shard> shards(shardCount);
+    for (size_t i = 0; i < shardCount; i++)
+    {
+        auto&& shard = shards[i];
+        shard.Resources.Device = CreatePipelineDevice(options.UseDebugLayer, adapters[i]);
+        shard.Resources.Decoder = decoder;
+        auto begin = (i * framePaths.size()) / shardCount;
+        auto end = ((i + 1) * framePaths.size()) / shardCount;
+        shard.FramePaths = std::vector<std::filesystem::path>(framePaths.begin() + begin, framePaths.begin() + end);
+        shard.FrameDelays = std::vector<uint16_t>(frameDelays.begin() + begin, frameDelays.begin() + end);
+        winrt::check_hresult(CreateStreamOnHGlobal(nullptr, TRUE, shard.Stream.put()));
+    }
+    {
+        ThreadPool pool(static_cast<uint32_t>(shardCount));
+        std::vector<std::future<void>> results;
+        for (auto&& shard : shards)
+        {
+            results.push_back(pool.Submit([&shard, &options, stats, profiler]()
+                {
+                    auto createEncoder = [&shard, &options, profiler](D2D1_SIZE_U frameSize, uint32_t workerCount, std::shared_ptr<std::vector<PaletteColor> const> const&)
+                        -> std::future<std::unique_ptr<GifEncoder>>
+                    {
+                        shard.FrameSize = frameSize;
+                        co_return std::make_unique<NativeGifEncoder>(shard.Stream, frameSize.width, frameSize.height, workerCount, nullptr, profiler, true, options.Dither);
+                    };
+                    EncodeFramesAsync(shard.Resources, options, shard.FramePaths, shard.FrameDelays, createEncoder, stats).get();
+                }));
+        }
+        for (auto&& result : results)
+        {
+            result.get();
+        }
+    }
+
+    // Stitch the shards together
+    auto frameSize = shards.front().FrameSize;
+    for (auto&& shard : shards)
+    {
+        if (shard.FrameSize.width != frameSize.width || shard.FrameSize.height != frameSize.height)
+        {
+            throw winrt::hresult_invalid_argument(L"All frames must be of the same size!");
+        }
+    }
+    NativeGifEncoder encoder(CreateOutputStream(options.OutputPath), frameSize.width, frameSize.height, 1, nullptr, profiler);
+    for (auto&& shard : shards)
+    {
+        encoder.AppendEncodedFrames(shard.Stream);
+    }
+    co_await encoder.FinishAsync();
+}
+
+winrt::IAsyncAction CreateIncrementalGifAsync(PipelineOptions options, PipelineStats* stats)
+{
+    if (options.Encoder != EncoderType::Native || options.Palette == PaletteMode::Global)
+    {
+        throw winrt::hresult_invalid_argument(L"Incremental mode requires the native encoder and per frame palettes!");
+    }
+    if (IsVideoFile(options.FramesPath))
+    {
+        throw winrt::hresult_invalid_argument(L"Videos can't be encoded incrementally!");
+    }
+    auto profiler = stats != nullptr ? &stats->Profiler : nullptr;
+    if (options.UseDeltaEncoding)
+    {
+        options.KeyFrameInterval = IncrementalKeyFrameInterval;
+    }
+
+    auto framePaths = GetImageFilePaths(options.FramesPath);
+    if (framePaths.empty())
+    {
+        wprintf(L"No frames found, exiting...\n");
+        co_return;
+    }
+    auto frameSize = ReadPngSize(framePaths.front());
+    CheckImageSizes(framePaths, frameSize, L"Frame");
+    auto frameDelays = LoadFrameDelays(options, framePaths);
+    LimitFrameRate(framePaths, frameDelays, options.MaxFrameRate);
+
+    // Hash every input. This reads every file, but that's far cheaper than
+    // decoding and composing them.
+    std::vector<uint64_t> frameHashes(framePaths.size());
+    std::vector<uint64_t> settings;
+    {
+        ThreadPool pool(options.DecodeThreads);
+        std::vector<std::future<uint64_t>> frameHashResults;
+        for (auto&& path : framePaths)
+        {
+            frameHashResults.push_back(pool.Submit([path]() { return HashFile(path); }));
+        }
+        auto backgroundPaths = GetImageFilePaths(options.BackgroundPath);
+        settings =
+        {
+            static_cast<uint64_t>(options.Quantizer),
+            static_cast<uint64_t>(options.Dither),
+            static_cast<uint64_t>(options.UseDeltaEncoding),
+            static_cast<uint64_t>(options.MergeDuplicateFrames),
+            static_cast<uint64_t>(options.KeyFrameInterval),
+            static_cast<uint64_t>(options.TileSize),
+            static_cast<uint64_t>(options.Scale.Factor * 1000000.0),
+            static_cast<uint64_t>(options.Scale.Width),
+            static_cast<uint64_t>(options.Scale.Height),
+            static_cast<uint64_t>(backgroundPaths.size()),
+        };
+        for (auto&& path : backgroundPaths)
+        {
+            settings.push_back(HashFile(path));
+        }
+        for (size_t i = 0; i < frameHashes.size(); i++)
+        {
+            frameHashes[i] = frameHashResults[i].get();
+        }
+    }
+    auto settingsHash = MurmurHash64A(settings.data(), settings.size() * sizeof(uint64_t));
+
+    // The old output is only trusted if it's the one the manifest describes
+    std::filesystem::path outputPath(options.OutputPath);
+    auto manifestPath = outputPath;
+    manifestPath += L".manifest.json";
+    std::optional<MappedFile> oldOutput;
+    auto oldManifest = TryLoadIncrementalManifest(manifestPath);
+    std::error_code error;
+    if (oldManifest.has_value() && oldManifest->SettingsHash == settingsHash && std::filesystem::exists(outputPath, error))
+    {
+        oldOutput.emplace(outputPath);
+        auto&& blocks = oldManifest->Blocks;
+        auto framesSize = blocks.empty() ? 0 : blocks.back().Offset + blocks.back().Size;
+        if (MurmurHash64A(oldOutput->Data(), oldOutput->Size()) != oldManifest->OutputHash ||
+            oldOutput->Size() < framesSize + 1)
+        {
+            oldOutput.reset();
+        }
+    }
+
+    // A block can be copied if its key still matches, as long as the frame
+    // before it was copied too or it doesn't depend on that frame at all.
+    // Otherwise the canvas it was encoded against might not be the same.
+    std::vector<ManifestBlock const*> reusedBlocks(framePaths.size(), nullptr);
+    uint64_t headerSize = 0;
+    if (oldOutput.has_value())
+    {
+        auto&& blocks = oldManifest->Blocks;
+        // The frames come right before the trailer
+        headerSize = oldOutput->Size() - 1 - (blocks.empty() ? 0 : blocks.back().Offset + blocks.back().Size);
+        auto previousReused = false;
+        for (auto&& block : blocks)
+        {
+            auto isReused = block.FirstFrame + block.FrameCount <= framePaths.size() &&
+                (block.IsKeyFrame || previousReused) &&
+                ComputeBlockKey(settingsHash, frameHashes, frameDelays, block.FirstFrame, block.FrameCount) == block.Key;
+            if (isReused)
+            {
+                reusedBlocks[block.FirstFrame] = &block;
+            }
+            previousReused = isReused;
+        }
+    }
+
+    // Split the frames into runs that are copied and runs that are encoded
+    // again. Each encoded run starts with a full frame, so it doesn't
+    // depend on the run before it either.
+    struct Segment
+    {
+        ManifestBlock const* ReusedBlock = nullptr;
+        size_t FirstFrame = 0;
+        size_t FrameCount = 0;
+        winrt::com_ptr<IStream> Stream;
+        std::shared_ptr<std::vector<EncodedBlock>> Blocks;
+    };
+    std::vector<Segment> segments;
+    size_t reusedFrameCount = 0;
+    for (size_t i = 0; i < framePaths.size();)
+    {
+        Segment segment;
+        segment.FirstFrame = i;
+        if (auto block = reusedBlocks[i])
+        {
+            segment.ReusedBlock = block;
+            segment.FrameCount = block->FrameCount;
+            reusedFrameCount += block->FrameCount;
+        }
+        else
+        {
+            while (i + segment.FrameCount < framePaths.size() && reusedBlocks[i + segment.FrameCount] == nullptr)
+            {
+                segment.FrameCount++;
+            }
+        }
+        i += segment.FrameCount;
+        segments.push_back(std::move(segment));
+    }
+    wprintf(L"Reusing %zu of %zu frames from the last run...\n", reusedFrameCount, framePaths.size());
+
+    // Encode the runs that changed into memory
+    auto resources = CreatePipelineResources(options, stats);
+    for (auto&& segment : segments)
+    {
+        if (segment.ReusedBlock != nullptr)
+        {
+            continue;
+        }
+        winrt::check_hresult(CreateStreamOnHGlobal(nullptr, TRUE, segment.Stream.put()));
+        segment.Blocks = std::make_shared<std::vector<EncodedBlock>>();
+        auto createEncoder = [&segment, &options, profiler](D2D1_SIZE_U frameSize, uint32_t workerCount, std::shared_ptr<std::vector<PaletteColor> const> const&)
+            -> std::future<std::unique_ptr<GifEncoder>>
+        {
+            auto encoder = std::make_unique<NativeGifEncoder>(segment.Stream, frameSize.width, frameSize.height, workerCount, nullptr, profiler, true, options.Dither);
+            encoder->LogBlocks(segment.Blocks);
+            co_return encoder;
+        };
+        auto begin = framePaths.begin() + segment.FirstFrame;
+        std::vector<std::filesystem::path> segmentPaths(begin, begin + segment.FrameCount);
+        auto delaysBegin = frameDelays.begin() + segment.FirstFrame;
+        std::vector<uint16_t> segmentDelays(delaysBegin, delaysBegin + segment.FrameCount);
+        co_await EncodeFramesAsync(resources, options, segmentPaths, segmentDelays, createEncoder, stats);
+    }
+
+    // Join everything into a new file, the old one is still being read from
+    auto tempPath = outputPath;
+    tempPath += L".tmp";
+    IncrementalManifest manifest;
+    manifest.SettingsHash = settingsHash;
+    {
+        auto outputSize = GetScaledSize(options.Scale, frameSize);
+        NativeGifEncoder encoder(CreateOutputStream(tempPath), outputSize.width, outputSize.height, 1, nullptr, profiler);
+        auto framesStart = encoder.BytesWritten();
+        for (auto&& segment : segments)
+        {
+            if (auto block = segment.ReusedBlock)
+            {
+                auto newBlock = *block;
+                newBlock.Offset = encoder.BytesWritten() - framesStart;
+                encoder.AppendEncodedFrames(oldOutput->Data() + headerSize + block->Offset, static_cast<size_t>(block->Size));
+                manifest.Blocks.push_back(newBlock);
+                continue;
+            }
+
+            auto offset = encoder.BytesWritten() - framesStart;
+            auto firstFrame = segment.FirstFrame;
+            for (auto&& encodedBlock : *segment.Blocks)
+            {
+                ManifestBlock block;
+                block.FirstFrame = firstFrame;
+                block.FrameCount = encodedBlock.SourceFrameCount;
+                block.IsKeyFrame = encodedBlock.IsKeyFrame;
+                block.Offset = offset;
+                block.Size = encodedBlock.Size;
+                block.Key = ComputeBlockKey(settingsHash, frameHashes, frameDelays, block.FirstFrame, block.FrameCount);
+                manifest.Blocks.push_back(block);
+                firstFrame += block.FrameCount;
+                offset += block.Size;
+            }
+            if (firstFrame != segment.FirstFrame + segment.FrameCount)
+            {
+                throw winrt::hresult_error(E_UNEXPECTED, L"The encoded frames don't match the frames that were submitted!");
+            }
+            encoder.AppendEncodedFrames(segment.Stream);
+        }
+        co_await encoder.FinishAsync();
+    }
+    oldOutput.reset();
+    winrt::check_bool(MoveFileExW(tempPath.c_str(), outputPath.c_str(), MOVEFILE_REPLACE_EXISTING));
+
+    manifest.OutputHash = HashFile(outputPath);
+    SaveIncrementalManifest(manifestPath, manifest);
+}
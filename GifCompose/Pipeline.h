@@ -0,0 +1,125 @@
+﻿#pragma once
+#include "FrameComposer.h"
+#include "PipelineProfiler.h"
+#include "PipelineDevice.h"
+#include "ImageDecoder.h"
+#include "FrameScaler.h"
+
+class BackgroundTemplateCache;
+
+enum class EncoderType
+{
+    Wic,
+    Native,
+};
+
+enum class QuantizerType
+{
+    Cpu,
+    Gpu,
+};
+
+enum class PaletteMode
+{
+    Frame,
+    Global,
+};
+
+struct PipelineOptions
+{
+    bool UseDebugLayer = false;
+    AdapterSelection Adapter;
+    std::wstring FramesPath;
+    std::wstring BackgroundPath;
+    std::wstring OutputPath;
+    std::wstring CachePath;
+    uint32_t WindowSize = 0;
+    uint32_t DecodeThreads = 1;
+    uint32_t ReadbackDepth = 3;
+    // Compose frames in tiles of this size, see TiledComposer. If 0, tiles
+    // are only used for frames that are too large for a texture.
+    uint32_t TileSize = 0;
+    EncoderType Encoder = EncoderType::Wic;
+    uint32_t EncodeThreads = 1;
+    bool UseDeltaEncoding = false;
+    // In hundredths of a second
+    uint16_t FrameDelay = 13;
+    // Optional, see LoadFrameTimings
+    std::wstring TimingsPath;
+    // Consecutive identical frames are written as one frame with their
+    // delays added together.
+    bool MergeDuplicateFrames = true;
+    // Frames are dropped so no more than this many are shown each second, 0
+    // keeps every frame. See LimitFrameRate.
+    uint32_t MaxFrameRate = 0;
+    // Composed frames are resampled to this size before they're read back
+    OutputScale Scale;
+    QuantizerType Quantizer = QuantizerType::Cpu;
+    PaletteMode Palette = PaletteMode::Frame;
+    // Only used by the CPU quantizer, see QuantizeImage
+    DitherMode Dither = DitherMode::None;
+    // Split the frames between every hardware adapter, see CreateShardedGifAsync.
+    // Adapter is ignored.
+    bool UseAllAdapters = false;
+    // Only recompose the frames that changed since the last run, see
+    // CreateIncrementalGifAsync.
+    bool UseIncremental = false;
+    // In bytes, applied to the CPU and the GPU separately. 0 means no limit.
+    // See FitToMemoryBudget.
+    uint64_t MemoryBudget = 0;
+    // Write every Nth frame in full when delta encoding, see GifFrameWriter.
+    // Set by incremental mode.
+    size_t KeyFrameInterval = 0;
+};
+
+struct PipelineStats
+{
+    // Guards FrameCount, FramesMerged, Composition and the allocation counts
+    // when jobs run concurrently
+    std::mutex Lock;
+    size_t FrameCount = 0;
+    size_t FramesMerged = 0;
+    CompositionStats Composition;
+    // Allocations made while processing every frame after the first, which
+    // is where caches and pools get filled. The count is process wide, so
+    // it includes the decode workers and any other jobs.
+    uint64_t SteadyStateAllocations = 0;
+    size_t SteadyStateFrames = 0;
+    PipelineProfiler Profiler;
+};
+
+// Everything that can be shared between jobs running in the same process.
+struct PipelineResources
+{
+    PipelineDevice Device;
+    std::shared_ptr<ParallelDecoder> Decoder;
+    // Optional
+    std::shared_ptr<BackgroundTemplateCache> Backgrounds;
+};
+
+// Uses UseDebugLayer, Adapter, DecodeThreads and CachePath from the options.
+PipelineResources CreatePipelineResources(PipelineOptions const& options, PipelineStats* stats = nullptr);
+
+// Composes every frame onto the backgrounds and encodes the result as a GIF.
+// If stats is provided, each stage of the pipeline is timed into it.
+winrt::Windows::Foundation::IAsyncAction CreateGifAsync(PipelineOptions options, PipelineStats* stats = nullptr);
+// Same as above, but on resources that may be shared with other jobs. Jobs
+// can run concurrently on the same resources. UseAllAdapters is ignored.
+winrt::Windows::Foundation::IAsyncAction CreateGifAsync(
+    PipelineResources resources,
+    PipelineOptions options,
+    PipelineStats* stats = nullptr);
+// Gives each hardware adapter a contiguous range of frames, which it composes
+// and encodes on its own device. The encoded frames are then joined into one
+// GIF. Requires the native encoder and per frame palettes, and each range
+// starts with a full frame when delta encoding.
+winrt::Windows::Foundation::IAsyncAction CreateShardedGifAsync(PipelineOptions options, PipelineStats* stats = nullptr);
+// Keeps a manifest next to the output with a hash of every frame's inputs
+// and where its encoded bytes are. On the next run, frames whose inputs
+// haven't changed are copied from the old output and only the rest are
+// composed and encoded again. Requires the native encoder and per frame
+// palettes. When delta encoding, a key frame is written every
+// IncrementalKeyFrameInterval frames so a change only affects the frames up
+// to the next one.
+winrt::Windows::Foundation::IAsyncAction CreateIncrementalGifAsync(PipelineOptions options, PipelineStats* stats = nullptr);
+inline constexpr size_t IncrementalKeyFrameInterval = 30;
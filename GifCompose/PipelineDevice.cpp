@@ -0,0 +1,259 @@
+﻿#include "pch.h"
+#include "PipelineDevice.h"
+#include "BitmapLoader.h"
+
+namespace
+{
+    winrt::com_ptr<IDXGIFactory6> CreateDXGIFactory()
+    {
+        return winrt::capture<IDXGIFactory6>(CreateDXGIFactory2, 0);
+    }
+
+    std::wstring GetAdapterName(winrt::com_ptr<IDXGIAdapter1> const& adapter)
+    {
+        DXGI_ADAPTER_DESC1 desc = {};
+        winrt::check_hresult(adapter->GetDesc1(&desc));
+        return desc.Description;
+    }
+
+    // Returns the average milliseconds it takes to compose and read back a
+    // 720p frame on the device.
+    double MeasureComposeReadback(PipelineDevice const& device)
+    {
+        constexpr uint32_t width = 1280;
+        constexpr uint32_t height = 720;
+        constexpr uint32_t frameCount = 8;
+        auto d2dContext = device.CreateDeviceContext();
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        desc.SampleDesc.Count = 1;
+        winrt::com_ptr<ID3D11Texture2D> renderTargetTexture;
+        winrt::check_hresult(device.D3DDevice->CreateTexture2D(&desc, nullptr, renderTargetTexture.put()));
+        auto renderTarget = CreateBitmapFromTexture(renderTargetTexture, d2dContext);
+
+        auto stagingDesc = desc;
+        stagingDesc.Usage = D3D11_USAGE_STAGING;
+        stagingDesc.BindFlags = 0;
+        stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        winrt::com_ptr<ID3D11Texture2D> stagingTexture;
+        winrt::check_hresult(device.D3DDevice->CreateTexture2D(&stagingDesc, nullptr, stagingTexture.put()));
+
+        // A half transparent source, so drawing it actually has to blend
+        std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4, 0x80);
+        auto bitmapProperties = D2D1::BitmapProperties1(
+            D2D1_BITMAP_OPTIONS_NONE,
+            D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+        winrt::com_ptr<ID2D1Bitmap1> source;
+        winrt::check_hresult(d2dContext->CreateBitmap(D2D1::SizeU(width, height), pixels.data(), width * 4, bitmapProperties, source.put()));
+
+        auto lock = device.Lock();
+        d2dContext->SetTarget(renderTarget.get());
+        auto composeAndReadBack = [&]()
+        {
+            d2dContext->BeginDraw();
+            d2dContext->Clear(D2D1::ColorF(D2D1::ColorF::White));
+            d2dContext->DrawBitmap(source.get());
+            winrt::check_hresult(d2dContext->EndDraw());
+            device.D3DContext->CopyResource(stagingTexture.get(), renderTargetTexture.get());
+            D3D11_MAPPED_SUBRESOURCE mapped = {};
+            winrt::check_hresult(device.D3DContext->Map(stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+            device.D3DContext->Unmap(stagingTexture.get(), 0);
+        };
+        // The first frame pays for shader compilation and the like
+        composeAndReadBack();
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            composeAndReadBack();
+        }
+        auto end = std::chrono::steady_clock::now();
+        d2dContext->SetTarget(nullptr);
+        return std::chrono::duration<double, std::milli>(end - start).count() / frameCount;
+    }
+
+    PipelineDevice CreateFastestPipelineDevice(bool useDebugLayer)
+    {
+        auto adapters = GetHardwareAdapters();
+        winrt::com_ptr<IDXGIAdapter1> warpAdapter;
+        winrt::check_hresult(CreateDXGIFactory()->EnumWarpAdapter(winrt::guid_of<IDXGIAdapter1>(), warpAdapter.put_void()));
+        adapters.push_back(warpAdapter);
+
+        std::optional<PipelineDevice> fastestDevice;
+        auto fastestTime = 0.0;
+        for (auto&& adapter : adapters)
+        {
+            auto device = CreatePipelineDevice(useDebugLayer, adapter);
+            auto time = MeasureComposeReadback(device);
+            wprintf(L"  %s: %.2f ms per frame\n", GetAdapterName(adapter).c_str(), time);
+            if (!fastestDevice.has_value() || time < fastestTime)
+            {
+                fastestDevice = device;
+                fastestTime = time;
+            }
+        }
+        return fastestDevice.value();
+    }
+}
+
+bool TryParseAdapterSelection(std::wstring const& value, AdapterSelection& selection)
+{
+    if (value == L"high-perf")
+    {
+        selection = { AdapterPreference::HighPerformance };
+        return true;
+    }
+    else if (value == L"low-power")
+    {
+        selection = { AdapterPreference::LowPower };
+        return true;
+    }
+    else if (value == L"warp")
+    {
+        selection = { AdapterPreference::Warp };
+        return true;
+    }
+    else if (value == L"auto")
+    {
+        selection = { AdapterPreference::Auto };
+        return true;
+    }
+    else if (!value.empty() && std::all_of(value.begin(), value.end(), iswdigit))
+    {
+        try
+        {
+            auto index = std::stoul(value);
+            if (index <= UINT32_MAX)
+            {
+                selection = { AdapterPreference::Index, static_cast<uint32_t>(index) };
+                return true;
+            }
+        }
+        catch (std::out_of_range const&)
+        {
+        }
+    }
+    return false;
+}
+
+winrt::com_ptr<ID2D1DeviceContext> PipelineDevice::CreateDeviceContext() const
+{
+    winrt::com_ptr<ID2D1DeviceContext> d2dContext;
+    winrt::check_hresult(D2DDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, d2dContext.put()));
+    return d2dContext;
+}
+
+PipelineDevice CreatePipelineDevice(bool useDebugLayer, winrt::com_ptr<IDXGIAdapter1> const& adapter)
+{
+    PipelineDevice device;
+
+    // Initialize D3D. Video support lets Media Foundation decode on the same
+    // device, but not every driver has it.
+    uint32_t flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+    if (useDebugLayer)
+    {
+        flags |= D3D11_CREATE_DEVICE_DEBUG;
+    }
+    auto createDevice = [&](IDXGIAdapter* adapter, D3D_DRIVER_TYPE driverType)
+    {
+        auto hr = D3D11CreateDevice(adapter, driverType, nullptr, flags | D3D11_CREATE_DEVICE_VIDEO_SUPPORT, nullptr, 0, D3D11_SDK_VERSION, device.D3DDevice.put(), nullptr, nullptr);
+        if (FAILED(hr))
+        {
+            hr = D3D11CreateDevice(adapter, driverType, nullptr, flags, nullptr, 0, D3D11_SDK_VERSION, device.D3DDevice.put(), nullptr, nullptr);
+        }
+        return hr;
+    };
+    if (adapter)
+    {
+        winrt::check_hresult(createDevice(adapter.get(), D3D_DRIVER_TYPE_UNKNOWN));
+    }
+    else
+    {
+        // Headless machines may not have a hardware device at all
+        auto hr = createDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE);
+        if (hr == DXGI_ERROR_UNSUPPORTED)
+        {
+            hr = createDevice(nullptr, D3D_DRIVER_TYPE_WARP);
+        }
+        winrt::check_hresult(hr);
+    }
+    device.D3DDevice->GetImmediateContext(device.D3DContext.put());
+
+    // Initialize D2D. Jobs in a batch draw from different threads.
+    D2D1_FACTORY_OPTIONS options = {};
+    options.debugLevel = D2D1_DEBUG_LEVEL_NONE;
+    if (useDebugLayer)
+    {
+        options.debugLevel = D2D1_DEBUG_LEVEL_INFORMATION;
+    }
+    winrt::check_hresult(D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, options, device.D2DFactory.put()));
+    auto dxgiDevice = device.D3DDevice.as<IDXGIDevice>();
+    winrt::check_hresult(device.D2DFactory->CreateDevice(dxgiDevice.get(), device.D2DDevice.put()));
+    device.Multithread = device.D2DFactory.as<ID2D1Multithread>();
+
+    return device;
+}
+
+PipelineDevice CreatePipelineDevice(bool useDebugLayer, AdapterSelection const& selection)
+{
+    winrt::com_ptr<IDXGIAdapter1> adapter;
+    auto factory = CreateDXGIFactory();
+    switch (selection.Preference)
+    {
+    case AdapterPreference::Default:
+        break;
+    case AdapterPreference::Index:
+    {
+        auto hr = factory->EnumAdapters1(selection.Index, adapter.put());
+        if (hr == DXGI_ERROR_NOT_FOUND)
+        {
+            throw winrt::hresult_invalid_argument(L"There is no adapter with that index!");
+        }
+        winrt::check_hresult(hr);
+        break;
+    }
+    case AdapterPreference::HighPerformance:
+        winrt::check_hresult(factory->EnumAdapterByGpuPreference(0, DXGI_GPU_PREFERENCE_HIGH_PERFORMANCE, winrt::guid_of<IDXGIAdapter1>(), adapter.put_void()));
+        break;
+    case AdapterPreference::LowPower:
+        winrt::check_hresult(factory->EnumAdapterByGpuPreference(0, DXGI_GPU_PREFERENCE_MINIMUM_POWER, winrt::guid_of<IDXGIAdapter1>(), adapter.put_void()));
+        break;
+    case AdapterPreference::Warp:
+        winrt::check_hresult(factory->EnumWarpAdapter(winrt::guid_of<IDXGIAdapter1>(), adapter.put_void()));
+        break;
+    case AdapterPreference::Auto:
+        wprintf(L"Measuring adapters...\n");
+        return CreateFastestPipelineDevice(useDebugLayer);
+    }
+    return CreatePipelineDevice(useDebugLayer, adapter);
+}
+
+std::vector<winrt::com_ptr<IDXGIAdapter1>> GetHardwareAdapters()
+{
+    auto factory = CreateDXGIFactory();
+    std::vector<winrt::com_ptr<IDXGIAdapter1>> adapters;
+    for (uint32_t i = 0;; i++)
+    {
+        winrt::com_ptr<IDXGIAdapter1> adapter;
+        auto hr = factory->EnumAdapterByGpuPreference(i, DXGI_GPU_PREFERENCE_HIGH_PERFORMANCE, winrt::guid_of<IDXGIAdapter1>(), adapter.put_void());
+        if (hr == DXGI_ERROR_NOT_FOUND)
+        {
+            break;
+        }
+        winrt::check_hresult(hr);
+
+        DXGI_ADAPTER_DESC1 desc = {};
+        winrt::check_hresult(adapter->GetDesc1(&desc));
+        if ((desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) == 0)
+        {
+            adapters.push_back(adapter);
+        }
+    }
+    return adapters;
+}
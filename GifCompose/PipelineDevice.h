@@ -0,0 +1,69 @@
+﻿#pragma once
+
+// Holds the D2D multithread lock. D2D takes the same lock internally, so
+// holding it makes our own use of the immediate context safe alongside
+// other threads drawing with D2D. Must be released on the thread that
+// acquired it, so never hold one across a co_await.
+class DeviceLock
+{
+public:
+    DeviceLock(winrt::com_ptr<ID2D1Multithread> const& multithread)
+    {
+        m_multithread = multithread;
+        m_multithread->Enter();
+    }
+    ~DeviceLock()
+    {
+        m_multithread->Leave();
+    }
+
+    DeviceLock(DeviceLock const&) = delete;
+    DeviceLock& operator=(DeviceLock const&) = delete;
+
+private:
+    winrt::com_ptr<ID2D1Multithread> m_multithread;
+};
+
+// The devices shared by every job in a process. The D2D factory is
+// multithreaded, so each job can have its own device context.
+struct PipelineDevice
+{
+    winrt::com_ptr<ID3D11Device> D3DDevice;
+    winrt::com_ptr<ID3D11DeviceContext> D3DContext;
+    winrt::com_ptr<ID2D1Factory1> D2DFactory;
+    winrt::com_ptr<ID2D1Device> D2DDevice;
+    winrt::com_ptr<ID2D1Multithread> Multithread;
+
+    // Anything that touches D3DContext directly, or draws with D2D, must
+    // hold this.
+    DeviceLock Lock() const { return DeviceLock(Multithread); }
+    winrt::com_ptr<ID2D1DeviceContext> CreateDeviceContext() const;
+};
+
+enum class AdapterPreference
+{
+    // The default hardware adapter, or WARP if there isn't one
+    Default,
+    Index,
+    HighPerformance,
+    LowPower,
+    Warp,
+    // Times a short compose and readback burst on every adapter (including
+    // WARP) and picks the fastest
+    Auto,
+};
+
+struct AdapterSelection
+{
+    AdapterPreference Preference = AdapterPreference::Default;
+    // Only used with AdapterPreference::Index, in EnumAdapters1 order
+    uint32_t Index = 0;
+};
+
+bool TryParseAdapterSelection(std::wstring const& value, AdapterSelection& selection);
+
+// If no adapter is provided, the default one is used.
+PipelineDevice CreatePipelineDevice(bool useDebugLayer, winrt::com_ptr<IDXGIAdapter1> const& adapter = nullptr);
+PipelineDevice CreatePipelineDevice(bool useDebugLayer, AdapterSelection const& selection);
+// Every adapter that isn't a software rasterizer, fastest first.
+std::vector<winrt::com_ptr<IDXGIAdapter1>> GetHardwareAdapters();
@@ -0,0 +1,178 @@
+﻿#include "pch.h"
+#include "PipelineProfiler.h"
+
+namespace
+{
+    // Nearest rank, samples must be sorted
+    double GetPercentile(std::vector<double> const& samples, double percentile)
+    {
+        auto rank = static_cast<size_t>(std::ceil((percentile / 100.0) * samples.size()));
+        return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+    }
+}
+
+std::wstring_view GetPipelineStageName(PipelineStage stage)
+{
+    switch (stage)
+    {
+    case PipelineStage::FileOpen:
+        return L"FileOpen";
+    case PipelineStage::Decode:
+        return L"Decode";
+    case PipelineStage::Upload:
+        return L"Upload";
+    case PipelineStage::Compose:
+        return L"Compose";
+    case PipelineStage::Quantize:
+        return L"Quantize";
+    case PipelineStage::CopyResource:
+        return L"CopyResource";
+    case PipelineStage::Readback:
+        return L"Readback";
+    case PipelineStage::EncodeFrame:
+        return L"EncodeFrame";
+    case PipelineStage::SetPixelData:
+        return L"SetPixelData";
+    case PipelineStage::GoToNextFrame:
+        return L"GoToNextFrame";
+    case PipelineStage::Write:
+        return L"Write";
+    case PipelineStage::Flush:
+        return L"Flush";
+    case PipelineStage::Throttle:
+        return L"Throttle";
+    case PipelineStage::GpuCompose:
+        return L"GPU Compose";
+    case PipelineStage::GpuCopyResource:
+        return L"GPU Copy";
+    default:
+        return L"Unknown";
+    }
+}
+
+void PipelineProfiler::Record(PipelineStage stage, std::chrono::steady_clock::duration duration)
+{
+    auto milliseconds = std::chrono::duration<double, std::milli>(duration).count();
+    std::scoped_lock lock(m_lock);
+    m_samples[static_cast<size_t>(stage)].push_back(milliseconds);
+}
+
+void PipelineProfiler::SampleVideoMemory(winrt::com_ptr<ID3D11Device> const& d3dDevice)
+{
+    auto dxgiDevice = d3dDevice.as<IDXGIDevice>();
+    winrt::com_ptr<IDXGIAdapter> adapter;
+    winrt::check_hresult(dxgiDevice->GetAdapter(adapter.put()));
+    auto adapter3 = adapter.try_as<IDXGIAdapter3>();
+    if (!adapter3)
+    {
+        return;
+    }
+    DXGI_QUERY_VIDEO_MEMORY_INFO info = {};
+    winrt::check_hresult(adapter3->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info));
+    auto peak = m_peakVideoMemory.load();
+    while (info.CurrentUsage > peak && !m_peakVideoMemory.compare_exchange_weak(peak, info.CurrentUsage))
+    {
+    }
+}
+
+StageSummary SummarizeSamples(std::vector<double> samples)
+{
+    StageSummary summary;
+    if (samples.empty())
+    {
+        return summary;
+    }
+    std::sort(samples.begin(), samples.end());
+    summary.Count = samples.size();
+    for (auto&& sample : samples)
+    {
+        summary.TotalMilliseconds += sample;
+        auto bucket = std::upper_bound(StageHistogramBounds.begin(), StageHistogramBounds.end(), sample) - StageHistogramBounds.begin();
+        summary.Histogram[bucket]++;
+    }
+    summary.MedianMilliseconds = GetPercentile(samples, 50.0);
+    summary.P95Milliseconds = GetPercentile(samples, 95.0);
+    summary.MaxMilliseconds = samples.back();
+    return summary;
+}
+
+StageSummary PipelineProfiler::Summarize(PipelineStage stage) const
+{
+    std::vector<double> samples;
+    {
+        std::scoped_lock lock(m_lock);
+        samples = m_samples[static_cast<size_t>(stage)];
+    }
+    return SummarizeSamples(std::move(samples));
+}
+
+void PipelineProfiler::Clear()
+{
+    std::scoped_lock lock(m_lock);
+    for (auto&& samples : m_samples)
+    {
+        samples.clear();
+    }
+    m_peakVideoMemory = 0;
+}
+
+void PrintStageSummaries(PipelineProfiler const& profiler)
+{
+    wprintf(L"  %-14s %7s %10s %10s %10s %10s\n", L"Stage", L"Count", L"Total ms", L"Median ms", L"P95 ms", L"Max ms");
+    for (size_t i = 0; i < static_cast<size_t>(PipelineStage::Count); i++)
+    {
+        auto stage = static_cast<PipelineStage>(i);
+        auto summary = profiler.Summarize(stage);
+        if (summary.Count == 0)
+        {
+            continue;
+        }
+        auto name = GetPipelineStageName(stage);
+        wprintf(L"  %-14.*s %7zu %10.2f %10.3f %10.3f %10.3f\n",
+            static_cast<int>(name.size()),
+            name.data(),
+            summary.Count,
+            summary.TotalMilliseconds,
+            summary.MedianMilliseconds,
+            summary.P95Milliseconds,
+            summary.MaxMilliseconds);
+    }
+}
+
+void PrintStageHistograms(PipelineProfiler const& profiler)
+{
+    wprintf(L"  %-14s", L"Stage (ms)");
+    for (auto&& bound : StageHistogramBounds)
+    {
+        wchar_t label[16] = {};
+        swprintf_s(label, L"<%g", bound);
+        wprintf(L" %7s", label);
+    }
+    wchar_t lastLabel[16] = {};
+    swprintf_s(lastLabel, L">=%g", StageHistogramBounds.back());
+    wprintf(L" %7s\n", lastLabel);
+
+    for (size_t i = 0; i < static_cast<size_t>(PipelineStage::Count); i++)
+    {
+        auto stage = static_cast<PipelineStage>(i);
+        auto summary = profiler.Summarize(stage);
+        if (summary.Count == 0)
+        {
+            continue;
+        }
+        auto name = GetPipelineStageName(stage);
+        wprintf(L"  %-14.*s", static_cast<int>(name.size()), name.data());
+        for (auto&& count : summary.Histogram)
+        {
+            wprintf(L" %7zu", count);
+        }
+        wprintf(L"\n");
+    }
+}
+
+uint64_t GetPeakWorkingSet()
+{
+    PROCESS_MEMORY_COUNTERS counters = {};
+    winrt::check_bool(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)));
+    return counters.PeakWorkingSetSize;
+}
@@ -0,0 +1,114 @@
+﻿#pragma once
+#include "Tracing.h"
+
+enum class PipelineStage
+{
+    FileOpen,
+    Decode,
+    Upload,
+    Compose,
+    Quantize,
+    CopyResource,
+    Readback,
+    EncodeFrame,
+    SetPixelData,
+    GoToNextFrame,
+    Write,
+    Flush,
+    // Waiting on later stages because we're over the memory budget
+    Throttle,
+    // Measured with timestamp queries, so these are time spent on the GPU
+    // rather than on the thread that submitted the work.
+    GpuCompose,
+    GpuCopyResource,
+    Count,
+};
+
+std::wstring_view GetPipelineStageName(PipelineStage stage);
+
+// Upper bounds of the histogram buckets in milliseconds, the last bucket
+// holds everything slower.
+inline constexpr std::array<double, 7> StageHistogramBounds = { 0.1, 0.5, 1.0, 2.0, 5.0, 10.0, 50.0 };
+
+struct StageSummary
+{
+    size_t Count = 0;
+    double TotalMilliseconds = 0.0;
+    double MedianMilliseconds = 0.0;
+    double P95Milliseconds = 0.0;
+    double MaxMilliseconds = 0.0;
+    std::array<size_t, StageHistogramBounds.size() + 1> Histogram = {};
+};
+
+StageSummary SummarizeSamples(std::vector<double> samples);
+
+// Collects how long each stage of the pipeline takes. Stages can be recorded
+// from any thread.
+class PipelineProfiler
+{
+public:
+    void Record(PipelineStage stage, std::chrono::steady_clock::duration duration);
+    // Video memory is sampled rather than timed, we keep the peak.
+    void SampleVideoMemory(winrt::com_ptr<ID3D11Device> const& d3dDevice);
+
+    StageSummary Summarize(PipelineStage stage) const;
+    uint64_t PeakVideoMemory() const { return m_peakVideoMemory; }
+    void Clear();
+
+private:
+    mutable std::mutex m_lock;
+    std::array<std::vector<double>, static_cast<size_t>(PipelineStage::Count)> m_samples;
+    std::atomic<uint64_t> m_peakVideoMemory = 0;
+};
+
+// Records the time between its construction and destruction, and traces it
+// if a session is listening. Does nothing if profiler is null and nobody is
+// tracing.
+class StageTimer
+{
+public:
+    StageTimer(PipelineProfiler* profiler, PipelineStage stage)
+    {
+        m_profiler = profiler;
+        m_stage = stage;
+        m_isTracing = IsStageTracingEnabled();
+        if (m_profiler != nullptr || m_isTracing)
+        {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+    ~StageTimer()
+    {
+        if (m_profiler == nullptr && !m_isTracing)
+        {
+            return;
+        }
+        auto duration = std::chrono::steady_clock::now() - m_start;
+        if (m_profiler != nullptr)
+        {
+            m_profiler->Record(m_stage, duration);
+        }
+        if (m_isTracing)
+        {
+            TraceStage(m_stage, duration);
+        }
+    }
+
+    StageTimer(StageTimer const&) = delete;
+    StageTimer& operator=(StageTimer const&) = delete;
+
+private:
+    PipelineProfiler* m_profiler = nullptr;
+    PipelineStage m_stage = PipelineStage::Decode;
+    bool m_isTracing = false;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Prints the median, p95 and max of every stage that was recorded.
+void PrintStageSummaries(PipelineProfiler const& profiler);
+// Prints how many samples of every recorded stage fall in each bucket of
+// StageHistogramBounds.
+void PrintStageHistograms(PipelineProfiler const& profiler);
+
+// The largest the working set of this process has been.
+uint64_t GetPeakWorkingSet();
@@ -0,0 +1,22 @@
+﻿// Counts the 15-bit colors of the input texture into a histogram with one
+// uint per bucket. The histogram is only cleared by the CPU, so it can
+// accumulate over many frames.
+Texture2D<float4> Input : register(t0);
+RWByteAddressBuffer Histogram : register(u0);
+
+[numthreads(16, 16, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+    uint width;
+    uint height;
+    Input.GetDimensions(width, height);
+    if (id.x >= width || id.y >= height)
+    {
+        return;
+    }
+
+    float4 color = Input.Load(int3(id.xy, 0));
+    uint3 value = (uint3)(saturate(color.rgb) * 255.0f + 0.5f);
+    uint bucket = ((value.r >> 3) << 10) | ((value.g >> 3) << 5) | (value.b >> 3);
+    Histogram.InterlockedAdd(bucket * 4, 1);
+}
@@ -0,0 +1,22 @@
+﻿// Maps each pixel of the input texture to a palette index using a lookup
+// table with one entry per 15-bit color bucket.
+Texture2D<float4> Input : register(t0);
+StructuredBuffer<uint> Lookup : register(t1);
+RWTexture2D<uint> Output : register(u0);
+
+[numthreads(16, 16, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+    uint width;
+    uint height;
+    Input.GetDimensions(width, height);
+    if (id.x >= width || id.y >= height)
+    {
+        return;
+    }
+
+    float4 color = Input.Load(int3(id.xy, 0));
+    uint3 value = (uint3)(saturate(color.rgb) * 255.0f + 0.5f);
+    uint bucket = ((value.r >> 3) << 10) | ((value.g >> 3) << 5) | (value.b >> 3);
+    Output[id.xy] = Lookup[bucket];
+}
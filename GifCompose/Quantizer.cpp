@@ -0,0 +1,688 @@
+﻿#include "pch.h"
+#include "Quantizer.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define GIFCOMPOSE_QUANTIZE_X86
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#define GIFCOMPOSE_QUANTIZE_NEON
+#include <arm64_neon.h>
+#endif
+
+namespace
+{
+    inline bool IsUnchanged(uint8_t const* pixel, uint8_t const* previousPixel)
+    {
+        return previousPixel != nullptr && *reinterpret_cast<uint32_t const*>(pixel) == *reinterpret_cast<uint32_t const*>(previousPixel);
+    }
+
+    inline uint32_t BucketChannel(uint32_t bucket, uint32_t channel)
+    {
+        // 0 = red, 1 = green, 2 = blue
+        return (bucket >> (10 - (channel * 5))) & 0x1F;
+    }
+
+    bool TryIndexExactly(uint8_t const* bgraPixels, uint8_t const* previousPixels, uint32_t width, uint32_t height, uint32_t stride, IndexedImage& image)
+    {
+        // A small open addressed table of the 24-bit colors we've seen so far
+        constexpr uint32_t TableSize = 1024;
+        constexpr uint32_t EmptyKey = 0xFFFFFFFF;
+        std::array<uint32_t, TableSize> keys;
+        std::array<uint8_t, TableSize> values;
+        keys.fill(EmptyKey);
+
+        auto indices = image.Indices.data();
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = bgraPixels + (static_cast<size_t>(y) * stride);
+            auto previousRow = previousPixels != nullptr ? previousPixels + (static_cast<size_t>(y) * stride) : nullptr;
+            for (uint32_t x = 0; x < width; x++)
+            {
+                auto pixel = row + (x * 4);
+                if (IsUnchanged(pixel, previousRow != nullptr ? previousRow + (x * 4) : nullptr))
+                {
+                    *indices++ = static_cast<uint8_t>(image.TransparentIndex);
+                    continue;
+                }
+                uint32_t color = (pixel[2] << 16) | (pixel[1] << 8) | pixel[0];
+                auto slot = (color * 2654435761u) >> 22;
+                while (keys[slot] != EmptyKey && keys[slot] != color)
+                {
+                    slot = (slot + 1) & (TableSize - 1);
+                }
+                if (keys[slot] == EmptyKey)
+                {
+                    if (image.Palette.size() == MaxPaletteSize)
+                    {
+                        return false;
+                    }
+                    keys[slot] = color;
+                    values[slot] = static_cast<uint8_t>(image.Palette.size());
+                    image.Palette.push_back({ pixel[2], pixel[1], pixel[0] });
+                }
+                *indices++ = values[slot];
+            }
+        }
+        return true;
+    }
+
+    // Palette entries the nearest color search must never pick (the
+    // transparent index and the padding) are moved this far outside the
+    // color cube.
+    constexpr int16_t UnusableChannel = 1024;
+
+    // The palette with one array per channel, padded to a multiple of 8
+    // entries so the SIMD kernels don't need a tail.
+    struct PaletteChannels
+    {
+        std::vector<int16_t> R;
+        std::vector<int16_t> G;
+        std::vector<int16_t> B;
+    };
+
+    PaletteChannels SplitPalette(std::vector<PaletteColor> const& palette, int32_t transparentIndex)
+    {
+        auto count = std::max<size_t>((palette.size() + 7) & ~static_cast<size_t>(7), 8);
+        PaletteChannels channels;
+        channels.R.resize(count, UnusableChannel);
+        channels.G.resize(count, UnusableChannel);
+        channels.B.resize(count, UnusableChannel);
+        for (size_t i = 0; i < palette.size(); i++)
+        {
+            if (static_cast<int32_t>(i) != transparentIndex)
+            {
+                channels.R[i] = palette[i].R;
+                channels.G[i] = palette[i].G;
+                channels.B[i] = palette[i].B;
+            }
+        }
+        return channels;
+    }
+
+    inline int16_t BucketCenter(uint32_t bucket, uint32_t channel)
+    {
+        return static_cast<int16_t>((BucketChannel(bucket, channel) << 3) | 4);
+    }
+
+    // Each lane of the SIMD kernels keeps the closest entry it's seen, so
+    // the winner is picked from the 8 lanes at the end. Ties go to the
+    // lowest index, like a plain front to back search.
+    inline uint8_t PickNearest(int32_t const (&distances)[8], int32_t const (&indices)[8])
+    {
+        auto best = 0;
+        for (auto lane = 1; lane < 8; lane++)
+        {
+            if (distances[lane] < distances[best] || (distances[lane] == distances[best] && indices[lane] < indices[best]))
+            {
+                best = lane;
+            }
+        }
+        return static_cast<uint8_t>(indices[best]);
+    }
+
+#if defined(GIFCOMPOSE_QUANTIZE_X86)
+    inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+
+    void FillNearestColorTableSse2(PaletteChannels const& channels, uint8_t* table)
+    {
+        auto const zero = _mm_setzero_si128();
+        auto const eight = _mm_set1_epi32(8);
+        for (uint32_t bucket = 0; bucket < ColorHistogramSize; bucket++)
+        {
+            auto const r = _mm_set1_epi16(BucketCenter(bucket, 0));
+            auto const g = _mm_set1_epi16(BucketCenter(bucket, 1));
+            auto const b = _mm_set1_epi16(BucketCenter(bucket, 2));
+            auto bestLow = _mm_set1_epi32(INT32_MAX);
+            auto bestHigh = bestLow;
+            auto indexLow = zero;
+            auto indexHigh = zero;
+            auto candidateLow = _mm_setr_epi32(0, 1, 2, 3);
+            auto candidateHigh = _mm_setr_epi32(4, 5, 6, 7);
+            for (size_t i = 0; i < channels.R.size(); i += 8)
+            {
+                auto dr = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(channels.R.data() + i)), r);
+                auto dg = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(channels.G.data() + i)), g);
+                auto db = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(channels.B.data() + i)), b);
+                // madd squares each (dr, dg) pair and adds them in one go
+                auto redGreenLow = _mm_unpacklo_epi16(dr, dg);
+                auto redGreenHigh = _mm_unpackhi_epi16(dr, dg);
+                auto blueLow = _mm_unpacklo_epi16(db, zero);
+                auto blueHigh = _mm_unpackhi_epi16(db, zero);
+                auto distanceLow = _mm_add_epi32(_mm_madd_epi16(redGreenLow, redGreenLow), _mm_madd_epi16(blueLow, blueLow));
+                auto distanceHigh = _mm_add_epi32(_mm_madd_epi16(redGreenHigh, redGreenHigh), _mm_madd_epi16(blueHigh, blueHigh));
+
+                auto closerLow = _mm_cmplt_epi32(distanceLow, bestLow);
+                auto closerHigh = _mm_cmplt_epi32(distanceHigh, bestHigh);
+                bestLow = Select(closerLow, distanceLow, bestLow);
+                bestHigh = Select(closerHigh, distanceHigh, bestHigh);
+                indexLow = Select(closerLow, candidateLow, indexLow);
+                indexHigh = Select(closerHigh, candidateHigh, indexHigh);
+                candidateLow = _mm_add_epi32(candidateLow, eight);
+                candidateHigh = _mm_add_epi32(candidateHigh, eight);
+            }
+
+            int32_t distances[8];
+            int32_t indices[8];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(distances), bestLow);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(distances + 4), bestHigh);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(indices), indexLow);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + 4), indexHigh);
+            table[bucket] = PickNearest(distances, indices);
+        }
+    }
+#elif defined(GIFCOMPOSE_QUANTIZE_NEON)
+    void FillNearestColorTableNeon(PaletteChannels const& channels, uint8_t* table)
+    {
+        auto const eight = vdupq_n_s32(8);
+        int32_t const firstCandidates[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+        for (uint32_t bucket = 0; bucket < ColorHistogramSize; bucket++)
+        {
+            auto const r = vdupq_n_s16(BucketCenter(bucket, 0));
+            auto const g = vdupq_n_s16(BucketCenter(bucket, 1));
+            auto const b = vdupq_n_s16(BucketCenter(bucket, 2));
+            auto bestLow = vdupq_n_s32(INT32_MAX);
+            auto bestHigh = bestLow;
+            auto indexLow = vdupq_n_s32(0);
+            auto indexHigh = indexLow;
+            auto candidateLow = vld1q_s32(firstCandidates);
+            auto candidateHigh = vld1q_s32(firstCandidates + 4);
+            for (size_t i = 0; i < channels.R.size(); i += 8)
+            {
+                auto dr = vsubq_s16(vld1q_s16(channels.R.data() + i), r);
+                auto dg = vsubq_s16(vld1q_s16(channels.G.data() + i), g);
+                auto db = vsubq_s16(vld1q_s16(channels.B.data() + i), b);
+                auto distanceLow = vmull_s16(vget_low_s16(dr), vget_low_s16(dr));
+                distanceLow = vmlal_s16(distanceLow, vget_low_s16(dg), vget_low_s16(dg));
+                distanceLow = vmlal_s16(distanceLow, vget_low_s16(db), vget_low_s16(db));
+                auto distanceHigh = vmull_high_s16(dr, dr);
+                distanceHigh = vmlal_high_s16(distanceHigh, dg, dg);
+                distanceHigh = vmlal_high_s16(distanceHigh, db, db);
+
+                auto closerLow = vcltq_s32(distanceLow, bestLow);
+                auto closerHigh = vcltq_s32(distanceHigh, bestHigh);
+                bestLow = vbslq_s32(closerLow, distanceLow, bestLow);
+                bestHigh = vbslq_s32(closerHigh, distanceHigh, bestHigh);
+                indexLow = vbslq_s32(closerLow, candidateLow, indexLow);
+                indexHigh = vbslq_s32(closerHigh, candidateHigh, indexHigh);
+                candidateLow = vaddq_s32(candidateLow, eight);
+                candidateHigh = vaddq_s32(candidateHigh, eight);
+            }
+
+            int32_t distances[8];
+            int32_t indices[8];
+            vst1q_s32(distances, bestLow);
+            vst1q_s32(distances + 4, bestHigh);
+            vst1q_s32(indices, indexLow);
+            vst1q_s32(indices + 4, indexHigh);
+            table[bucket] = PickNearest(distances, indices);
+        }
+    }
+#else
+    void FillNearestColorTableScalar(PaletteChannels const& channels, uint8_t* table)
+    {
+        for (uint32_t bucket = 0; bucket < ColorHistogramSize; bucket++)
+        {
+            int32_t const r = BucketCenter(bucket, 0);
+            int32_t const g = BucketCenter(bucket, 1);
+            int32_t const b = BucketCenter(bucket, 2);
+            size_t best = 0;
+            auto bestDistance = INT32_MAX;
+            for (size_t i = 0; i < channels.R.size(); i++)
+            {
+                auto dr = channels.R[i] - r;
+                auto dg = channels.G[i] - g;
+                auto db = channels.B[i] - b;
+                auto distance = (dr * dr) + (dg * dg) + (db * db);
+                if (distance < bestDistance)
+                {
+                    best = i;
+                    bestDistance = distance;
+                }
+            }
+            table[bucket] = static_cast<uint8_t>(best);
+        }
+    }
+#endif
+
+    // Maps every 15-bit color to its closest palette entry. Dithering moves
+    // colors into buckets the histogram never saw, so the median cut lookup
+    // can't be used for those. Filling all of them up front keeps the
+    // search out of the per pixel loops.
+    std::vector<uint8_t> BuildNearestColorTable(std::vector<PaletteColor> const& palette, int32_t transparentIndex)
+    {
+        auto channels = SplitPalette(palette, transparentIndex);
+        std::vector<uint8_t> table(ColorHistogramSize, 0);
+#if defined(GIFCOMPOSE_QUANTIZE_X86)
+        // SSE2 is the baseline on both x86 targets
+        FillNearestColorTableSse2(channels, table.data());
+#elif defined(GIFCOMPOSE_QUANTIZE_NEON)
+        FillNearestColorTableNeon(channels, table.data());
+#else
+        FillNearestColorTableScalar(channels, table.data());
+#endif
+        return table;
+    }
+
+    // Classic 8x8 Bayer matrix, values 0 to 63
+    constexpr uint8_t BayerMatrix[8][8] =
+    {
+        {  0, 32,  8, 40,  2, 34, 10, 42 },
+        { 48, 16, 56, 24, 50, 18, 58, 26 },
+        { 12, 44,  4, 36, 14, 46,  6, 38 },
+        { 60, 28, 52, 20, 62, 30, 54, 22 },
+        {  3, 35, 11, 43,  1, 33,  9, 41 },
+        { 51, 19, 59, 27, 49, 17, 57, 25 },
+        { 15, 47,  7, 39, 13, 45,  5, 37 },
+        { 63, 31, 55, 23, 61, 29, 53, 21 },
+    };
+
+    inline uint8_t ClampChannel(int32_t value)
+    {
+        return static_cast<uint8_t>(std::clamp(value, 0, 255));
+    }
+
+    // Dither offsets for 8 BGRA pixels, split into a part to add and a part
+    // to subtract so that saturating byte math clamps each channel. Alpha is
+    // left alone.
+    struct DitherPattern
+    {
+        alignas(16) uint8_t Add[32];
+        alignas(16) uint8_t Subtract[32];
+    };
+
+    // Adds the pattern to each pixel of the row and writes out its 15-bit
+    // color bucket.
+    void DitherRowScalar(uint8_t const* row, DitherPattern const& pattern, uint32_t begin, uint32_t end, uint32_t* buckets)
+    {
+        for (auto x = begin; x < end; x++)
+        {
+            auto pixel = row + (x * 4);
+            auto add = pattern.Add + ((x & 7) * 4);
+            auto subtract = pattern.Subtract + ((x & 7) * 4);
+            buckets[x] = ToColorBucket(
+                ClampChannel(std::min(pixel[2] + add[2], 255) - subtract[2]),
+                ClampChannel(std::min(pixel[1] + add[1], 255) - subtract[1]),
+                ClampChannel(std::min(pixel[0] + add[0], 255) - subtract[0]));
+        }
+    }
+
+    void DitherRow(uint8_t const* row, DitherPattern const& pattern, uint32_t width, uint32_t* buckets)
+    {
+        uint32_t x = 0;
+#if defined(GIFCOMPOSE_QUANTIZE_X86)
+        auto const add0 = _mm_load_si128(reinterpret_cast<__m128i const*>(pattern.Add));
+        auto const add1 = _mm_load_si128(reinterpret_cast<__m128i const*>(pattern.Add + 16));
+        auto const subtract0 = _mm_load_si128(reinterpret_cast<__m128i const*>(pattern.Subtract));
+        auto const subtract1 = _mm_load_si128(reinterpret_cast<__m128i const*>(pattern.Subtract + 16));
+        auto const blueMask = _mm_set1_epi32(0x1F);
+        auto const greenMask = _mm_set1_epi32(0x3E0);
+        auto const redMask = _mm_set1_epi32(0x7C00);
+        auto toBuckets = [&](__m128i pixels)
+        {
+            // The top 5 bits of blue, green and red, packed the same way as
+            // ToColorBucket
+            return _mm_or_si128(
+                _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 3), blueMask), _mm_and_si128(_mm_srli_epi32(pixels, 6), greenMask)),
+                _mm_and_si128(_mm_srli_epi32(pixels, 9), redMask));
+        };
+        for (; x + 8 <= width; x += 8)
+        {
+            auto pixels0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + (x * 4)));
+            auto pixels1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + (x * 4) + 16));
+            pixels0 = _mm_subs_epu8(_mm_adds_epu8(pixels0, add0), subtract0);
+            pixels1 = _mm_subs_epu8(_mm_adds_epu8(pixels1, add1), subtract1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buckets + x), toBuckets(pixels0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buckets + x + 4), toBuckets(pixels1));
+        }
+#elif defined(GIFCOMPOSE_QUANTIZE_NEON)
+        auto const add0 = vld1q_u8(pattern.Add);
+        auto const add1 = vld1q_u8(pattern.Add + 16);
+        auto const subtract0 = vld1q_u8(pattern.Subtract);
+        auto const subtract1 = vld1q_u8(pattern.Subtract + 16);
+        auto const blueMask = vdupq_n_u32(0x1F);
+        auto const greenMask = vdupq_n_u32(0x3E0);
+        auto const redMask = vdupq_n_u32(0x7C00);
+        auto toBuckets = [&](uint8x16_t pixelBytes)
+        {
+            auto pixels = vreinterpretq_u32_u8(pixelBytes);
+            return vorrq_u32(
+                vorrq_u32(vandq_u32(vshrq_n_u32(pixels, 3), blueMask), vandq_u32(vshrq_n_u32(pixels, 6), greenMask)),
+                vandq_u32(vshrq_n_u32(pixels, 9), redMask));
+        };
+        for (; x + 8 <= width; x += 8)
+        {
+            auto pixels0 = vqsubq_u8(vqaddq_u8(vld1q_u8(row + (x * 4)), add0), subtract0);
+            auto pixels1 = vqsubq_u8(vqaddq_u8(vld1q_u8(row + (x * 4) + 16), add1), subtract1);
+            vst1q_u32(buckets + x, toBuckets(pixels0));
+            vst1q_u32(buckets + x + 4, toBuckets(pixels1));
+        }
+#endif
+        DitherRowScalar(row, pattern, x, width, buckets);
+    }
+
+    void MapWithOrderedDither(uint8_t const* bgraPixels, uint8_t const* previousPixels, uint32_t width, uint32_t height, uint32_t stride, IndexedImage& image)
+    {
+        // About half the distance between neighbouring palette colors, if
+        // they were spread evenly over the color cube. More than that adds
+        // visible noise without making gradients any smoother.
+        auto spread = 128.0 / std::cbrt(static_cast<double>(std::max<size_t>(image.Palette.size(), 2)));
+        std::array<DitherPattern, 8> patterns = {};
+        for (uint32_t y = 0; y < 8; y++)
+        {
+            for (uint32_t x = 0; x < 8; x++)
+            {
+                auto offset = static_cast<int32_t>(((BayerMatrix[y][x] + 0.5) / 64.0 - 0.5) * spread);
+                for (uint32_t channel = 0; channel < 3; channel++)
+                {
+                    patterns[y].Add[(x * 4) + channel] = static_cast<uint8_t>(std::max(offset, 0));
+                    patterns[y].Subtract[(x * 4) + channel] = static_cast<uint8_t>(std::max(-offset, 0));
+                }
+            }
+        }
+
+        auto table = BuildNearestColorTable(image.Palette, image.TransparentIndex);
+        std::vector<uint32_t> buckets(width);
+        // Unchanged pixels are masked to the transparent index, rather than
+        // branched around, so the loops below stay straight line code
+        auto transparentIndex = static_cast<uint8_t>(image.TransparentIndex);
+        auto indices = image.Indices.data();
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = bgraPixels + (static_cast<size_t>(y) * stride);
+            DitherRow(row, patterns[y & 7], width, buckets.data());
+            if (previousPixels == nullptr)
+            {
+                for (uint32_t x = 0; x < width; x++)
+                {
+                    indices[x] = table[buckets[x]];
+                }
+            }
+            else
+            {
+                auto current = reinterpret_cast<uint32_t const*>(row);
+                auto previous = reinterpret_cast<uint32_t const*>(previousPixels + (static_cast<size_t>(y) * stride));
+                for (uint32_t x = 0; x < width; x++)
+                {
+                    auto changed = static_cast<uint8_t>(0 - static_cast<uint8_t>(current[x] != previous[x]));
+                    indices[x] = static_cast<uint8_t>((table[buckets[x]] & changed) | (transparentIndex & ~changed));
+                }
+            }
+            indices += width;
+        }
+    }
+
+    void MapWithErrorDiffusion(uint8_t const* bgraPixels, uint8_t const* previousPixels, uint32_t width, uint32_t height, uint32_t stride, IndexedImage& image)
+    {
+        // Error carried to the current and next row, in sixteenths, with a
+        // pixel of padding on either side
+        std::vector<std::array<int32_t, 3>> currentErrors(static_cast<size_t>(width) + 2);
+        std::vector<std::array<int32_t, 3>> nextErrors(static_cast<size_t>(width) + 2);
+
+        auto table = BuildNearestColorTable(image.Palette, image.TransparentIndex);
+        auto indices = image.Indices.data();
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = bgraPixels + (static_cast<size_t>(y) * stride);
+            auto previousRow = previousPixels != nullptr ? previousPixels + (static_cast<size_t>(y) * stride) : nullptr;
+            std::fill(nextErrors.begin(), nextErrors.end(), std::array<int32_t, 3>{});
+            for (uint32_t x = 0; x < width; x++)
+            {
+                auto pixel = row + (x * 4);
+                // Unchanged pixels show the previous frame, so they don't
+                // take or pass on any error
+                if (IsUnchanged(pixel, previousRow != nullptr ? previousRow + (x * 4) : nullptr))
+                {
+                    *indices++ = static_cast<uint8_t>(image.TransparentIndex);
+                    continue;
+                }
+                auto&& error = currentErrors[x + 1];
+                std::array<int32_t, 3> wanted =
+                {
+                    pixel[2] + (error[0] / 16),
+                    pixel[1] + (error[1] / 16),
+                    pixel[0] + (error[2] / 16),
+                };
+                auto index = table[ToColorBucket(ClampChannel(wanted[0]), ClampChannel(wanted[1]), ClampChannel(wanted[2]))];
+                *indices++ = index;
+
+                auto&& color = image.Palette[index];
+                std::array<int32_t, 3> const actual = { color.R, color.G, color.B };
+                for (uint32_t channel = 0; channel < 3; channel++)
+                {
+                    auto difference = std::clamp(wanted[channel], 0, 255) - actual[channel];
+                    currentErrors[x + 2][channel] += difference * 7;
+                    nextErrors[x][channel] += difference * 3;
+                    nextErrors[x + 1][channel] += difference * 5;
+                    nextErrors[x + 2][channel] += difference;
+                }
+            }
+            std::swap(currentErrors, nextErrors);
+        }
+    }
+
+    struct HistogramEntry
+    {
+        uint32_t Bucket;
+        uint64_t Count;
+    };
+
+    struct Box
+    {
+        size_t Begin;
+        size_t End;
+        uint64_t Population;
+    };
+
+    void IndexWithMedianCut(uint8_t const* bgraPixels, uint8_t const* previousPixels, uint32_t width, uint32_t height, uint32_t stride, DitherMode dither, IndexedImage& image)
+    {
+        // Build a histogram of 15-bit colors, keeping the full precision sums
+        // around so the palette colors aren't biased towards the bucket corners.
+        ColorHistogram histogram;
+        histogram.Counts.resize(ColorHistogramSize, 0);
+        histogram.Sums.resize(ColorHistogramSize * 3, 0);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = bgraPixels + (static_cast<size_t>(y) * stride);
+            auto previousRow = previousPixels != nullptr ? previousPixels + (static_cast<size_t>(y) * stride) : nullptr;
+            for (uint32_t x = 0; x < width; x++)
+            {
+                auto pixel = row + (x * 4);
+                if (IsUnchanged(pixel, previousRow != nullptr ? previousRow + (x * 4) : nullptr))
+                {
+                    continue;
+                }
+                auto bucket = ToColorBucket(pixel[2], pixel[1], pixel[0]);
+                histogram.Counts[bucket]++;
+                histogram.Sums[(bucket * 3) + 0] += pixel[2];
+                histogram.Sums[(bucket * 3) + 1] += pixel[1];
+                histogram.Sums[(bucket * 3) + 2] += pixel[0];
+            }
+        }
+
+        auto palette = BuildMedianCutPalette(histogram, previousPixels != nullptr);
+        image.Palette = std::move(palette.Colors);
+        image.TransparentIndex = palette.TransparentIndex;
+        if (dither == DitherMode::Ordered)
+        {
+            MapWithOrderedDither(bgraPixels, previousPixels, width, height, stride, image);
+            return;
+        }
+        else if (dither == DitherMode::FloydSteinberg)
+        {
+            MapWithErrorDiffusion(bgraPixels, previousPixels, width, height, stride, image);
+            return;
+        }
+
+        auto&& lookup = palette.Lookup;
+        auto indices = image.Indices.data();
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = bgraPixels + (static_cast<size_t>(y) * stride);
+            auto previousRow = previousPixels != nullptr ? previousPixels + (static_cast<size_t>(y) * stride) : nullptr;
+            for (uint32_t x = 0; x < width; x++)
+            {
+                auto pixel = row + (x * 4);
+                if (IsUnchanged(pixel, previousRow != nullptr ? previousRow + (x * 4) : nullptr))
+                {
+                    *indices++ = static_cast<uint8_t>(image.TransparentIndex);
+                }
+                else
+                {
+                    *indices++ = lookup[ToColorBucket(pixel[2], pixel[1], pixel[0])];
+                }
+            }
+        }
+    }
+}
+
+ColorPalette BuildMedianCutPalette(ColorHistogram const& histogram, bool reserveTransparentIndex)
+{
+    ColorPalette palette;
+    palette.Lookup.resize(ColorHistogramSize, 0);
+    if (reserveTransparentIndex)
+    {
+        // The transparent color always gets the first palette entry
+        palette.TransparentIndex = 0;
+        palette.Colors.push_back({ 0, 0, 0 });
+    }
+
+    std::vector<HistogramEntry> entries;
+    uint64_t population = 0;
+    for (uint32_t bucket = 0; bucket < ColorHistogramSize; bucket++)
+    {
+        auto count = histogram.Counts[bucket];
+        if (count > 0)
+        {
+            entries.push_back({ bucket, count });
+            population += count;
+        }
+    }
+
+    // Keep splitting the most populated box along its longest axis
+    std::vector<Box> boxes;
+    auto maxBoxes = MaxPaletteSize - palette.Colors.size();
+    boxes.push_back({ 0, entries.size(), population });
+    while (boxes.size() < maxBoxes)
+    {
+        auto boxIndex = boxes.size();
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            auto&& box = boxes[i];
+            if (box.End - box.Begin > 1 && (boxIndex == boxes.size() || box.Population > boxes[boxIndex].Population))
+            {
+                boxIndex = i;
+            }
+        }
+        if (boxIndex == boxes.size())
+        {
+            break;
+        }
+        auto box = boxes[boxIndex];
+
+        std::array<uint32_t, 3> minimums = { 31, 31, 31 };
+        std::array<uint32_t, 3> maximums = { 0, 0, 0 };
+        for (auto i = box.Begin; i < box.End; i++)
+        {
+            for (uint32_t channel = 0; channel < 3; channel++)
+            {
+                auto value = BucketChannel(entries[i].Bucket, channel);
+                minimums[channel] = std::min(minimums[channel], value);
+                maximums[channel] = std::max(maximums[channel], value);
+            }
+        }
+        uint32_t axis = 0;
+        for (uint32_t channel = 1; channel < 3; channel++)
+        {
+            if (maximums[channel] - minimums[channel] > maximums[axis] - minimums[axis])
+            {
+                axis = channel;
+            }
+        }
+
+        std::sort(entries.begin() + box.Begin, entries.begin() + box.End, [axis](auto const& left, auto const& right)
+            {
+                return BucketChannel(left.Bucket, axis) < BucketChannel(right.Bucket, axis);
+            });
+        uint64_t lowerPopulation = 0;
+        auto split = box.Begin;
+        while (split < box.End - 1 && lowerPopulation + entries[split].Count <= box.Population / 2)
+        {
+            lowerPopulation += entries[split].Count;
+            split++;
+        }
+        if (split == box.Begin)
+        {
+            lowerPopulation += entries[split].Count;
+            split++;
+        }
+
+        boxes[boxIndex] = { box.Begin, split, lowerPopulation };
+        boxes.push_back({ split, box.End, box.Population - lowerPopulation });
+    }
+
+    // Each box becomes a palette entry, and every bucket in the box maps to it
+    auto hasSums = !histogram.Sums.empty();
+    for (auto&& box : boxes)
+    {
+        std::array<uint64_t, 3> total = {};
+        for (auto i = box.Begin; i < box.End; i++)
+        {
+            auto bucket = entries[i].Bucket;
+            for (uint32_t channel = 0; channel < 3; channel++)
+            {
+                if (hasSums)
+                {
+                    total[channel] += histogram.Sums[(bucket * 3) + channel];
+                }
+                else
+                {
+                    total[channel] += static_cast<uint64_t>((BucketChannel(bucket, channel) << 3) | 4) * entries[i].Count;
+                }
+            }
+            palette.Lookup[bucket] = static_cast<uint8_t>(palette.Colors.size());
+        }
+        auto boxPopulation = std::max<uint64_t>(box.Population, 1);
+        palette.Colors.push_back(
+            {
+                static_cast<uint8_t>(total[0] / boxPopulation),
+                static_cast<uint8_t>(total[1] / boxPopulation),
+                static_cast<uint8_t>(total[2] / boxPopulation),
+            });
+    }
+
+    return palette;
+}
+
+IndexedImage QuantizeImage(
+    uint8_t const* bgraPixels,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    uint8_t const* previousPixels,
+    DitherMode dither)
+{
+    IndexedImage image;
+    image.Width = width;
+    image.Height = height;
+    image.Indices.resize(static_cast<size_t>(width) * height);
+
+    // The transparent color always gets the first palette entry
+    if (previousPixels != nullptr)
+    {
+        image.TransparentIndex = 0;
+        image.Palette.push_back({ 0, 0, 0 });
+    }
+    if (!TryIndexExactly(bgraPixels, previousPixels, width, height, stride, image))
+    {
+        image.Palette.clear();
+        IndexWithMedianCut(bgraPixels, previousPixels, width, height, stride, dither, image);
+    }
+    if (image.Palette.empty())
+    {
+        image.Palette.push_back({ 0, 0, 0 });
+    }
+    return image;
+}
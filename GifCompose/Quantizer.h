@@ -0,0 +1,75 @@
+﻿#pragma once
+
+struct PaletteColor
+{
+    uint8_t R;
+    uint8_t G;
+    uint8_t B;
+};
+
+constexpr uint32_t MaxPaletteSize = 256;
+constexpr uint32_t ColorHistogramSize = 1 << 15;
+
+inline uint32_t ToColorBucket(uint8_t r, uint8_t g, uint8_t b)
+{
+    return ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+}
+
+// A histogram of 15-bit colors. Sums holds the full precision red, green
+// and blue totals of each bucket. It may be left empty, in which case the
+// bucket centers are used.
+struct ColorHistogram
+{
+    std::vector<uint64_t> Counts;
+    std::vector<uint64_t> Sums;
+};
+
+struct ColorPalette
+{
+    std::vector<PaletteColor> Colors;
+    // Maps every 15-bit color bucket seen in the histogram to a palette index
+    std::vector<uint8_t> Lookup;
+    // -1 if no entry is reserved for transparency
+    int32_t TransparentIndex = -1;
+};
+
+enum class DitherMode
+{
+    None,
+    // An 8x8 Bayer matrix. Each pixel only depends on its own position, so
+    // it can run over a row at a time.
+    Ordered,
+    FloydSteinberg,
+};
+
+// An image made up of indices into a palette of at most 256 colors.
+struct IndexedImage
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<uint8_t> Indices;
+    std::vector<PaletteColor> Palette;
+    // -1 if the image has no transparent pixels
+    int32_t TransparentIndex = -1;
+};
+
+// Builds a palette using median cut. If reserveTransparentIndex is true, the
+// first entry is set aside for transparency.
+ColorPalette BuildMedianCutPalette(ColorHistogram const& histogram, bool reserveTransparentIndex);
+
+// Reduces a BGRA8 image to at most 256 colors. Images that already have 256
+// colors or fewer are indexed exactly, everything else goes through median
+// cut on a 15-bit histogram. Alpha is ignored, frames are expected to be
+// composed onto an opaque background.
+//
+// If previousPixels is provided (with the same stride), pixels that haven't
+// changed are mapped to a reserved transparent index instead.
+//
+// Dithering only applies to images that go through median cut.
+IndexedImage QuantizeImage(
+    uint8_t const* bgraPixels,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    uint8_t const* previousPixels = nullptr,
+    DitherMode dither = DitherMode::None);
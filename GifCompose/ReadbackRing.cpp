@@ -0,0 +1,160 @@
+﻿#include "pch.h"
+#include "ReadbackRing.h"
+
+namespace
+{
+    uint32_t GetBytesPerPixel(DXGI_FORMAT format)
+    {
+        switch (format)
+        {
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+            return 4;
+        case DXGI_FORMAT_R8_UINT:
+            return 1;
+        default:
+            throw winrt::hresult_invalid_argument(L"Unsupported readback format!");
+        }
+    }
+}
+
+ReadbackRing::ReadbackRing(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    D3D11_TEXTURE2D_DESC const& textureDesc,
+    uint32_t depth)
+{
+    if (depth == 0)
+    {
+        throw winrt::hresult_invalid_argument(L"The readback depth must be at least 1!");
+    }
+
+    auto desc = textureDesc;
+    desc.Usage = D3D11_USAGE_STAGING;
+    desc.BindFlags = 0;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    desc.MiscFlags = 0;
+    m_rowSize = desc.Width * GetBytesPerPixel(desc.Format);
+    m_height = desc.Height;
+
+    // Fences let us wait on the GPU without the device lock, fall back to
+    // event queries where they aren't supported
+    if (auto d3dDevice5 = d3dDevice.try_as<ID3D11Device5>())
+    {
+        if (SUCCEEDED(d3dDevice5->CreateFence(0, D3D11_FENCE_FLAG_NONE, winrt::guid_of<ID3D11Fence>(), m_fence.put_void())))
+        {
+            m_fenceEvent.create(wil::EventOptions::None);
+        }
+    }
+
+    D3D11_QUERY_DESC queryDesc = {};
+    queryDesc.Query = D3D11_QUERY_EVENT;
+
+    m_slots.resize(depth);
+    for (auto&& slot : m_slots)
+    {
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, slot.Texture.put()));
+        if (!m_fence)
+        {
+            winrt::check_hresult(d3dDevice->CreateQuery(&queryDesc, slot.Query.put()));
+        }
+    }
+}
+
+void ReadbackRing::Enqueue(
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    winrt::com_ptr<ID3D11Texture2D> const& source)
+{
+    if (IsFull())
+    {
+        throw winrt::hresult_illegal_method_call(L"The readback ring is full!");
+    }
+
+    auto&& slot = m_slots[(m_oldest + m_pendingCount) % m_slots.size()];
+    d3dContext->CopyResource(slot.Texture.get(), source.get());
+    if (m_fence)
+    {
+        slot.FenceValue = ++m_lastFenceValue;
+        winrt::check_hresult(d3dContext.as<ID3D11DeviceContext4>()->Signal(m_fence.get(), slot.FenceValue));
+    }
+    else
+    {
+        d3dContext->End(slot.Query.get());
+    }
+    // Make sure the copy actually gets submitted while we do other work
+    d3dContext->Flush();
+    m_pendingCount++;
+}
+
+bool ReadbackRing::IsOldestReady(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext)
+{
+    if (m_pendingCount == 0)
+    {
+        throw winrt::hresult_illegal_method_call(L"The readback ring is empty!");
+    }
+
+    auto&& slot = m_slots[m_oldest];
+    if (m_fence)
+    {
+        return m_fence->GetCompletedValue() >= slot.FenceValue;
+    }
+    auto hr = d3dContext->GetData(slot.Query.get(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH);
+    winrt::check_hresult(hr);
+    return hr == S_OK;
+}
+
+uint64_t ReadbackRing::OldestCopyFence() const
+{
+    if (m_pendingCount == 0)
+    {
+        throw winrt::hresult_illegal_method_call(L"The readback ring is empty!");
+    }
+    return m_fence ? m_slots[m_oldest].FenceValue : 0;
+}
+
+void ReadbackRing::WaitForCopy(uint64_t fenceValue)
+{
+    if (!m_fence || fenceValue == 0)
+    {
+        throw winrt::hresult_illegal_method_call(L"There is no fence to wait on!");
+    }
+
+    if (m_fence->GetCompletedValue() < fenceValue)
+    {
+        winrt::check_hresult(m_fence->SetEventOnCompletion(fenceValue, m_fenceEvent.get()));
+        m_fenceEvent.wait();
+    }
+}
+
+void ReadbackRing::Dequeue(
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    std::vector<uint8_t>& bytes)
+{
+    if (m_pendingCount == 0)
+    {
+        throw winrt::hresult_illegal_method_call(L"The readback ring is empty!");
+    }
+
+    // Map waits for the copy itself, callers check IsOldestReady first so
+    // that they don't wait here with the device lock held
+    auto&& slot = m_slots[m_oldest];
+
+    // Copy the rows out, the staging texture's row pitch may be padded
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    winrt::check_hresult(d3dContext->Map(slot.Texture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+    bytes.resize(FrameByteSize());
+    auto source = reinterpret_cast<uint8_t const*>(mapped.pData);
+    if (mapped.RowPitch == m_rowSize)
+    {
+        memcpy(bytes.data(), source, bytes.size());
+    }
+    else
+    {
+        for (uint32_t y = 0; y < m_height; y++)
+        {
+            memcpy(bytes.data() + (static_cast<size_t>(y) * m_rowSize), source + (static_cast<size_t>(y) * mapped.RowPitch), m_rowSize);
+        }
+    }
+    d3dContext->Unmap(slot.Texture.get(), 0);
+
+    m_oldest = (m_oldest + 1) % m_slots.size();
+    m_pendingCount--;
+}
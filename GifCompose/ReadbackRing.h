@@ -0,0 +1,62 @@
+﻿#pragma once
+
+// A ring of staging textures used to read rendered frames back to the CPU
+// without stalling the GPU. Each copy is followed by a fence signal (or an
+// event query on devices without fences), and a staging texture is only
+// mapped once the GPU has reached it. Supports BGRA8 and 8-bit palette index
+// textures.
+//
+// The ring can be filled and drained from different threads as long as both
+// hold the device lock. The one exception is WaitForCopy, which is meant to
+// be called without it.
+class ReadbackRing
+{
+public:
+    ReadbackRing(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        D3D11_TEXTURE2D_DESC const& textureDesc,
+        uint32_t depth);
+
+    size_t Depth() const { return m_slots.size(); }
+    size_t PendingCount() const { return m_pendingCount; }
+    bool IsFull() const { return m_pendingCount == m_slots.size(); }
+    // The size of a frame once it's been read back, rows are tightly packed.
+    size_t FrameByteSize() const { return static_cast<size_t>(m_rowSize) * m_height; }
+
+    // Queues a copy of the source texture into the next free staging texture.
+    void Enqueue(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        winrt::com_ptr<ID3D11Texture2D> const& source);
+    // Returns true if the oldest pending copy has finished, so Dequeue won't
+    // have to wait.
+    bool IsOldestReady(winrt::com_ptr<ID3D11DeviceContext> const& d3dContext);
+    // Returns the fence value the oldest pending copy signals, or 0 if the
+    // device doesn't support fences and IsOldestReady has to be polled.
+    uint64_t OldestCopyFence() const;
+    // Blocks until the GPU reaches the given fence value. This doesn't touch
+    // the device context, so other threads can keep using the device while
+    // we wait.
+    void WaitForCopy(uint64_t fenceValue);
+    // Copies the oldest pending frame's pixels into bytes, which is resized
+    // to FrameByteSize. Blocks until the copy is done if it isn't yet.
+    void Dequeue(
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        std::vector<uint8_t>& bytes);
+
+private:
+    struct Slot
+    {
+        winrt::com_ptr<ID3D11Texture2D> Texture;
+        winrt::com_ptr<ID3D11Query> Query;
+        uint64_t FenceValue = 0;
+    };
+
+    std::vector<Slot> m_slots;
+    winrt::com_ptr<ID3D11Fence> m_fence;
+    wil::unique_event m_fenceEvent;
+    uint64_t m_lastFenceValue = 0;
+    uint32_t m_rowSize = 0;
+    uint32_t m_height = 0;
+    size_t m_oldest = 0;
+    size_t m_pendingCount = 0;
+};
@@ -0,0 +1,84 @@
+﻿#pragma once
+
+// A bounded FIFO that hands work from one pipeline stage to the next. Push
+// blocks while the queue is full, which is what keeps a fast stage from
+// running too far ahead of a slow one. Pop blocks while the queue is empty.
+//
+// Either side can Close the queue: Push fails from then on, and Pop returns
+// what's left before returning nothing. A stage that fails closes its queues
+// so the stages on either side don't wait on it forever.
+template <typename T>
+class StageQueue
+{
+public:
+    StageQueue(size_t capacity) : m_capacity(std::max<size_t>(capacity, 1)) {}
+
+    size_t Capacity() const { return m_capacity; }
+    // Blocks the pushing side until the next item is popped. Returns false
+    // right away if the queue is empty or closed, since then nothing is
+    // coming.
+    bool WaitForPop()
+    {
+        std::unique_lock lock(m_lock);
+        if (m_isClosed || m_items.empty())
+        {
+            return false;
+        }
+        auto popCount = m_popCount;
+        m_notFull.wait(lock, [&]() { return m_isClosed || m_popCount != popCount; });
+        return true;
+    }
+
+    // Returns false if the queue was closed, in which case value is dropped.
+    bool Push(T value)
+    {
+        {
+            std::unique_lock lock(m_lock);
+            m_notFull.wait(lock, [this]() { return m_isClosed || m_items.size() < m_capacity; });
+            if (m_isClosed)
+            {
+                return false;
+            }
+            m_items.push_back(std::move(value));
+        }
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    std::optional<T> Pop()
+    {
+        std::optional<T> value;
+        {
+            std::unique_lock lock(m_lock);
+            m_notEmpty.wait(lock, [this]() { return m_isClosed || !m_items.empty(); });
+            if (m_items.empty())
+            {
+                return std::nullopt;
+            }
+            value.emplace(std::move(m_items.front()));
+            m_items.pop_front();
+            m_popCount++;
+        }
+        m_notFull.notify_one();
+        return value;
+    }
+
+    void Close()
+    {
+        {
+            std::scoped_lock lock(m_lock);
+            m_isClosed = true;
+        }
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+
+private:
+    size_t m_capacity = 0;
+    std::mutex m_lock;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+    std::deque<T> m_items;
+    uint64_t m_popCount = 0;
+    bool m_isClosed = false;
+};
@@ -0,0 +1,60 @@
+﻿#include "pch.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    }
+    m_threads.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        m_threads.emplace_back([this]() { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::scoped_lock lock(m_lock);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    for (auto&& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void ThreadPool::Enqueue(std::function<void()> work)
+{
+    {
+        std::scoped_lock lock(m_lock);
+        m_work.push_back(std::move(work));
+    }
+    m_workAvailable.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+    winrt::init_apartment(winrt::apartment_type::multi_threaded);
+    while (true)
+    {
+        std::function<void()> work;
+        {
+            std::unique_lock lock(m_lock);
+            m_workAvailable.wait(lock, [this]() { return m_stopping || !m_work.empty(); });
+            if (m_work.empty())
+            {
+                break;
+            }
+            work = std::move(m_work.front());
+            m_work.pop_front();
+        }
+        // Exceptions are captured by the packaged_task and surface
+        // through the future returned by Submit.
+        work();
+    }
+    winrt::uninit_apartment();
+}
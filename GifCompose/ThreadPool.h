@@ -0,0 +1,33 @@
+﻿#pragma once
+
+// A fixed set of worker threads that run submitted work in FIFO order. Each
+// worker joins the MTA so it can use WIC and other COM objects.
+class ThreadPool
+{
+public:
+    ThreadPool(uint32_t threadCount);
+    ~ThreadPool();
+
+    uint32_t ThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+    template <typename Func>
+    auto Submit(Func&& func) -> std::future<std::invoke_result_t<Func>>
+    {
+        using Result = std::invoke_result_t<Func>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+        auto future = task->get_future();
+        Enqueue([task]() { (*task)(); });
+        return future;
+    }
+
+private:
+    void Enqueue(std::function<void()> work);
+    void WorkerLoop();
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_lock;
+    std::condition_variable m_workAvailable;
+    std::deque<std::function<void()>> m_work;
+    bool m_stopping = false;
+};
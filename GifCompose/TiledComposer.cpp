@@ -0,0 +1,207 @@
+﻿#include "pch.h"
+#include "TiledComposer.h"
+#include "BitmapLoader.h"
+
+namespace
+{
+    inline uint64_t GetArea(PixelRect const& rect)
+    {
+        return static_cast<uint64_t>(rect.Width) * rect.Height;
+    }
+
+    PixelRect Intersect(PixelRect const& left, PixelRect const& right)
+    {
+        auto x1 = std::max(left.Left, right.Left);
+        auto y1 = std::max(left.Top, right.Top);
+        auto x2 = std::min(left.Left + left.Width, right.Left + right.Width);
+        auto y2 = std::min(left.Top + left.Height, right.Top + right.Height);
+        if (x1 >= x2 || y1 >= y2)
+        {
+            return {};
+        }
+        return { x1, y1, x2 - x1, y2 - y1 };
+    }
+
+    void CopyRect(uint8_t const* source, uint32_t sourceStride, uint8_t* dest, uint32_t destStride, uint32_t width, uint32_t height)
+    {
+        for (uint32_t y = 0; y < height; y++)
+        {
+            memcpy(dest + (static_cast<size_t>(y) * destStride), source + (static_cast<size_t>(y) * sourceStride), static_cast<size_t>(width) * 4);
+        }
+    }
+
+    inline size_t GetPixelOffset(uint32_t x, uint32_t y, uint32_t stride)
+    {
+        return (static_cast<size_t>(y) * stride) + (static_cast<size_t>(x) * 4);
+    }
+}
+
+TiledComposer::TiledComposer(
+    PipelineDevice const& device,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    D2D1_SIZE_U frameSize,
+    uint32_t tileSize,
+    std::vector<DecodedImage> const& backgrounds,
+    PipelineProfiler* profiler)
+{
+    if (tileSize == 0 || tileSize > MaxTileSize)
+    {
+        throw winrt::hresult_invalid_argument(L"Tile sizes must be between 1 and 16384!");
+    }
+    m_device = device;
+    m_d2dContext = d2dContext;
+    m_frameSize = frameSize;
+    m_tileSize = tileSize;
+    m_profiler = profiler;
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = tileSize;
+    desc.Height = tileSize;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+    desc.SampleDesc.Count = 1;
+    auto&& d3dDevice = m_device.D3DDevice;
+    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_renderTargetTexture.put()));
+    m_renderTarget = CreateBitmapFromTexture(m_renderTargetTexture, m_d2dContext);
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_layerTexture.put()));
+    m_layerBitmap = CreateBitmapFromTexture(m_layerTexture, m_d2dContext);
+    desc.Usage = D3D11_USAGE_STAGING;
+    desc.BindFlags = 0;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    for (auto&& stagingTexture : m_stagingTextures)
+    {
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, stagingTexture.put()));
+    }
+
+    // Compose the backgrounds once, every frame starts from this
+    std::vector<DecodedImage const*> layers;
+    for (auto&& background : backgrounds)
+    {
+        if (background.Width != frameSize.width || background.Height != frameSize.height)
+        {
+            throw winrt::hresult_invalid_argument(L"All backgrounds must be of the same size as the frames!");
+        }
+        layers.push_back(&background);
+    }
+    m_backgroundTemplate.resize(FrameByteSize());
+    ComposeLayers(nullptr, layers, m_backgroundTemplate.data());
+}
+
+void TiledComposer::Compose(DecodedImage const& frame, std::vector<uint8_t>& bytes)
+{
+    auto&& coverage = frame.Coverage;
+    auto fullArea = static_cast<uint64_t>(m_frameSize.width) * m_frameSize.height;
+    m_stats.FramesComposed++;
+    m_stats.PixelsWithoutCoverage += fullArea * 2;
+
+    bytes.resize(FrameByteSize());
+    auto stride = m_frameSize.width * 4;
+    // Drawing an opaque frame over anything gives you the frame
+    if (coverage.IsOpaque)
+    {
+        m_stats.BackgroundsSkipped++;
+        CopyRect(frame.Data(), frame.Stride(), bytes.data(), stride, m_frameSize.width, m_frameSize.height);
+        return;
+    }
+    ComposeLayers(m_backgroundTemplate.data(), { &frame }, bytes.data());
+}
+
+void TiledComposer::ComposeLayers(uint8_t const* base, std::vector<DecodedImage const*> const& layers, uint8_t* dest)
+{
+    auto&& d3dContext = m_device.D3DContext;
+    auto stride = m_frameSize.width * 4;
+    auto lock = m_device.Lock();
+    m_d2dContext->SetTarget(m_renderTarget.get());
+
+    std::optional<PixelRect> pendingTile;
+    size_t pendingSlot = 0;
+    size_t tileIndex = 0;
+    for (uint32_t top = 0; top < m_frameSize.height; top += m_tileSize)
+    {
+        for (uint32_t left = 0; left < m_frameSize.width; left += m_tileSize)
+        {
+            PixelRect tile = { left, top, std::min(m_tileSize, m_frameSize.width - left), std::min(m_tileSize, m_frameSize.height - top) };
+            auto isCovered = std::any_of(layers.begin(), layers.end(), [&](auto&& layer)
+                {
+                    return !Intersect(layer->Coverage.Bounds, tile).IsEmpty();
+                });
+            if (!isCovered && base != nullptr)
+            {
+                auto offset = GetPixelOffset(tile.Left, tile.Top, stride);
+                CopyRect(base + offset, stride, dest + offset, stride, tile.Width, tile.Height);
+                continue;
+            }
+
+            {
+                StageTimer timer(m_profiler, PipelineStage::Compose);
+                D3D11_BOX tileBox = { 0, 0, 0, tile.Width, tile.Height, 1 };
+                if (base != nullptr)
+                {
+                    d3dContext->UpdateSubresource(m_renderTargetTexture.get(), 0, &tileBox, base + GetPixelOffset(tile.Left, tile.Top, stride), stride, 0);
+                    m_stats.PixelsDrawn += GetArea(tile);
+                }
+                else
+                {
+                    auto clearColor = D2D1_COLOR_F{ 1.0f, 1.0f, 1.0f, 1.0f };
+                    m_d2dContext->BeginDraw();
+                    m_d2dContext->Clear(&clearColor);
+                    winrt::check_hresult(m_d2dContext->EndDraw());
+                }
+                for (auto&& layer : layers)
+                {
+                    // Layers are drawn at the same place in the tile as in
+                    // the frame
+                    auto region = Intersect(layer->Coverage.Bounds, tile);
+                    if (region.IsEmpty())
+                    {
+                        continue;
+                    }
+                    D3D11_BOX layerBox = { region.Left - tile.Left, region.Top - tile.Top, 0, region.Left - tile.Left + region.Width, region.Top - tile.Top + region.Height, 1 };
+                    d3dContext->UpdateSubresource(m_layerTexture.get(), 0, &layerBox, layer->Data() + GetPixelOffset(region.Left, region.Top, layer->Stride()), layer->Stride(), 0);
+
+                    // Each layer is its own draw, so D2D has used the upload
+                    // before the next one replaces it
+                    m_d2dContext->BeginDraw();
+                    auto rect = D2D1::RectF(
+                        static_cast<float>(layerBox.left),
+                        static_cast<float>(layerBox.top),
+                        static_cast<float>(layerBox.right),
+                        static_cast<float>(layerBox.bottom));
+                    m_d2dContext->DrawBitmap(m_layerBitmap.get(), &rect, 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, &rect);
+                    winrt::check_hresult(m_d2dContext->EndDraw());
+                    m_stats.PixelsDrawn += GetArea(region);
+                }
+                auto slot = tileIndex % m_stagingTextures.size();
+                d3dContext->CopySubresourceRegion(m_stagingTextures[slot].get(), 0, 0, 0, 0, m_renderTargetTexture.get(), 0, &tileBox);
+                if (pendingTile.has_value())
+                {
+                    ReadBackTile(pendingTile.value(), pendingSlot, dest);
+                }
+                pendingTile = tile;
+                pendingSlot = slot;
+                tileIndex++;
+            }
+        }
+    }
+    if (pendingTile.has_value())
+    {
+        ReadBackTile(pendingTile.value(), pendingSlot, dest);
+    }
+    m_d2dContext->SetTarget(nullptr);
+}
+
+void TiledComposer::ReadBackTile(PixelRect const& tile, size_t slot, uint8_t* dest)
+{
+    StageTimer timer(m_profiler, PipelineStage::Readback);
+    auto&& d3dContext = m_device.D3DContext;
+    auto&& stagingTexture = m_stagingTextures[slot];
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    winrt::check_hresult(d3dContext->Map(stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+    auto stride = m_frameSize.width * 4;
+    CopyRect(reinterpret_cast<uint8_t const*>(mapped.pData), mapped.RowPitch, dest + GetPixelOffset(tile.Left, tile.Top, stride), stride, tile.Width, tile.Height);
+    d3dContext->Unmap(stagingTexture.get(), 0);
+}
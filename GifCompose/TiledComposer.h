@@ -0,0 +1,56 @@
+﻿#pragma once
+#include "FrameComposer.h"
+#include "PipelineDevice.h"
+#include "PipelineProfiler.h"
+
+// Composes frames one tile at a time, for canvases larger than a texture can
+// be or that would take up too much video memory. Only a few tile sized
+// textures are allocated on the GPU, frames stay in CPU memory and are
+// uploaded a tile at a time. The backgrounds are composed once up front and
+// kept in CPU memory as well.
+//
+// Tiles that the frame doesn't cover are copied straight from the composed
+// backgrounds, and opaque frames are copied as they are, without using the
+// GPU at all.
+class TiledComposer
+{
+public:
+    // Textures can't be larger than this
+    static constexpr uint32_t MaxTileSize = D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION;
+
+    TiledComposer(
+        PipelineDevice const& device,
+        winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+        D2D1_SIZE_U frameSize,
+        uint32_t tileSize,
+        std::vector<DecodedImage> const& backgrounds,
+        PipelineProfiler* profiler = nullptr);
+
+    CompositionStats const& Stats() const { return m_stats; }
+    size_t FrameByteSize() const { return static_cast<size_t>(m_frameSize.width) * 4 * m_frameSize.height; }
+
+    // Writes the composed frame as BGRA8 with tightly packed rows into bytes,
+    // which is resized to FrameByteSize.
+    void Compose(DecodedImage const& frame, std::vector<uint8_t>& bytes);
+
+private:
+    // Draws the layers on top of base (or white if base is null) and writes
+    // the result to dest. Both are full frames.
+    void ComposeLayers(uint8_t const* base, std::vector<DecodedImage const*> const& layers, uint8_t* dest);
+    void ReadBackTile(PixelRect const& tile, size_t slot, uint8_t* dest);
+
+private:
+    PipelineDevice m_device;
+    winrt::com_ptr<ID2D1DeviceContext> m_d2dContext;
+    D2D1_SIZE_U m_frameSize = {};
+    uint32_t m_tileSize = 0;
+    PipelineProfiler* m_profiler = nullptr;
+    winrt::com_ptr<ID3D11Texture2D> m_renderTargetTexture;
+    winrt::com_ptr<ID2D1Bitmap1> m_renderTarget;
+    winrt::com_ptr<ID3D11Texture2D> m_layerTexture;
+    winrt::com_ptr<ID2D1Bitmap1> m_layerBitmap;
+    // One tile is read back while the next one is composed
+    std::array<winrt::com_ptr<ID3D11Texture2D>, 2> m_stagingTextures;
+    std::vector<uint8_t> m_backgroundTemplate;
+    CompositionStats m_stats;
+};
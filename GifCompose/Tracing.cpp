@@ -0,0 +1,30 @@
+﻿#include "pch.h"
+#include "Tracing.h"
+
+// {6a1cadf8-5364-50d2-2c73-77060306f3ac}
+TRACELOGGING_DEFINE_PROVIDER(
+    g_traceProvider,
+    "GifCompose",
+    (0x6a1cadf8, 0x5364, 0x50d2, 0x2c, 0x73, 0x77, 0x06, 0x03, 0x06, 0xf3, 0xac));
+
+TraceProviderRegistration::TraceProviderRegistration()
+{
+    TraceLoggingRegister(g_traceProvider);
+}
+
+TraceProviderRegistration::~TraceProviderRegistration()
+{
+    TraceLoggingUnregister(g_traceProvider);
+}
+
+void TraceStage(PipelineStage stage, std::chrono::steady_clock::duration duration)
+{
+    auto name = GetPipelineStageName(stage);
+    auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    TraceLoggingWrite(
+        g_traceProvider,
+        "Stage",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingCountedWideString(name.data(), static_cast<USHORT>(name.size()), "Name"),
+        TraceLoggingInt64(microseconds, "DurationUs"));
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+enum class PipelineStage;
+
+// Every stage the profiler times is also written as a TraceLogging event, so
+// per frame latency can be collected from a running process with any ETW
+// consumer (e.g. "wpr" or "tracelog -guid *GifCompose"). The provider name
+// is GifCompose and its GUID is derived from the name the same way
+// EventSource does it.
+TRACELOGGING_DECLARE_PROVIDER(g_traceProvider);
+
+// Registers the provider for the lifetime of the object.
+class TraceProviderRegistration
+{
+public:
+    TraceProviderRegistration();
+    ~TraceProviderRegistration();
+
+    TraceProviderRegistration(TraceProviderRegistration const&) = delete;
+    TraceProviderRegistration& operator=(TraceProviderRegistration const&) = delete;
+};
+
+// Cheap enough to check before every stage, it only reads a flag that ETW
+// sets when a session enables the provider.
+inline bool IsStageTracingEnabled()
+{
+    return TraceLoggingProviderEnabled(g_traceProvider, WINEVENT_LEVEL_VERBOSE, 0);
+}
+
+void TraceStage(PipelineStage stage, std::chrono::steady_clock::duration duration);
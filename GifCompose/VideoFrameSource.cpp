@@ -0,0 +1,234 @@
+﻿#include "pch.h"
+#include "VideoFrameSource.h"
+#include "BitmapLoader.h"
+
+namespace
+{
+    constexpr DWORD VideoStream = static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM);
+
+    // Media Foundation times are in 100ns units
+    int64_t ToHundredths(int64_t time)
+    {
+        return (time + 50000) / 100000;
+    }
+
+    // Sample times are rounded to 100ns, so a frame that should start right
+    // on a tick can be a little early
+    constexpr int64_t FrameTimeTolerance = 10000;
+
+    int64_t GetSampleTime(winrt::com_ptr<IMFSample> const& sample)
+    {
+        int64_t time = 0;
+        winrt::check_hresult(sample->GetSampleTime(&time));
+        return time;
+    }
+}
+
+bool IsVideoFile(std::filesystem::path const& path)
+{
+    if (!path.has_extension())
+    {
+        return false;
+    }
+    auto extension = path.extension().wstring();
+    std::transform(extension.begin(), extension.end(), extension.begin(), towlower);
+    return extension == L".mp4" ||
+        extension == L".m4v" ||
+        extension == L".mov" ||
+        extension == L".mkv" ||
+        extension == L".wmv" ||
+        extension == L".avi";
+}
+
+VideoFrameSource::VideoFrameSource(
+    PipelineDevice const& device,
+    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+    std::filesystem::path const& path,
+    uint32_t maxFramesPerSecond,
+    PipelineProfiler* profiler)
+{
+    m_device = device;
+    m_profiler = profiler;
+    if (maxFramesPerSecond != 0)
+    {
+        m_frameInterval = 10000000 / maxFramesPerSecond;
+    }
+
+    // The decoder uses the device from its own threads
+    m_device.D3DDevice.as<ID3D10Multithread>()->SetMultithreadProtected(TRUE);
+    uint32_t resetToken = 0;
+    winrt::check_hresult(MFCreateDXGIDeviceManager(&resetToken, m_deviceManager.put()));
+    winrt::check_hresult(m_deviceManager->ResetDevice(m_device.D3DDevice.get(), resetToken));
+
+    winrt::com_ptr<IMFAttributes> attributes;
+    winrt::check_hresult(MFCreateAttributes(attributes.put(), 3));
+    winrt::check_hresult(attributes->SetUnknown(MF_SOURCE_READER_D3D_MANAGER, m_deviceManager.get()));
+    winrt::check_hresult(attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE));
+    // Lets the reader convert from NV12 (or whatever the decoder outputs)
+    // with the GPU video processor
+    winrt::check_hresult(attributes->SetUINT32(MF_SOURCE_READER_ENABLE_ADVANCED_VIDEO_PROCESSING, TRUE));
+    auto hr = MFCreateSourceReaderFromURL(path.c_str(), attributes.get(), m_reader.put());
+    if (FAILED(hr))
+    {
+        throw winrt::hresult_error(hr, L"Could not open the video!");
+    }
+
+    winrt::check_hresult(m_reader->SetStreamSelection(static_cast<DWORD>(MF_SOURCE_READER_ALL_STREAMS), FALSE));
+    winrt::check_hresult(m_reader->SetStreamSelection(VideoStream, TRUE));
+    winrt::com_ptr<IMFMediaType> mediaType;
+    winrt::check_hresult(MFCreateMediaType(mediaType.put()));
+    winrt::check_hresult(mediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+    winrt::check_hresult(mediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_ARGB32));
+    hr = m_reader->SetCurrentMediaType(VideoStream, nullptr, mediaType.get());
+    if (FAILED(hr))
+    {
+        throw winrt::hresult_error(hr, L"The video can't be decoded to BGRA!");
+    }
+    UpdateFrameArea();
+    m_frameSize = { m_frameArea.right - m_frameArea.left, m_frameArea.bottom - m_frameArea.top };
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = m_frameSize.width;
+    desc.Height = m_frameSize.height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    desc.SampleDesc.Count = 1;
+    winrt::check_hresult(m_device.D3DDevice->CreateTexture2D(&desc, nullptr, m_frameTexture.put()));
+    m_frameBitmap = CreateBitmapFromTexture(m_frameTexture, d2dContext);
+}
+
+std::optional<SourceFrame> VideoFrameSource::TryGetNextFrame()
+{
+    // A frame is shown until the next one we keep starts, so we always read
+    // one sample ahead
+    if (!m_started)
+    {
+        m_nextSample = ReadKeptSample();
+        m_started = true;
+    }
+    if (!m_nextSample)
+    {
+        return std::nullopt;
+    }
+    auto sample = std::move(m_nextSample);
+    m_nextSample = ReadKeptSample();
+
+    // Rounding the start times instead of each duration keeps the delays
+    // from drifting
+    auto sampleTime = GetSampleTime(sample);
+    auto nextTime = m_nextSample ? GetSampleTime(m_nextSample) : m_streamEnd;
+    auto delay = std::clamp<int64_t>(ToHundredths(nextTime) - ToHundredths(sampleTime), 0, UINT16_MAX);
+
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    winrt::check_hresult(sample->GetBufferByIndex(0, buffer.put()));
+    auto dxgiBuffer = buffer.try_as<IMFDXGIBuffer>();
+    if (!dxgiBuffer)
+    {
+        throw winrt::hresult_error(MF_E_UNSUPPORTED_D3D_TYPE, L"The video wasn't decoded into a texture!");
+    }
+    winrt::com_ptr<ID3D11Texture2D> texture;
+    winrt::check_hresult(dxgiBuffer->GetResource(winrt::guid_of<ID3D11Texture2D>(), texture.put_void()));
+    uint32_t subresource = 0;
+    winrt::check_hresult(dxgiBuffer->GetSubresourceIndex(&subresource));
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    if (desc.Format != DXGI_FORMAT_B8G8R8A8_UNORM)
+    {
+        throw winrt::hresult_error(MF_E_UNSUPPORTED_D3D_TYPE, L"The video wasn't decoded to BGRA!");
+    }
+
+    {
+        StageTimer timer(m_profiler, PipelineStage::Upload);
+        auto lock = m_device.Lock();
+        m_device.D3DContext->CopySubresourceRegion(m_frameTexture.get(), 0, 0, 0, 0, texture.get(), subresource, &m_frameArea);
+    }
+
+    // Video has no alpha
+    SourceFrame frame;
+    frame.Bitmap = m_frameBitmap;
+    frame.Coverage.IsOpaque = true;
+    frame.Coverage.Bounds = { 0, 0, m_frameSize.width, m_frameSize.height };
+    frame.Delay = static_cast<uint16_t>(delay);
+    return frame;
+}
+
+winrt::com_ptr<IMFSample> VideoFrameSource::ReadSample()
+{
+    StageTimer timer(m_profiler, PipelineStage::Decode);
+    winrt::com_ptr<IMFSample> sample;
+    while (!sample)
+    {
+        DWORD flags = 0;
+        winrt::check_hresult(m_reader->ReadSample(VideoStream, 0, nullptr, &flags, nullptr, sample.put()));
+        if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
+        {
+            return nullptr;
+        }
+        if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED)
+        {
+            UpdateFrameArea();
+            auto width = m_frameArea.right - m_frameArea.left;
+            auto height = m_frameArea.bottom - m_frameArea.top;
+            if (width != m_frameSize.width || height != m_frameSize.height)
+            {
+                throw winrt::hresult_invalid_argument(L"All frames must be of the same size!");
+            }
+        }
+        // Gaps in the stream don't come with a sample
+    }
+
+    int64_t duration = 0;
+    if (FAILED(sample->GetSampleDuration(&duration)))
+    {
+        duration = 0;
+    }
+    m_streamEnd = std::max(m_streamEnd, GetSampleTime(sample) + duration);
+    return sample;
+}
+
+winrt::com_ptr<IMFSample> VideoFrameSource::ReadKeptSample()
+{
+    // Dropped samples are still decoded, but they're never copied or composed
+    while (auto sample = ReadSample())
+    {
+        if (m_frameInterval == 0)
+        {
+            return sample;
+        }
+        auto sampleTime = GetSampleTime(sample) + FrameTimeTolerance;
+        if (sampleTime >= m_nextTick)
+        {
+            m_nextTick += ((sampleTime - m_nextTick) / m_frameInterval + 1) * m_frameInterval;
+            return sample;
+        }
+    }
+    return nullptr;
+}
+
+void VideoFrameSource::UpdateFrameArea()
+{
+    winrt::com_ptr<IMFMediaType> mediaType;
+    winrt::check_hresult(m_reader->GetCurrentMediaType(VideoStream, mediaType.put()));
+    uint32_t width = 0;
+    uint32_t height = 0;
+    winrt::check_hresult(MFGetAttributeSize(mediaType.get(), MF_MT_FRAME_SIZE, &width, &height));
+    m_frameArea = { 0, 0, 0, width, height, 1 };
+
+    MFVideoArea aperture = {};
+    if (SUCCEEDED(mediaType->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE, reinterpret_cast<uint8_t*>(&aperture), sizeof(aperture), nullptr)))
+    {
+        auto left = static_cast<uint32_t>(std::max<int32_t>(aperture.OffsetX.value, 0));
+        auto top = static_cast<uint32_t>(std::max<int32_t>(aperture.OffsetY.value, 0));
+        m_frameArea.left = std::min(left, width);
+        m_frameArea.top = std::min(top, height);
+        m_frameArea.right = std::min(left + static_cast<uint32_t>(aperture.Area.cx), width);
+        m_frameArea.bottom = std::min(top + static_cast<uint32_t>(aperture.Area.cy), height);
+    }
+    if (m_frameArea.right <= m_frameArea.left || m_frameArea.bottom <= m_frameArea.top)
+    {
+        throw winrt::hresult_invalid_argument(L"The video has no frames!");
+    }
+}
@@ -0,0 +1,67 @@
+﻿#pragma once
+#include "FrameSource.h"
+#include "PipelineDevice.h"
+#include "PipelineProfiler.h"
+
+// True for the containers we hand to Media Foundation instead of treating
+// as a folder of frames.
+bool IsVideoFile(std::filesystem::path const& path);
+
+// Reads the frames of a video with a Media Foundation source reader. The
+// reader decodes and converts to BGRA on the GPU of the device we compose
+// on, and each frame is copied straight into a texture D2D can draw, so the
+// pixels never go through the CPU. Delays come from the sample times.
+//
+// If maxFramesPerSecond isn't 0, samples that start before the next tick
+// of that rate are skipped, and the kept frames are shown for the time
+// they cover.
+class VideoFrameSource : public FrameSource
+{
+public:
+    VideoFrameSource(
+        PipelineDevice const& device,
+        winrt::com_ptr<ID2D1DeviceContext> const& d2dContext,
+        std::filesystem::path const& path,
+        uint32_t maxFramesPerSecond = 0,
+        PipelineProfiler* profiler = nullptr);
+
+    D2D1_SIZE_U FrameSize() const override { return m_frameSize; }
+    std::optional<SourceFrame> TryGetNextFrame() override;
+
+private:
+    // Media Foundation has to stay started until the reader is released
+    struct MediaFoundationScope
+    {
+        MediaFoundationScope() { winrt::check_hresult(MFStartup(MF_VERSION, MFSTARTUP_NOSOCKET)); }
+        ~MediaFoundationScope() { MFShutdown(); }
+
+        MediaFoundationScope(MediaFoundationScope const&) = delete;
+        MediaFoundationScope& operator=(MediaFoundationScope const&) = delete;
+    };
+
+    // Returns null at the end of the stream
+    winrt::com_ptr<IMFSample> ReadSample();
+    winrt::com_ptr<IMFSample> ReadKeptSample();
+    void UpdateFrameArea();
+
+private:
+    MediaFoundationScope m_mediaFoundation;
+    PipelineDevice m_device;
+    PipelineProfiler* m_profiler = nullptr;
+    winrt::com_ptr<IMFDXGIDeviceManager> m_deviceManager;
+    winrt::com_ptr<IMFSourceReader> m_reader;
+    // The decoded surfaces can be larger than the picture, e.g. 1088 rows
+    // for 1080p
+    D3D11_BOX m_frameArea = {};
+    D2D1_SIZE_U m_frameSize = {};
+    // Frames are composed before the next one is read, so one texture is
+    // enough
+    winrt::com_ptr<ID3D11Texture2D> m_frameTexture;
+    winrt::com_ptr<ID2D1Bitmap1> m_frameBitmap;
+    // All in 100ns units
+    int64_t m_frameInterval = 0;
+    int64_t m_nextTick = 0;
+    int64_t m_streamEnd = 0;
+    bool m_started = false;
+    winrt::com_ptr<IMFSample> m_nextSample;
+};
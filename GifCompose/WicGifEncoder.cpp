@@ -0,0 +1,148 @@
+﻿#include "pch.h"
+#include "WicGifEncoder.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Foundation::Collections;
+    using namespace Windows::Graphics::Imaging;
+    using namespace Windows::Storage::Streams;
+}
+
+std::future<std::unique_ptr<GifEncoder>> WicGifEncoder::CreateAsync(
+    winrt::IRandomAccessStream stream,
+    uint32_t width,
+    uint32_t height,
+    PipelineProfiler* profiler)
+{
+    // Setup our encoder
+    auto encoder = co_await winrt::BitmapEncoder::CreateAsync(winrt::BitmapEncoder::GifEncoderId(), stream);
+    auto containerProperties = encoder.BitmapContainerProperties();
+    // Write the application block
+    // http://www.vurdalakov.net/misc/gif/netscape-looping-application-extension
+    std::string text("NETSCAPE2.0");
+    std::vector<uint8_t> chars(text.begin(), text.end());
+    WINRT_VERIFY(chars.size() == 11);
+    co_await containerProperties.SetPropertiesAsync(
+        {
+            { L"/appext/application", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt8Array(chars), winrt::PropertyType::UInt8Array) },
+            // The first value is the size of the block, which is the fixed value 3.
+            // The second value is the looping extension, which is the fixed value 1.
+            // The third and fourth values comprise an unsigned 2-byte integer (little endian).
+            //     The value of 0 means to loop infinitely.
+            // The final value is the block terminator, which is the fixed value 0.
+            { L"/appext/data", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt8Array({ 3, 1, 0, 0, 0 }), winrt::PropertyType::UInt8Array) },
+            // Frames may only cover part of the image, so the canvas size
+            // can't be inferred from the first one.
+            { L"/logscrdesc/Width", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt16(static_cast<uint16_t>(width)), winrt::PropertyType::UInt16) },
+            { L"/logscrdesc/Height", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt16(static_cast<uint16_t>(height)), winrt::PropertyType::UInt16) },
+        });
+    co_return std::make_unique<WicGifEncoder>(encoder, profiler);
+}
+
+WicGifEncoder::WicGifEncoder(winrt::BitmapEncoder const& encoder, PipelineProfiler* profiler)
+{
+    m_encoder = encoder;
+    m_profiler = profiler;
+
+    // Not disposing the frame lets partial frames draw on top of the
+    // previous one.
+    m_frameProperties = winrt::single_threaded_map<winrt::hstring, winrt::BitmapTypedValue>();
+    m_frameProperties.Insert(L"/grctlext/Disposal", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt8(1), winrt::PropertyType::UInt8));
+}
+
+winrt::IAsyncAction WicGifEncoder::WriteFrameAsync(GifFrame frame)
+{
+    if (frame.Palette)
+    {
+        throw winrt::hresult_invalid_argument(L"The WIC encoder only accepts BGRA8 frames!");
+    }
+
+    // BitmapEncoder doesn't know a frame is the last one until we flush, so
+    // we hold on to one frame. Committing the previous frame happens in the
+    // background while the caller produces the next one.
+    if (m_pendingCommit)
+    {
+        StageTimer timer(m_profiler, PipelineStage::GoToNextFrame);
+        co_await m_pendingCommit;
+        m_pendingCommit = nullptr;
+    }
+    if (m_stagedFrame.has_value())
+    {
+        co_await SetFrameAsync(m_stagedFrame.value());
+        m_pendingCommit = m_encoder.GoToNextFrameAsync();
+    }
+    m_stagedFrame = std::move(frame);
+}
+
+winrt::IAsyncAction WicGifEncoder::FinishAsync()
+{
+    if (m_pendingCommit)
+    {
+        StageTimer timer(m_profiler, PipelineStage::GoToNextFrame);
+        co_await m_pendingCommit;
+        m_pendingCommit = nullptr;
+    }
+    if (m_stagedFrame.has_value())
+    {
+        co_await SetFrameAsync(m_stagedFrame.value());
+        m_stagedFrame.reset();
+    }
+    StageTimer timer(m_profiler, PipelineStage::Flush);
+    co_await m_encoder.FlushAsync();
+}
+
+winrt::IAsyncAction WicGifEncoder::SetFrameAsync(GifFrame const& frame)
+{
+    StageTimer timer(m_profiler, PipelineStage::SetPixelData);
+    auto&& region = frame.Region;
+
+    // Write our frame delay and position
+    UpdateFrameProperty(L"/grctlext/Delay", frame.Delay, m_lastDelay);
+    UpdateFrameProperty(L"/imgdesc/Left", static_cast<uint16_t>(region.Left), m_lastLeft);
+    UpdateFrameProperty(L"/imgdesc/Top", static_cast<uint16_t>(region.Top), m_lastTop);
+    UpdateFrameProperty(L"/imgdesc/Width", static_cast<uint16_t>(region.Width), m_lastWidth);
+    UpdateFrameProperty(L"/imgdesc/Height", static_cast<uint16_t>(region.Height), m_lastHeight);
+    co_await m_encoder.BitmapProperties().SetPropertiesAsync(m_frameProperties);
+
+    // BitmapEncoder wants the pixels of the region packed together. Regions
+    // that span the whole width already are, so those are passed straight
+    // through. WIC picks the palette itself, so unchanged pixels are written
+    // out as they are rather than as transparent.
+    auto&& bytes = *frame.Bytes;
+    auto stride = frame.Width * 4;
+    auto regionStride = region.Width * 4;
+    auto regionSize = static_cast<size_t>(regionStride) * region.Height;
+    uint8_t const* regionData = nullptr;
+    if (region.Left == 0 && region.Width == frame.Width)
+    {
+        regionData = bytes.data() + (static_cast<size_t>(region.Top) * stride);
+    }
+    else
+    {
+        m_regionBytes.resize(regionSize);
+        for (uint32_t y = 0; y < region.Height; y++)
+        {
+            auto source = bytes.data() + (static_cast<size_t>(region.Top + y) * stride) + (region.Left * 4);
+            memcpy(m_regionBytes.data() + (static_cast<size_t>(y) * regionStride), source, regionStride);
+        }
+        regionData = m_regionBytes.data();
+    }
+    m_encoder.SetPixelData(
+        winrt::BitmapPixelFormat::Bgra8,
+        winrt::BitmapAlphaMode::Premultiplied,
+        region.Width,
+        region.Height,
+        1.0,
+        1.0,
+        winrt::array_view<uint8_t const>(regionData, regionData + regionSize));
+}
+
+void WicGifEncoder::UpdateFrameProperty(wchar_t const* key, uint16_t value, std::optional<uint16_t>& lastValue)
+{
+    if (lastValue != value)
+    {
+        m_frameProperties.Insert(key, winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt16(value), winrt::PropertyType::UInt16));
+        lastValue = value;
+    }
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+#include "GifEncoder.h"
+#include "PipelineProfiler.h"
+
+// Encodes frames using the WIC GIF encoder through BitmapEncoder.
+class WicGifEncoder : public GifEncoder
+{
+public:
+    static std::future<std::unique_ptr<GifEncoder>> CreateAsync(
+        winrt::Windows::Storage::Streams::IRandomAccessStream stream,
+        uint32_t width,
+        uint32_t height,
+        PipelineProfiler* profiler = nullptr);
+    WicGifEncoder(winrt::Windows::Graphics::Imaging::BitmapEncoder const& encoder, PipelineProfiler* profiler = nullptr);
+
+    winrt::Windows::Foundation::IAsyncAction WriteFrameAsync(GifFrame frame) override;
+    winrt::Windows::Foundation::IAsyncAction FinishAsync() override;
+
+private:
+    winrt::Windows::Foundation::IAsyncAction SetFrameAsync(GifFrame const& frame);
+    void UpdateFrameProperty(wchar_t const* key, uint16_t value, std::optional<uint16_t>& lastValue);
+
+private:
+    winrt::Windows::Graphics::Imaging::BitmapEncoder m_encoder{ nullptr };
+    winrt::Windows::Foundation::IAsyncAction m_pendingCommit{ nullptr };
+    std::optional<GifFrame> m_stagedFrame;
+    // Reused for regions that need to be packed
+    std::vector<uint8_t> m_regionBytes;
+    // The same properties are written for every frame, so values are only
+    // boxed again when they change.
+    winrt::Windows::Foundation::Collections::IMap<winrt::hstring, winrt::Windows::Graphics::Imaging::BitmapTypedValue> m_frameProperties{ nullptr };
+    std::optional<uint16_t> m_lastDelay;
+    std::optional<uint16_t> m_lastLeft;
+    std::optional<uint16_t> m_lastTop;
+    std::optional<uint16_t> m_lastWidth;
+    std::optional<uint16_t> m_lastHeight;
+    PipelineProfiler* m_profiler = nullptr;
+};
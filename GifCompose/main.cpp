@@ -1,28 +1,23 @@
 ﻿#include "pch.h"
+#include "Pipeline.h"
+#include "BatchRunner.h"
+#include "Benchmarks.h"
+#include "BufferedFileStream.h"
+#include "Tracing.h"
+#include "VideoFrameSource.h"
 
 namespace winrt
 {
     using namespace Windows::Foundation;
-    using namespace Windows::Foundation::Numerics;
-    using namespace Windows::UI;
-    using namespace Windows::Graphics;
-    using namespace Windows::Graphics::Imaging;
-    using namespace Windows::Storage;
-    using namespace Windows::Storage::Streams;
-}
-
-namespace util
-{
-    using namespace robmikh::common::uwp;
-    using namespace robmikh::common::desktop;
 }
 
 struct Options
 {
-    bool UseDebugLayer;
-    std::wstring FramesPath;
-    std::wstring BackgroundPath;
-    std::wstring OutputPath;
+    PipelineOptions Pipeline;
+    std::wstring BatchPath;
+    uint32_t MaxConcurrentJobs;
+    bool ShowStats;
+    BenchmarkOptions Benchmark;
 };
 
 enum class CliResult
@@ -30,166 +25,39 @@ enum class CliResult
     Valid,
     Invalid,
     Help,
+    Benchmark,
 };
 
 CliResult ParseOptions(std::vector<std::wstring> const& args, Options& options);
 void PrintHelp();
-std::future<std::vector<winrt::com_ptr<ID2D1Bitmap1>>> LoadBitmapsAsync(
-    winrt::com_ptr<ID3D11Device> d3dDevice, 
-    winrt::com_ptr<ID2D1DeviceContext> d2dContext, 
-    std::wstring path);
-winrt::com_ptr<ID2D1Bitmap1> CreateBitmapFromTexture(
-    winrt::com_ptr<ID3D11Texture2D> const& texture,
-    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext);
-winrt::IAsyncOperation<winrt::BitmapEncoder> CreateGifEncoderAsync(winrt::IRandomAccessStream stream);
+int RunBatchMode(Options const& options);
+void PrintStats(PipelineStats const& stats, std::chrono::steady_clock::duration elapsed);
+bool ParseUInt32(std::wstring const& value, uint32_t& result);
 
-winrt::IAsyncAction MainAsync(bool useDebugLayer, std::wstring framesPath, std::wstring backgroundPath, std::wstring outputPath)
+winrt::IAsyncAction MainAsync(Options options)
 {
-    // Initialize D3D
-    uint32_t flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
-    if (useDebugLayer)
-    {
-        flags |= D3D11_CREATE_DEVICE_DEBUG;
-    }
-    auto d3dDevice = util::CreateD3DDevice();
-    winrt::com_ptr<ID3D11DeviceContext> d3dContext;
-    d3dDevice->GetImmediateContext(d3dContext.put());
-
-    // Initialize D2D
-    auto debugLevel = D2D1_DEBUG_LEVEL_NONE;
-    if (useDebugLayer)
+    std::unique_ptr<PipelineStats> stats;
+    if (options.ShowStats)
     {
-        debugLevel = D2D1_DEBUG_LEVEL_INFORMATION;
+        stats = std::make_unique<PipelineStats>();
     }
-    auto d2dFactory = util::CreateD2DFactory(debugLevel);
-    auto d2dDevice = util::CreateD2DDevice(d2dFactory, d3dDevice);
-    winrt::com_ptr<ID2D1DeviceContext> d2dContext;
-    winrt::check_hresult(d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, d2dContext.put()));
-
-    // Load all frames
-    auto frames = co_await LoadBitmapsAsync(d3dDevice, d2dContext, framesPath);
-    if (frames.empty())
-    {
-        wprintf(L"No frames found, exiting...\n");
-        co_return;
-    }
-    // Make sure all the frames are the same size
-    auto frameSize = frames[0]->GetPixelSize();
-    for (auto&& frame : frames)
-    {
-        auto size = frame->GetPixelSize();
-        if (size.width != frameSize.width || size.height != frameSize.height)
-        {
-            throw winrt::hresult_invalid_argument(L"All frames must be of the same size!");
-        }
-    }
-
-    // Load the backgrounds
-    auto backgrounds = co_await LoadBitmapsAsync(d3dDevice, d2dContext, backgroundPath);
-    for (auto&& background : backgrounds)
-    {
-        auto size = background->GetPixelSize();
-        if (size.width != frameSize.width || size.height != frameSize.height)
-        {
-            throw winrt::hresult_invalid_argument(L"All backgrounds must be of the same size as the frames!");
-        }
-    }
-    
-    // Create our output file
-    auto outputFile = co_await util::CreateStorageFileFromPathAsync(outputPath);
-
-    // Create our render target
-    D3D11_TEXTURE2D_DESC desc = {};
-    desc.Width = frameSize.width;
-    desc.Height = frameSize.height;
-    desc.MipLevels = 1;
-    desc.ArraySize = 1;
-    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-    desc.Usage = D3D11_USAGE_DEFAULT;
-    desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
-    desc.SampleDesc.Count = 1;
-    winrt::com_ptr<ID3D11Texture2D> renderTargetTexture;
-    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, renderTargetTexture.put()));
-    auto renderTarget = CreateBitmapFromTexture(renderTargetTexture, d2dContext);
-
-    // Create our background template
-    winrt::com_ptr<ID3D11Texture2D> backgroundTemplateTexture;
-    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, backgroundTemplateTexture.put()));
-    auto backgroundTemplate = CreateBitmapFromTexture(backgroundTemplateTexture, d2dContext);
-
-    // Create our staging texture
-    desc.Usage = D3D11_USAGE_STAGING;
-    desc.BindFlags = 0;
-    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-    winrt::com_ptr<ID3D11Texture2D> stagingTexture;
-    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, stagingTexture.put()));
+    auto start = std::chrono::steady_clock::now();
+    co_await CreateGifAsync(options.Pipeline, stats.get());
+    auto elapsed = std::chrono::steady_clock::now() - start;
 
-    // Draw our background template
-    d2dContext->SetTarget(backgroundTemplate.get());
-    auto clearColor = D2D1_COLOR_F{ 1.0f, 1.0f, 1.0f, 1.0f };
-    d2dContext->BeginDraw();
-    d2dContext->Clear(&clearColor);
-    for (auto&& background : backgrounds)
-    {
-        d2dContext->DrawBitmap(background.get());
-    }
-    winrt::check_hresult(d2dContext->EndDraw());
-
-    // Iterate through each frame and compose it with the background template. After that,
-    // extract the image and encode it as a frame.
-    uint32_t frameDelay = 13;
-    d2dContext->SetTarget(renderTarget.get());
+    wprintf(L"Done!\n");
+    if (stats)
     {
-        auto stream = co_await outputFile.OpenAsync(winrt::FileAccessMode::ReadWrite);
-        auto encoder = co_await CreateGifEncoderAsync(stream);
-
-        for (auto i = 0; i < frames.size(); i++)
-        {
-            auto&& frame = frames[i];
-
-            // Render the frame
-            d2dContext->BeginDraw();
-            d2dContext->DrawBitmap(backgroundTemplate.get());
-            d2dContext->DrawBitmap(frame.get());
-            winrt::check_hresult(d2dContext->EndDraw());
-            d3dContext->CopyResource(stagingTexture.get(), renderTargetTexture.get());
-
-            // Get the bytes out of the render target
-            auto bytes = util::CopyBytesFromTexture(stagingTexture);
-
-            // Write our frame delay
-            co_await encoder.BitmapProperties().SetPropertiesAsync(
-                {
-                    { L"/grctlext/Delay", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt16(static_cast<uint16_t>(frameDelay)), winrt::PropertyType::UInt16) },
-                });
-
-            encoder.SetPixelData(
-                winrt::BitmapPixelFormat::Bgra8,
-                winrt::BitmapAlphaMode::Premultiplied,
-                frameSize.width,
-                frameSize.height,
-                1.0,
-                1.0,
-                bytes);
-
-            if (i < frames.size() - 1)
-            {
-                co_await encoder.GoToNextFrameAsync();
-            }
-        }
-
-        co_await encoder.FlushAsync();
+        PrintStats(*stats, elapsed);
     }
-    
-    wprintf(L"Done!\n");
-
-    co_return;
 }
 
 int __stdcall wmain(int argc, wchar_t* argv[])
 {
     // Initialize COM
     winrt::init_apartment(winrt::apartment_type::multi_threaded);
+    // Stages are traced whenever an ETW session enables the provider
+    TraceProviderRegistration traceRegistration;
 
     // CLI
     std::vector<std::wstring> args(argv + 1, argv + argc);
@@ -201,15 +69,48 @@ int __stdcall wmain(int argc, wchar_t* argv[])
         return 0;
     case CliResult::Invalid:
         return 1;
+    case CliResult::Benchmark:
+        return RunBenchmark(options.Benchmark) ? 0 : 1;
     default:
         break;
     }
 
-    MainAsync(options.UseDebugLayer, options.FramesPath, options.BackgroundPath, options.OutputPath).get();
+    if (!options.BatchPath.empty())
+    {
+        return RunBatchMode(options);
+    }
+
+    // Writing to stdout, so everything we print goes to stderr instead
+    if (options.Pipeline.OutputPath == L"-")
+    {
+        ReserveStdoutForOutput();
+    }
+
+    MainAsync(options).get();
 
     return 0;
 }
 
+int RunBatchMode(Options const& options)
+{
+    auto jobs = LoadBatchJobs(options.BatchPath);
+    std::unique_ptr<PipelineStats> stats;
+    if (options.ShowStats)
+    {
+        stats = std::make_unique<PipelineStats>();
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto failedCount = RunBatch(jobs, options.Pipeline, options.MaxConcurrentJobs, stats.get());
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    wprintf(L"Done! %zu of %zu jobs succeeded.\n", jobs.size() - failedCount, jobs.size());
+    if (stats)
+    {
+        PrintStats(*stats, elapsed);
+    }
+    return failedCount == 0 ? 0 : 1;
+}
+
 CliResult ParseOptions(std::vector<std::wstring> const& args, Options& options)
 {
     using namespace robmikh::common::wcli::impl;
@@ -219,30 +120,252 @@ CliResult ParseOptions(std::vector<std::wstring> const& args, Options& options)
         PrintHelp();
         return CliResult::Help;
     }
+    auto benchmarkString = GetFlagValue(args, L"-bench", L"/bench");
+    if (!benchmarkString.empty())
+    {
+        if (!TryParseBenchmarkType(benchmarkString, options.Benchmark.Type))
+        {
+            wprintf(L"Invalid benchmark! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+        options.Benchmark.FramesPath = GetFlagValue(args, L"-f", L"/f");
+        options.Benchmark.ResultsPath = GetFlagValue(args, L"-o", L"/o");
+        options.Benchmark.BaselinePath = GetFlagValue(args, L"-baseline", L"/baseline");
+        return CliResult::Benchmark;
+    }
+    // The paths come from the manifest in batch mode
+    auto batchPath = GetFlagValue(args, L"-batch", L"/batch");
     auto framesPath = GetFlagValue(args, L"-f", L"/f");
-    if (framesPath.empty())
+    if (framesPath.empty() && batchPath.empty())
     {
         wprintf(L"Invalid frames path! Use '-help' for help.\n");
         return CliResult::Invalid;
     }
     auto backgroundPath = GetFlagValue(args, L"-b", L"/b");
-    if (backgroundPath.empty())
+    if (backgroundPath.empty() && batchPath.empty())
     {
         wprintf(L"Invalid background path! Use '-help' for help.\n");
         return CliResult::Invalid;
     }
     auto outputPath = GetFlagValue(args, L"-o", L"/o");
-    if (outputPath.empty())
+    if (outputPath.empty() && batchPath.empty())
     {
         wprintf(L"Invalid output path! Use '-help' for help.\n");
         return CliResult::Invalid;
     }
+    uint32_t maxConcurrentJobs = 2;
+    auto maxConcurrentJobsString = GetFlagValue(args, L"-jobs", L"/jobs");
+    if (!maxConcurrentJobsString.empty() && (!ParseUInt32(maxConcurrentJobsString, maxConcurrentJobs) || maxConcurrentJobs == 0))
+    {
+        wprintf(L"Invalid job count! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto cachePath = GetFlagValue(args, L"-cache", L"/cache");
+    uint32_t decodeThreads = std::thread::hardware_concurrency();
+    auto decodeThreadsString = GetFlagValue(args, L"-decodeThreads", L"/decodeThreads");
+    if (!decodeThreadsString.empty() && (!ParseUInt32(decodeThreadsString, decodeThreads) || decodeThreads == 0))
+    {
+        wprintf(L"Invalid decode thread count! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    // Enough to keep every decode thread busy
+    uint32_t windowSize = decodeThreads * 2;
+    auto windowSizeString = GetFlagValue(args, L"-window", L"/window");
+    if (!windowSizeString.empty() && !ParseUInt32(windowSizeString, windowSize))
+    {
+        wprintf(L"Invalid window size! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    uint32_t readbackDepth = 3;
+    auto readbackDepthString = GetFlagValue(args, L"-readbackDepth", L"/readbackDepth");
+    if (!readbackDepthString.empty() && (!ParseUInt32(readbackDepthString, readbackDepth) || readbackDepth == 0))
+    {
+        wprintf(L"Invalid readback depth! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    uint32_t memoryBudget = 0;
+    auto memoryBudgetString = GetFlagValue(args, L"-memoryBudget", L"/memoryBudget");
+    if (!memoryBudgetString.empty() && (!ParseUInt32(memoryBudgetString, memoryBudget) || memoryBudget == 0))
+    {
+        wprintf(L"Invalid memory budget! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    uint32_t tileSize = 0;
+    auto tileSizeString = GetFlagValue(args, L"-tile", L"/tile");
+    if (!tileSizeString.empty() && (!ParseUInt32(tileSizeString, tileSize) || tileSize == 0 || tileSize > 16384))
+    {
+        wprintf(L"Invalid tile size! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto encoderType = EncoderType::Wic;
+    auto encoderString = GetFlagValue(args, L"-encoder", L"/encoder");
+    if (encoderString == L"native")
+    {
+        encoderType = EncoderType::Native;
+    }
+    else if (!encoderString.empty() && encoderString != L"wic")
+    {
+        wprintf(L"Invalid encoder! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    uint32_t encodeThreads = std::thread::hardware_concurrency();
+    auto encodeThreadsString = GetFlagValue(args, L"-encodeThreads", L"/encodeThreads");
+    if (!encodeThreadsString.empty() && (!ParseUInt32(encodeThreadsString, encodeThreads) || encodeThreads == 0))
+    {
+        wprintf(L"Invalid encode thread count! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto quantizerType = QuantizerType::Cpu;
+    auto quantizerString = GetFlagValue(args, L"-quantizer", L"/quantizer");
+    if (quantizerString == L"gpu")
+    {
+        quantizerType = QuantizerType::Gpu;
+    }
+    else if (!quantizerString.empty() && quantizerString != L"cpu")
+    {
+        wprintf(L"Invalid quantizer! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto paletteMode = PaletteMode::Frame;
+    auto paletteString = GetFlagValue(args, L"-palette", L"/palette");
+    if (paletteString == L"global")
+    {
+        paletteMode = PaletteMode::Global;
+    }
+    else if (!paletteString.empty() && paletteString != L"frame")
+    {
+        wprintf(L"Invalid palette mode! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto ditherMode = DitherMode::None;
+    auto ditherString = GetFlagValue(args, L"-dither", L"/dither");
+    if (ditherString == L"ordered")
+    {
+        ditherMode = DitherMode::Ordered;
+    }
+    else if (ditherString == L"fs")
+    {
+        ditherMode = DitherMode::FloydSteinberg;
+    }
+    else if (!ditherString.empty() && ditherString != L"none")
+    {
+        wprintf(L"Invalid dither mode! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto useDeltaEncoding = GetFlag(args, L"-delta", L"/delta");
+    if (quantizerType == QuantizerType::Gpu && encoderType != EncoderType::Native)
+    {
+        wprintf(L"The GPU quantizer requires the native encoder! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    if (ditherMode != DitherMode::None && (quantizerType != QuantizerType::Cpu || encoderType != EncoderType::Native))
+    {
+        wprintf(L"Dithering requires the native encoder and the CPU quantizer! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    if (tileSize != 0 && quantizerType == QuantizerType::Gpu)
+    {
+        wprintf(L"Tiles can't be used with the GPU quantizer! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    if (paletteMode == PaletteMode::Global && quantizerType != QuantizerType::Gpu)
+    {
+        wprintf(L"A global palette requires the GPU quantizer! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    if (useDeltaEncoding && quantizerType == QuantizerType::Gpu && paletteMode != PaletteMode::Global)
+    {
+        wprintf(L"Delta encoding with the GPU quantizer requires a global palette! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    uint32_t frameDelay = 13;
+    auto frameDelayString = GetFlagValue(args, L"-delay", L"/delay");
+    if (!frameDelayString.empty() && (!ParseUInt32(frameDelayString, frameDelay) || frameDelay > UINT16_MAX))
+    {
+        wprintf(L"Invalid frame delay! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto timingsPath = GetFlagValue(args, L"-timings", L"/timings");
+    uint32_t maxFrameRate = 0;
+    auto maxFrameRateString = GetFlagValue(args, L"-fps", L"/fps");
+    if (!maxFrameRateString.empty() && (!ParseUInt32(maxFrameRateString, maxFrameRate) || maxFrameRate == 0 || maxFrameRate > 100))
+    {
+        wprintf(L"Invalid frame rate! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    OutputScale scale;
+    auto scaleString = GetFlagValue(args, L"-scale", L"/scale");
+    if (!scaleString.empty() && !TryParseOutputScale(scaleString, scale))
+    {
+        wprintf(L"Invalid scale! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    if (!scale.IsIdentity() && tileSize != 0)
+    {
+        wprintf(L"Scaling can't be used with '-tile'! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto keepDuplicates = GetFlag(args, L"-keepDuplicates", L"/keepDuplicates");
+    AdapterSelection adapter;
+    auto adapterString = GetFlagValue(args, L"-adapter", L"/adapter");
+    if (!adapterString.empty() && !TryParseAdapterSelection(adapterString, adapter))
+    {
+        wprintf(L"Invalid adapter! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    if (outputPath == L"-" && encoderType != EncoderType::Native)
+    {
+        wprintf(L"Writing to stdout requires the native encoder! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto useAllAdapters = GetFlag(args, L"-multiGpu", L"/multiGpu");
+    if (useAllAdapters && (encoderType != EncoderType::Native || paletteMode == PaletteMode::Global || !batchPath.empty()))
+    {
+        wprintf(L"Multiple GPUs require the native encoder and per frame palettes, and can't be used in batch mode! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto useIncremental = GetFlag(args, L"-incremental", L"/incremental");
+    if (useIncremental && (encoderType != EncoderType::Native || paletteMode == PaletteMode::Global ||
+        !batchPath.empty() || useAllAdapters || outputPath == L"-"))
+    {
+        wprintf(L"Incremental mode requires the native encoder, per frame palettes and an output file, and can't be used with '-multiGpu' or in batch mode! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    if (IsVideoFile(framesPath) && (useAllAdapters || useIncremental || tileSize != 0))
+    {
+        wprintf(L"Videos can't be used with '-multiGpu', '-incremental' or '-tile'! Use '-help' for help.\n");
+        return CliResult::Invalid;
+    }
+    auto showStats = GetFlag(args, L"-stats", L"/stats");
     auto useDebugLayer = GetFlag(args, L"-dxDebug", L"/dxDebug");
 
-    options.UseDebugLayer = useDebugLayer;
-    options.FramesPath = framesPath;
-    options.BackgroundPath = backgroundPath;
-    options.OutputPath = outputPath;
+    options.Pipeline.UseDebugLayer = useDebugLayer;
+    options.Pipeline.Adapter = adapter;
+    options.Pipeline.FramesPath = framesPath;
+    options.Pipeline.BackgroundPath = backgroundPath;
+    options.Pipeline.OutputPath = outputPath;
+    options.Pipeline.CachePath = cachePath;
+    options.Pipeline.WindowSize = windowSize;
+    options.Pipeline.DecodeThreads = decodeThreads;
+    options.Pipeline.ReadbackDepth = readbackDepth;
+    options.Pipeline.MemoryBudget = static_cast<uint64_t>(memoryBudget) * 1024 * 1024;
+    options.Pipeline.TileSize = tileSize;
+    options.Pipeline.Encoder = encoderType;
+    options.Pipeline.EncodeThreads = encodeThreads;
+    options.Pipeline.UseDeltaEncoding = useDeltaEncoding;
+    options.Pipeline.FrameDelay = static_cast<uint16_t>(frameDelay);
+    options.Pipeline.TimingsPath = timingsPath;
+    options.Pipeline.MergeDuplicateFrames = !keepDuplicates;
+    options.Pipeline.MaxFrameRate = maxFrameRate;
+    options.Pipeline.Scale = scale;
+    options.Pipeline.Quantizer = quantizerType;
+    options.Pipeline.Palette = paletteMode;
+    options.Pipeline.Dither = ditherMode;
+    options.Pipeline.UseAllAdapters = useAllAdapters;
+    options.Pipeline.UseIncremental = useIncremental;
+    options.BatchPath = batchPath;
+    options.MaxConcurrentJobs = maxConcurrentJobs;
+    options.ShowStats = showStats;
     return CliResult::Valid;
 }
 
@@ -252,87 +375,139 @@ void PrintHelp()
     wprintf(L"An application that creates gifs from files.\n");
     wprintf(L"\n");
     wprintf(L"Arguments:\n");
-    wprintf(L"  -f <frames path>         (required) Path to the frame images.\n");
+    wprintf(L"  -f <frames path>         (required) Path to the frame images, or a video file (mp4, mov,\n");
+    wprintf(L"                                      mkv, wmv or avi) which is decoded on the GPU.\n");
     wprintf(L"  -b <backgrounds path>    (required) Path to the background images.\n");
     wprintf(L"  -o <output path>         (required) Path to the output image that will be created.\n");
+    wprintf(L"                                      Use - to write to stdout, which requires the native\n");
+    wprintf(L"                                      encoder.\n");
+    wprintf(L"  -batch <manifest path>   (optional) Create every gif listed in a json manifest instead:\n");
+    wprintf(L"                                      { \"jobs\": [ { \"frames\": \"...\", \"backgrounds\": \"...\",\n");
+    wprintf(L"                                      \"output\": \"...\" } ] }. Replaces -f, -b and -o, every\n");
+    wprintf(L"                                      other option applies to all jobs.\n");
+    wprintf(L"  -jobs <count>            (optional) Number of batch jobs to run at once. Defaults to 2.\n");
+    wprintf(L"  -cache <cache path>      (optional) Folder used to keep decoded images between runs.\n");
+    wprintf(L"  -window <count>          (optional) Number of frames to decode ahead of the encoder.\n");
+    wprintf(L"                                      Defaults to twice the decode thread count. 0 loads\n");
+    wprintf(L"                                      every frame up front.\n");
+    wprintf(L"  -decodeThreads <count>   (optional) Number of threads used to decode images.\n");
+    wprintf(L"                                      Defaults to the number of logical processors.\n");
+    wprintf(L"  -readbackDepth <count>   (optional) Number of frames that can be in flight between\n");
+    wprintf(L"                                      the GPU and the encoder. Defaults to 3.\n");
+    wprintf(L"  -memoryBudget <MB>       (optional) Memory each of the CPU and the GPU may use. The window,\n");
+    wprintf(L"                                      readback depth and encode threads are lowered to fit,\n");
+    wprintf(L"                                      and composition waits while usage is over the budget\n");
+    wprintf(L"                                      (or the budget the OS gives us).\n");
+    wprintf(L"  -tile <size>             (optional) Compose frames in square tiles of this many pixels, so\n");
+    wprintf(L"                                      video memory doesn't grow with the frame size. Frames\n");
+    wprintf(L"                                      larger than 16384 pixels are always tiled. Can't be\n");
+    wprintf(L"                                      used with the gpu quantizer.\n");
+    wprintf(L"  -encoder <wic|native>    (optional) GIF encoder to use. Defaults to wic.\n");
+    wprintf(L"                                      The native encoder encodes frames in parallel.\n");
+    wprintf(L"  -encodeThreads <count>   (optional) Number of threads used by the native encoder.\n");
+    wprintf(L"                                      Defaults to the number of logical processors.\n");
+    wprintf(L"  -quantizer <cpu|gpu>     (optional) Where frames are reduced to 256 colors. Defaults to cpu.\n");
+    wprintf(L"                                      The gpu quantizer requires the native encoder.\n");
+    wprintf(L"  -palette <frame|global>  (optional) Whether each frame gets its own palette or all frames\n");
+    wprintf(L"                                      share one. Defaults to frame. Global requires the\n");
+    wprintf(L"                                      gpu quantizer.\n");
+    wprintf(L"  -dither <none|ordered|fs>\n");
+    wprintf(L"                           (optional) How colors outside the palette are dithered. Defaults\n");
+    wprintf(L"                                      to none. Ordered is a Bayer matrix, fs is Floyd-Steinberg,\n");
+    wprintf(L"                                      which looks best but is the slowest. Requires the native\n");
+    wprintf(L"                                      encoder and the cpu quantizer.\n");
+    wprintf(L"  -delay <hundredths>      (optional) How long each frame is shown, in hundredths of a second.\n");
+    wprintf(L"                                      Defaults to 13.\n");
+    wprintf(L"  -timings <timings path>  (optional) Json file with per frame delays, which override -delay:\n");
+    wprintf(L"                                      { \"frames\": { \"0001.png\": 4 } }\n");
+    wprintf(L"  -fps <rate>              (optional) Drop frames so no more than this many are shown each\n");
+    wprintf(L"                                      second, between 1 and 100. The frames that are kept\n");
+    wprintf(L"                                      are shown for as long as the frames they replace.\n");
+    wprintf(L"  -scale <factor|WxH>      (optional) Resize frames on the GPU before they're encoded, either\n");
+    wprintf(L"                                      by a factor up to 1 or to a size. A side given as 0\n");
+    wprintf(L"                                      keeps the aspect ratio. Can't be used with -tile.\n");
+    wprintf(L"  -adapter <index|high-perf|low-power|warp|auto>\n");
+    wprintf(L"                           (optional) GPU to use. Defaults to the default adapter, or WARP if\n");
+    wprintf(L"                                      there is no GPU. Auto times a short burst of work on\n");
+    wprintf(L"                                      each adapter and uses the fastest one.\n");
+    wprintf(L"  -bench <diff|pipeline|lzw|regression>\n");
+    wprintf(L"                           (optional) Run a benchmark instead of creating a gif. The pipeline\n");
+    wprintf(L"                                      benchmark times each stage on generated frames. The lzw\n");
+    wprintf(L"                                      benchmark compresses the frames given with -f, or a\n");
+    wprintf(L"                                      generated screen capture. The regression benchmark checks\n");
+    wprintf(L"                                      both encoders' frames against frames composed on the CPU,\n");
+    wprintf(L"                                      writes its results to -o and fails if they're worse than\n");
+    wprintf(L"                                      the results given with -baseline.\n");
     wprintf(L"\n");
     wprintf(L"Flags:\n");
+    wprintf(L"  -delta             (optional) Only encode the part of each frame that changed.\n");
+    wprintf(L"  -keepDuplicates    (optional) Don't merge consecutive identical frames into one.\n");
+    wprintf(L"  -multiGpu          (optional) Split the frames between every GPU and join the results.\n");
+    wprintf(L"                                Requires the native encoder and per frame palettes.\n");
+    wprintf(L"  -incremental       (optional) Keep a manifest next to the output and only compose and encode\n");
+    wprintf(L"                                the frames that changed since the last run. Requires the\n");
+    wprintf(L"                                native encoder and per frame palettes.\n");
+    wprintf(L"  -stats             (optional) Print statistics about the work that was done, including\n");
+    wprintf(L"                                frames/sec and a histogram of how long each stage took.\n");
     wprintf(L"  -dxDebug           (optional) Use the DirectX and DirectML debug layers.\n");
     wprintf(L"\n");
 }
 
-std::future<std::vector<winrt::com_ptr<ID2D1Bitmap1>>> LoadBitmapsAsync(
-    winrt::com_ptr<ID3D11Device> d3dDevice,
-    winrt::com_ptr<ID2D1DeviceContext> d2dContext,
-    std::wstring path)
+void PrintStats(PipelineStats const& stats, std::chrono::steady_clock::duration elapsed)
 {
-    // Find all the files in the folder
-    auto fullPath = std::filesystem::canonical(path);
-    if (!std::filesystem::is_directory(fullPath))
+    auto&& composition = stats.Composition;
+    auto saved = 0.0;
+    if (composition.PixelsWithoutCoverage > 0)
     {
-        throw winrt::hresult_invalid_argument(L"Path was not a folder!");
+        saved = 100.0 * (1.0 - (static_cast<double>(composition.PixelsDrawn) / static_cast<double>(composition.PixelsWithoutCoverage)));
     }
-    std::vector<std::wstring> files;
-    for (auto const& entry : std::filesystem::directory_iterator(fullPath))
-    {
-        auto path = entry.path();
-        if (std::filesystem::is_regular_file(path) && path.has_extension())
-        {
-            auto extension = path.extension().wstring();
-            if (extension == L".png")
-            {
-                files.push_back(path.filename().wstring());
-            }
-        }
-    }
-    // Sort the filesnames
-    std::sort(files.begin(), files.end());
-
-    // Get the storage folder for the folder
-    auto folder = co_await winrt::StorageFolder::GetFolderFromPathAsync(fullPath.wstring());
-    std::vector<winrt::com_ptr<ID2D1Bitmap1>> bitmaps;
-    for (auto&& filename : files)
+    wprintf(L"\n");
+    wprintf(L"Composition:\n");
+    wprintf(L"  Frames composed:      %llu\n", composition.FramesComposed);
+    wprintf(L"  Duplicates merged:    %zu\n", stats.FramesMerged);
+    wprintf(L"  Backgrounds skipped:  %llu\n", composition.BackgroundsSkipped);
+    wprintf(L"  Pixels drawn:         %llu of %llu (%.1f%% saved)\n", composition.PixelsDrawn, composition.PixelsWithoutCoverage, saved);
+    wprintf(L"\n");
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    auto framesPerSecond = seconds > 0.0 ? static_cast<double>(stats.FrameCount) / seconds : 0.0;
+    wprintf(L"Throughput:\n");
+    wprintf(L"  Frames:               %zu in %.2f s (%.1f frames/sec)\n", stats.FrameCount, seconds, framesPerSecond);
+    wprintf(L"\n");
+    PrintStageSummaries(stats.Profiler);
+    wprintf(L"\n");
+    PrintStageHistograms(stats.Profiler);
+    wprintf(L"\n");
+    wprintf(L"Memory:\n");
+    wprintf(L"  Peak working set:     %.1f MB\n", static_cast<double>(GetPeakWorkingSet()) / (1024.0 * 1024.0));
+    wprintf(L"  Peak video memory:    %.1f MB\n", static_cast<double>(stats.Profiler.PeakVideoMemory()) / (1024.0 * 1024.0));
+    if (stats.SteadyStateFrames > 0)
     {
-        auto file = co_await folder.GetFileAsync(filename);
-        auto stream = co_await file.OpenReadAsync();
-
-        auto texture = co_await util::LoadTextureFromStreamAsync(stream, d3dDevice);
-        auto bitmap = CreateBitmapFromTexture(texture, d2dContext);
-        bitmaps.push_back(bitmap);
+        auto perFrame = static_cast<double>(stats.SteadyStateAllocations) / static_cast<double>(stats.SteadyStateFrames);
+        wprintf(L"  Allocations:          %llu over %zu frames (%.1f per frame)\n", stats.SteadyStateAllocations, stats.SteadyStateFrames, perFrame);
     }
-
-    co_return bitmaps;
-}
-
-winrt::com_ptr<ID2D1Bitmap1> CreateBitmapFromTexture(
-    winrt::com_ptr<ID3D11Texture2D> const& texture,
-    winrt::com_ptr<ID2D1DeviceContext> const& d2dContext)
-{
-    auto dxgiSurface = texture.as<IDXGISurface>();
-    winrt::com_ptr<ID2D1Bitmap1> bitmap;
-    winrt::check_hresult(d2dContext->CreateBitmapFromDxgiSurface(dxgiSurface.get(), nullptr, bitmap.put()));
-    return bitmap;
 }
 
-winrt::IAsyncOperation<winrt::BitmapEncoder> CreateGifEncoderAsync(winrt::IRandomAccessStream stream)
+bool ParseUInt32(std::wstring const& value, uint32_t& result)
 {
-    // Setup our encoder
-    auto encoder = co_await winrt::BitmapEncoder::CreateAsync(winrt::BitmapEncoder::GifEncoderId(), stream);
-    auto containerProperties = encoder.BitmapContainerProperties();
-    // Write the application block
-    // http://www.vurdalakov.net/misc/gif/netscape-looping-application-extension
-    std::string text("NETSCAPE2.0");
-    std::vector<uint8_t> chars(text.begin(), text.end());
-    WINRT_VERIFY(chars.size() == 11);
-    co_await containerProperties.SetPropertiesAsync(
+    // Only plain digits, std::stoul would also take leading whitespace and
+    // a minus sign (wrapping "-1" around to 4294967295)
+    if (value.empty())
+    {
+        return false;
+    }
+    uint64_t parsed = 0;
+    for (auto&& digit : value)
+    {
+        if (digit < L'0' || digit > L'9')
         {
-            { L"/appext/application", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt8Array(chars), winrt::PropertyType::UInt8Array) },
-            // The first value is the size of the block, which is the fixed value 3.
-            // The second value is the looping extension, which is the fixed value 1.
-            // The third and fourth values comprise an unsigned 2-byte integer (little endian).
-            //     The value of 0 means to loop infinitely.
-            // The final value is the block terminator, which is the fixed value 0.
-            { L"/appext/data", winrt::BitmapTypedValue(winrt::PropertyValue::CreateUInt8Array({ 3, 1, 0, 0, 0 }), winrt::PropertyType::UInt8Array) },
-        });
-    co_return encoder;
-}
\ No newline at end of file
+            return false;
+        }
+        parsed = (parsed * 10) + (digit - L'0');
+        if (parsed > UINT32_MAX)
+        {
+            return false;
+        }
+    }
+    result = static_cast<uint32_t>(parsed);
+    return true;
+}
@@ -2,6 +2,8 @@
 
 // Windows
 #include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
 
 // Must come before C++/WinRT
 #include <wil/cppwinrt.h>
@@ -10,6 +12,7 @@
 #include <winrt/Windows.Foundation.h>
 #include <winrt/Windows.Foundation.Collections.h>
 #include <winrt/Windows.Foundation.Numerics.h>
+#include <winrt/Windows.Data.Json.h>
 #include <winrt/Windows.Storage.h>
 #include <winrt/Windows.Storage.Streams.h>
 #include <winrt/Windows.System.h>
@@ -30,14 +33,36 @@
 #include <d2d1_3.h>
 #include <wincodec.h>
 
+// Media Foundation
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+
+// Shell
+#include <shcore.h>
+#include <psapi.h>
+
 // STL
 #include <vector>
 #include <string>
+#include <fstream>
+#include <string_view>
 #include <atomic>
 #include <memory>
 #include <algorithm>
 #include <mutex>
 #include <filesystem>
+#include <deque>
+#include <optional>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <array>
+#include <unordered_map>
+#include <chrono>
+#include <cmath>
 
 // robmikh.common
 #include <robmikh.common/composition.interop.h>